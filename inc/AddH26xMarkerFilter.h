@@ -9,14 +9,18 @@
 
 #pragma once
 
+#include <vector>
+
+#include "Metrics.h"
+
+// the input source writes the NAL after a 4 bytes headroom where the start code is added
+// once the input truncated a NAL, the NALs are read in a private buffer big enough for it and delivered in pieces
 class AddH26xMarkerFilter : public FramedFilter {
 	public:
-		AddH26xMarkerFilter (UsageEnvironment& env, FramedSource* inputSource): FramedFilter(env, inputSource) {
-			m_bufferSize = OutPacketBuffer::maxSize;
-			m_buffer = new unsigned char[m_bufferSize];
+		AddH26xMarkerFilter (UsageEnvironment& env, FramedSource* inputSource): FramedFilter(env, inputSource), 
+			m_pendingSize(0), m_pendingOffset(0) {
 		}
 		virtual ~AddH26xMarkerFilter () {
-			delete [] m_buffer;
 		}
 		
 	private:
@@ -29,43 +33,120 @@ class AddH26xMarkerFilter : public FramedFilter {
 			sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
 		}
 				
+		static void afterGettingOverflow(void* clientData, unsigned frameSize,
+						 unsigned numTruncatedBytes,
+						 struct timeval presentationTime,
+						 unsigned durationInMicroseconds) {
+			AddH26xMarkerFilter* sink = (AddH26xMarkerFilter*)clientData;
+			sink->afterGettingOverflow(frameSize, numTruncatedBytes, presentationTime);
+		}
+
+		static void readNextStub(void* clientData) {
+			((AddH26xMarkerFilter*)clientData)->doGetNextFrame();
+		}
+
+		// a truncated NAL cannot be decoded, it is dropped and the next ones are read in a buffer that fit it
+		bool dropTruncated(unsigned frameSize, unsigned numTruncatedBytes) 
+		{
+			if (numTruncatedBytes == 0) 
+			{
+				return false;
+			}
+			unsigned size = frameSize + numTruncatedBytes + 4;
+			envir() << "AddH26xMarkerFilter: NAL dropped size:" << size - 4 << " bufferSize:" << fMaxSize << "\n";
+			if (m_overflow.size() < size) 
+			{
+				CopyMetrics::allocated(CopyMetrics::MARKER, size - m_overflow.size());
+				m_overflow.resize(size);
+			}
+			// read the next NAL from the event loop, not from the callback of the input
+			nextTask() = envir().taskScheduler().scheduleDelayedTask(0, readNextStub, this);
+			return true;
+		}
+
 		void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime) 
 		{
+			if (this->dropTruncated(frameSize, numTruncatedBytes)) 
+			{
+				return;
+			}
+			static const unsigned char marker[] = {0,0,0,1};
 			fPresentationTime = presentationTime;
 			fDurationInMicroseconds = 0;
-			if (numTruncatedBytes > 0) 
+			memcpy(fTo, marker, sizeof(marker));
+			fFrameSize = frameSize + sizeof(marker);
+			fNumTruncatedBytes = 0;
+			afterGetting(this);
+		}
+
+		void afterGettingOverflow(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime) 
+		{
+			if (this->dropTruncated(frameSize, numTruncatedBytes)) 
 			{
-				envir() << "AddH26xMarkerFilter::afterGettingFrame(): The input frame data was too large for our buffer size truncated:" << numTruncatedBytes << " bufferSize:" << m_bufferSize << "\n";
-				m_bufferSize += numTruncatedBytes;
-				delete[] m_buffer;
-				m_buffer = new unsigned char[m_bufferSize];
-				fFrameSize = 0;
-			} else {
-				char marker[] = {0,0,0,1};
-				fFrameSize = frameSize + sizeof(marker);
-				if (fFrameSize > fMaxSize) {
-					fNumTruncatedBytes = fFrameSize - fMaxSize; 
-					envir() << "AddH26xMarkerFilter::afterGettingFrame(): buffer too small truncated:" << fNumTruncatedBytes << " bufferSize:" << fFrameSize << "\n";
-				} else {
-					fNumTruncatedBytes = 0;
-					memcpy(fTo, marker, sizeof(marker));
-					memcpy(fTo+sizeof(marker), m_buffer, frameSize); 
-				}
+				return;
+			}
+			static const unsigned char marker[] = {0,0,0,1};
+			memcpy(&m_overflow[0], marker, sizeof(marker));
+			m_pendingSize = frameSize + sizeof(marker);
+			m_pendingOffset = 0;
+			m_pendingTime = presentationTime;
+			this->deliverPending();
+		}
+
+		// the consumer parse a byte stream, the pieces of the NAL are sent as consecutive frames
+		void deliverPending() 
+		{
+			unsigned size = m_pendingSize - m_pendingOffset;
+			if (size > fMaxSize) 
+			{
+				size = fMaxSize;
 			}
+			memcpy(fTo, &m_overflow[m_pendingOffset], size);
+			CopyMetrics::copied(CopyMetrics::MARKER, size);
+			m_pendingOffset += size;
+			fPresentationTime = m_pendingTime;
+			fDurationInMicroseconds = 0;
+			fFrameSize = size;
+			fNumTruncatedBytes = 0;
 			afterGetting(this);
 		}
 		
 		virtual void doGetNextFrame() {
-			if (fInputSource != NULL) 
+			if (m_pendingOffset < m_pendingSize) 
+			{
+				this->deliverPending();
+			}
+			else if (fMaxSize <= 4) 
+			{
+				envir() << "AddH26xMarkerFilter::doGetNextFrame(): buffer too small for the marker bufferSize:" << fMaxSize << "\n";
+				handleClosure();
+			}
+			else if (fInputSource != NULL) 
 			{
-				fInputSource->getNextFrame(m_buffer, m_bufferSize,
-						afterGettingFrame, this,
-						handleClosure, this);
+				if (fMaxSize >= m_overflow.size()) 
+				{
+					// in place, the NALs that were truncated fit the buffer of the consumer
+					fInputSource->getNextFrame(fTo + 4, fMaxSize - 4,
+							afterGettingFrame, this,
+							handleClosure, this);
+				}
+				else 
+				{
+					fInputSource->getNextFrame(&m_overflow[4], m_overflow.size() - 4,
+							afterGettingOverflow, this,
+							handleClosure, this);
+				}
 			}			
 		}
-		
-		unsigned char* m_buffer;
-		unsigned int m_bufferSize;
-};
 
+		virtual void doStopGettingFrames() {
+			envir().taskScheduler().unscheduleDelayedTask(nextTask());
+			FramedFilter::doStopGettingFrames();
+		}
 
+	private:
+		std::vector<unsigned char> m_overflow;        // empty until the input truncates a NAL
+		unsigned                   m_pendingSize;
+		unsigned                   m_pendingOffset;
+		struct timeval             m_pendingTime;
+};
@@ -0,0 +1,39 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AnnexBScanner.h
+**
+** Single pass Annex-B start code scanner for H264/H265 byte streams
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <list>
+
+class AnnexBScanner
+{
+	public:
+		// ---------------------------------
+		// NAL unit inside the scanned buffer (no copy)
+		// ---------------------------------
+		struct Nal
+		{
+			Nal(unsigned char* buffer, size_t size, int header) : m_buffer(buffer), m_size(size), m_header(header) {}
+
+			unsigned char* m_buffer;
+			size_t         m_size;
+			int            m_header;   // first byte of the NAL header
+		};
+
+	public:
+		// return the first 00 00 01 in [begin, end[, or NULL
+		static const unsigned char* findStartCode(const unsigned char* begin, const unsigned char* end);
+
+		// find all the NAL units of a buffer in one sweep
+		static std::list<Nal> scan(unsigned char* buffer, size_t size, bool keepMarker);
+};
@@ -0,0 +1,125 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AsyncLogger.h
+**
+** Logging for the per-frame paths
+**
+** ALOG(level) is used like LOG(level). Levels above LOG_COMPILE_LEVEL are
+** removed by the compiler, disabled levels don't evaluate the arguments.
+** The records are formatted in a fixed buffer and pushed in a ring owned by
+** the calling thread, a background thread writes them with LOG, so a slow
+** output never blocks the capture or the event loop. When a ring is full
+** the record is dropped and counted. The ring of an exited thread is reused
+** by a later thread once it is written.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <list>
+#include <ostream>
+#include <streambuf>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "logger.h"
+
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL DEBUG
+#endif
+
+#ifdef HAVE_LOG4CPP
+#define LOG_LEVEL_VALUE(__level)   log4cpp::Priority::__level
+#define LOG_LEVEL_ENABLED(__level) log4cpp::Category::getRoot().isPriorityEnabled(log4cpp::Priority::__level)
+#else
+#define LOG_LEVEL_VALUE(__level)   __level
+#define LOG_LEVEL_ENABLED(__level) (__level<=LogLevel)
+#endif
+
+#define ALOG(__level) \
+	if ( (LOG_LEVEL_VALUE(__level) > LOG_LEVEL_VALUE(LOG_COMPILE_LEVEL)) || !LOG_LEVEL_ENABLED(__level) ) {} \
+	else AsyncLogger::Record(LOG_LEVEL_VALUE(__level), __FILE__, __LINE__).stream()
+
+class AsyncLogger
+{
+	public:
+		static const unsigned int RING_SIZE = 1024;
+		static const unsigned int MESSAGE_SIZE = 256;
+
+		// start/stop the thread that writes the records, without it they are written synchronously
+		static void start();
+		static void stop();
+
+		static uint64_t dropped() { return s_dropped.load(std::memory_order_relaxed); }
+
+		// ---------------------------------
+		// one log record
+		// ---------------------------------
+		class Record
+		{
+			public:
+				Record(int level, const char* file, int line);
+				~Record();
+				std::ostream & stream() { return m_stream; }
+
+			private:
+				// write in the fixed buffer, what doesn't fit is lost
+				class Buffer : public std::streambuf
+				{
+					public:
+						Buffer(char* buffer, size_t size) { setp(buffer, buffer + size); }
+						size_t size() const { return pptr() - pbase(); }
+				};
+
+				int          m_level;
+				char         m_message[MESSAGE_SIZE];
+				Buffer       m_buffer;
+				std::ostream m_stream;
+		};
+
+	private:
+		struct Entry
+		{
+			int          m_level;
+			unsigned int m_size;
+			char         m_message[MESSAGE_SIZE];
+		};
+
+		// single producer (the owning thread), single consumer (the writer thread)
+		struct Ring
+		{
+			Ring();
+
+			bool                  m_free;         // its thread exited, guarded by s_mutex
+			std::atomic<uint64_t> m_head;
+			std::atomic<uint64_t> m_tail;
+			Entry                 m_entries[RING_SIZE];
+		};
+
+		// gives the ring back when its thread exits
+		struct RingOwner
+		{
+			RingOwner() : m_ring(NULL) {}
+			~RingOwner();
+			Ring* m_ring;
+		};
+
+		static void push(int level, const char* message, size_t size);
+		static void output(int level, const char* message, size_t size);
+		static Ring* ring();
+		static void drain();
+		static void run();
+
+	private:
+		static std::atomic<bool>     s_running;
+		static std::atomic<uint64_t> s_dropped;
+		static std::mutex            s_mutex;
+		static std::list<Ring*>      s_rings;
+		static std::thread           s_thread;
+};
@@ -0,0 +1,78 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** BufferSender.h
+**
+** Send memory buffers to a socket without copying them
+**
+** The buffers are written with scatter/gather sends from the live555 event
+** loop, each buffer keeps a reference on its owner until it is sent. File
+** ranges are sent with sendfile(). When the connection also reads the
+** socket, its read handler stays armed while the sender waits to write.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <vector>
+#include <memory>
+
+#include "UsageEnvironment.hh"
+
+class BufferSender
+{
+	public:
+		typedef void (AfterSendingFunc)(void* clientData);
+
+		BufferSender(UsageEnvironment& env, int socket);
+		virtual ~BufferSender();
+
+		// add a buffer, owner keeps the memory alive until it is sent
+		void add(const std::shared_ptr<const void> & owner, const char* data, size_t size);
+		// add a file range, the descriptor is closed when the sender is deleted
+		void addFile(int fd, off_t offset, size_t size);
+		// send the buffers, afterFunc is called when all is sent or on error
+		void start(AfterSendingFunc* afterFunc, void* afterClientData);
+
+		// the socket is also read, handler is called when it is readable, also while waiting to write
+		void setReadHandler(TaskScheduler::BackgroundHandlerProc* handler, void* clientData) { m_readHandler = handler; m_readClientData = clientData; }
+
+		size_t pending() const { return m_pending; }
+		// the connection failed before all was sent
+		bool failed() const    { return m_failed; }
+
+	private:
+		static void socketHandler(void* clientData, int mask);
+		void sendPending();
+		void stopWaiting();
+		void done();
+
+	private:
+		struct Buffer
+		{
+			std::shared_ptr<const void> m_owner;
+			const char*                 m_data;
+			size_t                      m_size;
+			int                         m_fd;     // -1 for a memory buffer
+			off_t                       m_offset;
+		};
+		ssize_t sendBuffers();
+		ssize_t sendFile(Buffer & buffer);
+
+		UsageEnvironment&    m_env;
+		int                  m_socket;
+		std::vector<Buffer>  m_buffers;
+		std::vector<int>     m_files;
+		size_t               m_current;
+		size_t               m_pending;
+		bool                 m_waiting;
+		bool                 m_failed;
+		AfterSendingFunc*    m_afterFunc;
+		void*                m_afterClientData;
+		TaskScheduler::BackgroundHandlerProc* m_readHandler;
+		void*                m_readClientData;
+};
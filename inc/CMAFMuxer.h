@@ -0,0 +1,78 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CMAFMuxer.h
+**
+** Package H264/H265 NAL units in CMAF fragmented MP4
+**
+** Each access unit is delivered as a fragment (moof+mdat), the parameter
+** sets are kept out of the samples in the init segment (ftyp+moov). The
+** access unit is complete when the first NAL of the next one is received,
+** its duration is the difference of the presentation times (no B-frames).
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "MemoryBufferSink.h"
+
+class CMAFMuxer : public FramedFilter
+{
+	public:
+		static CMAFMuxer* createNew(UsageEnvironment& env, FramedSource* inputSource, const std::string& format, MemoryBufferSink* sink)
+		{
+			return new CMAFMuxer(env, inputSource, format, sink);
+		}
+
+		// init segment, NULL until the parameter sets are received
+		std::shared_ptr<const std::string> getInitSegment() const { return m_init; }
+		// RFC 6381 codecs of the stream
+		const std::string & getCodecs() const                      { return m_codecs; }
+
+	protected:
+		CMAFMuxer(UsageEnvironment& env, FramedSource* inputSource, const std::string& format, MemoryBufferSink* sink);
+
+		virtual void doGetNextFrame();
+
+		static void afterGettingFrame(void* clientData, unsigned frameSize,
+						 unsigned numTruncatedBytes,
+						 struct timeval presentationTime,
+						 unsigned durationInMicroseconds) {
+			CMAFMuxer* muxer = (CMAFMuxer*)clientData;
+			muxer->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
+		}
+		void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+
+	private:
+		bool deliverFragment(const timeval & next);
+		void dropAccessUnit(const timeval & time);
+		void updateInit();
+		bool parseH264Sps(unsigned int & width, unsigned int & height);
+		bool parseH265Sps(unsigned int & width, unsigned int & height, std::string & hvcc);
+
+	private:
+		bool                               m_h265;
+		MemoryBufferSink*                  m_sink;
+		std::vector<unsigned char>         m_buffer;
+		size_t                             m_auStart;
+		size_t                             m_end;
+		bool                               m_hasAu;
+		bool                               m_auKey;
+		timeval                            m_auTime;
+		timeval                            m_firstTime;
+		timeval                            m_dropTime;
+		uint32_t                           m_sequence;
+		std::string                        m_vps;
+		std::string                        m_sps;
+		std::string                        m_pps;
+		std::shared_ptr<const std::string> m_init;
+		std::string                        m_codecs;
+};
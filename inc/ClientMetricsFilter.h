@@ -0,0 +1,76 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** ClientMetricsFilter.h
+**
+** Pass-through filter that count what is sent to one RTSP client
+**
+** The StreamReplicator reads its input in the buffer of one replica, the
+** others get a copy. A delivery is counted as a replica copy when the buffer
+** of the filter is not the one the device source of the replicator wrote in.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "Metrics.h"
+#include "Tracer.h"
+#include "RSDeviceSource.h"
+#include "DeviceSource.h"
+
+class ClientMetricsFilter : public FramedFilter {
+	public:
+		ClientMetricsFilter (UsageEnvironment& env, StreamReplicator* replicator, unsigned int clientSessionId)
+			: FramedFilter(env, replicator->createStreamReplica()), m_replicator(replicator), m_metrics(clientSessionId) {
+		}
+
+	private:
+		static void afterGettingFrame(void* clientData, unsigned frameSize,
+						 unsigned numTruncatedBytes,
+						 struct timeval presentationTime,
+						 unsigned durationInMicroseconds) {
+			ClientMetricsFilter* filter = (ClientMetricsFilter*)clientData;
+			filter->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+		}
+
+		void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+		{
+			m_metrics.sent(frameSize);
+			const unsigned char* input = inputBuffer(m_replicator->inputSource());
+			if ( (input != NULL) && (fTo != input) ) {
+				CopyMetrics::copied(CopyMetrics::REPLICA, frameSize);
+			}
+			fFrameSize = frameSize;
+			fNumTruncatedBytes = numTruncatedBytes;
+			fPresentationTime = presentationTime;
+			fDurationInMicroseconds = durationInMicroseconds;
+			TraceScope trace("client_send", Tracer::currentFrame());
+			afterGetting(this);
+		}
+
+		// the input source write directly in the buffer of our consumer
+		virtual void doGetNextFrame() {
+			if (fInputSource != NULL)
+			{
+				fInputSource->getNextFrame(fTo, fMaxSize,
+						afterGettingFrame, this,
+						handleClosure, this);
+			}
+		}
+
+		// buffer the device source writes in, NULL for another source
+		static const unsigned char* inputBuffer(FramedSource* source) {
+			const unsigned char* buffer = NULL;
+			if (RSDeviceSource* rsSource = dynamic_cast<RSDeviceSource*>(source)) {
+				buffer = rsSource->getDeliveryBuffer();
+			} else if (V4L2DeviceSource* v4l2Source = dynamic_cast<V4L2DeviceSource*>(source)) {
+				buffer = v4l2Source->getDeliveryBuffer();
+			}
+			return buffer;
+		}
+
+		StreamReplicator* m_replicator;
+		ClientMetrics     m_metrics;
+};
@@ -0,0 +1,36 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** DepthCodec.h
+**
+** Lossless compression of the 16 bits depth frames for the browser viewers
+**
+** The little endian samples are predicted from the previous one, the
+** differences are zigzag coded on 1 or 2 bytes and the runs of equal samples
+** (the holes of a depth map) are coded with a single byte :
+**   0xxxxxxx                   difference 0..127
+**   10xxxxxx xxxxxxxx          difference 128..16383
+**   11000000 vvvvvvvv vvvvvvvv sample value (big endian)
+**   11nnnnnn                   n+1 samples equal to the previous one (2..64)
+** The decoder of index.html reverses it.
+**
+** The snapshots are 16 bits grayscale PNG, the rows use the Sub filter and
+** are deflated with zlib when it is available, otherwise they are stored.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+
+class DepthCodec
+{
+	public:
+		// encode the samples of a frame, a trailing odd byte is ignored
+		static void encodeDelta(const char* data, size_t size, std::string & out);
+
+		// encode a frame of little endian samples as PNG, false if the frame is smaller than width x height
+		static bool encodePNG(const char* data, size_t size, int width, int height, std::string & out);
+};
@@ -11,6 +11,35 @@
 #ifndef DEVICE_INTERFACE
 #define DEVICE_INTERFACE
 
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <atomic>
+
+// ---------------------------------
+// Driver buffer kept dequeued while frames point in it
+// ---------------------------------
+class CaptureBuffer
+{
+	public:
+		CaptureBuffer() : m_data(NULL), m_size(0), m_sequence(0), m_refs(0) { timerclear(&m_timestamp); }
+		virtual ~CaptureBuffer() {}
+
+		void addRef()  { m_refs.fetch_add(1, std::memory_order_relaxed); }
+		void release() { if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) this->requeue(); }
+
+		char*    m_data;
+		size_t   m_size;
+		uint32_t m_sequence;
+		timeval  m_timestamp;
+
+	protected:
+		// give the buffer back to the driver
+		virtual void requeue() = 0;
+
+		std::atomic<int> m_refs;
+};
 
 // ---------------------------------
 // Device Interface
@@ -25,6 +54,11 @@ class DeviceInterface
 		virtual int getHeight() = 0;	
 		virtual int getCaptureFormat() = 0;
 		virtual ~DeviceInterface() {};
+
+		// zero-copy capture, dequeue return a buffer with one reference
+		virtual CaptureBuffer* dequeue()    { return NULL; }
+		virtual unsigned int getBufferCount() { return 0; }
+		virtual unsigned int getBuffersInFlight() { return 0; }
 };
 
 
@@ -15,6 +15,7 @@
 
 #include <string>
 #include <list> 
+#include <vector>
 #include <iostream>
 #include <iomanip>
 
@@ -24,41 +25,41 @@
 #include <liveMedia.hh>
 
 #include "DeviceInterface.h"
+#include "Metrics.h"
+#include "Tracer.h"
 
 class V4L2DeviceSource: public FramedSource
 {
 	public:
 		// ---------------------------------
-		// Captured frame
+		// Captured frame, the NALs of one access unit share the same id
 		// ---------------------------------
 		struct Frame
 		{
-			Frame(char* buffer, int size, timeval timestamp) : m_buffer(buffer), m_size(size), m_timestamp(timestamp) {};
+			enum Flags
+			{
+				KEYFRAME      = 1,   // IDR/IRAP, start a new decode chain
+				CONFIG        = 2,   // parameter set
+				NON_REFERENCE = 4    // no other picture depends on it
+			};
+
+			Frame(char* buffer, int size, timeval timestamp, uint64_t id, int flags, CaptureBuffer* captureBuffer) 
+				: m_buffer(buffer), m_size(size), m_timestamp(timestamp), m_id(id), m_flags(flags), m_captureBuffer(captureBuffer) {
+				if (m_captureBuffer) m_captureBuffer->addRef();
+			};
 			Frame(const Frame&);
 			Frame& operator=(const Frame&);
-			~Frame()  { delete [] m_buffer; };
+			~Frame()  { 
+				if (m_captureBuffer) m_captureBuffer->release(); 
+				else delete [] m_buffer; 
+			};
 			
 			char* m_buffer;
 			unsigned int m_size;
 			timeval m_timestamp;
-		};
-		
-		// ---------------------------------
-		// Compute simple stats
-		// ---------------------------------
-		class Stats
-		{
-			public:
-				Stats(const std::string & msg) : m_fps(0), m_fps_sec(0), m_size(0), m_msg(msg) {};
-				
-			public:
-				int notify(int tv_sec, int framesize);
-			
-			protected:
-				int m_fps;
-				int m_fps_sec;
-				int m_size;
-				const std::string m_msg;
+			uint64_t m_id;
+			int m_flags;
+			CaptureBuffer* m_captureBuffer;   // driver buffer m_buffer points in, NULL if m_buffer is owned
 		};
 		
 	public:
@@ -68,6 +69,8 @@ class V4L2DeviceSource: public FramedSource
 		int getWidth() { return m_device->getWidth(); };	
 		int getHeight() { return m_device->getHeight(); };	
 		int getCaptureFormat() { return m_device->getCaptureFormat(); };	
+		// buffer of the consumer being delivered
+		const unsigned char* getDeliveryBuffer() const { return fTo; };
 
 	protected:
 		V4L2DeviceSource(UsageEnvironment& env, DeviceInterface * device, int outputFd, unsigned int queueSize, bool useThread);
@@ -80,12 +83,25 @@ class V4L2DeviceSource: public FramedSource
 		void deliverFrame();
 		static void incomingPacketHandlerStub(void* clientData, int mask) { ((V4L2DeviceSource*) clientData)->incomingPacketHandler(); };
 		void incomingPacketHandler();
-		int getNextFrame();
-		void processFrame(char * frame, int frameSize, const timeval &ref);
-		void queueFrame(char * frame, int frameSize, const timeval &tv);
+		// result of a read from the device
+		enum ReadStatus
+		{
+			READ_ERROR,     // the device failed, the capture stops
+			READ_SKIPPED,   // nothing to deliver, e.g. a driver buffer flagged in error
+			READ_FRAME      // a frame was read and queued
+		};
+		ReadStatus getNextFrame();
+		void releaseCaptureBuffer();
+		void processFrame(char * frame, int frameSize, const timeval &ref, CaptureBuffer* captureBuffer = NULL);
+		void queueFrame(char * frame, int frameSize, const timeval &tv, int flags, CaptureBuffer* captureBuffer);
+		bool dropAccessUnit();
 
 		// split packet in frames
 		virtual std::list< std::pair<unsigned char*,size_t> > splitFrames(unsigned char* frame, unsigned frameSize);
+		// Frame::Flags of a frame returned by splitFrames
+		virtual int getFrameFlags(unsigned char* frame, size_t frameSize) { return 0; }
+		// a frame is given to the consumer, called with the mutex locked
+		virtual void frameDelivered(const Frame & frame) {}
 		
 		// overide FramedSource
 		virtual void doGetNextFrame();	
@@ -93,8 +109,11 @@ class V4L2DeviceSource: public FramedSource
 					
 	protected:
 		std::list<Frame*> m_captureQueue;
-		Stats m_in;
-		Stats m_out;
+		SourceMetrics m_metrics;
+		uint64_t m_frameId;
+		uint64_t m_deliveringId;
+		bool m_hasKeyframes;
+		bool m_dropUntilKeyframe;
 		EventTriggerId m_eventTriggerId;
 		int m_outfd;
 		DeviceInterface * m_device;
@@ -102,6 +121,8 @@ class V4L2DeviceSource: public FramedSource
 		pthread_t m_thid;
 		pthread_mutex_t m_mutex;
 		std::string m_auxLine;
+		std::vector<char> m_readBuffer;
+		uint32_t m_lastSequence;
 };
 
 #endif
@@ -0,0 +1,83 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FileCache.h
+**
+** Cache of the static files served by the HTTP server
+**
+** A file is read once and kept with its response headers (MIME type, length,
+** ETag) until its modification time or size, or the ones of its precompressed
+** variants (file.br, file.gz), change. A variant is used when it is not older
+** than the file.
+** Files bigger than the cacheable size, or that don't fit in the memory
+** budget, keep only their headers and are sent with sendfile().
+**
+** The cache is used from the live555 thread only.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+
+class FileCache
+{
+	public:
+		// ---------------------------------
+		// File or precompressed variant
+		// ---------------------------------
+		struct Variant
+		{
+			std::string                        m_path;
+			std::string                        m_encoding;  // empty for the file itself
+			std::string                        m_etag;
+			time_t                             m_mtime;
+			off_t                              m_size;
+			std::string                        m_headers;   // Content-* and ETag headers
+			std::shared_ptr<const std::string> m_content;   // NULL when sent from the file
+		};
+
+		// ---------------------------------
+		// Cached file
+		// ---------------------------------
+		class Entry
+		{
+			friend class FileCache;
+
+			public:
+				// best variant for the Accept-Encoding of the request
+				const Variant & select(const char* acceptEncoding) const;
+
+			private:
+				std::vector<Variant> m_variants;  // the file itself is the last one
+		};
+		typedef std::shared_ptr<const Entry> Handle;
+
+	public:
+		// maxFileSize: bigger files are not kept in memory, maxBytes: memory of the cached contents
+		FileCache(size_t maxFileSize = 1<<20, size_t maxBytes = 16<<20);
+
+		// NULL if the path is not a regular file
+		Handle get(const std::string & path);
+
+		static const char* mimeType(const std::string & path);
+
+	private:
+		static void variants(const std::string & path, const struct stat & st, std::vector<Variant> & variants);
+		bool load(Variant & variant);
+
+	private:
+		size_t                        m_maxFileSize;
+		size_t                        m_maxBytes;
+		size_t                        m_bytes;
+		std::map<std::string, Handle> m_entries;
+};
@@ -0,0 +1,105 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameFeed.h
+**
+** Implement a live555 Sink that share the last frame with the HTTP viewers
+**
+** The frames are read from a replica once for all the viewers and given as
+** read-only shared buffers, a viewer that is still sending a frame only gets
+** the latest one when it is done. The replica is created with the first
+** listener and closed with the last one, so the capture can stop when no one
+** watches.
+**
+** The feed is used from the live555 thread only.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <list>
+#include <vector>
+#include <string>
+#include <memory>
+
+#include "liveMedia.hh"
+
+#include "MJPEG_V4l2DeviceSource.h"
+
+class FrameFeed : public MediaSink
+{
+	public:
+		// ---------------------------------
+		// Shared frame
+		// ---------------------------------
+		struct Frame
+		{
+			const char* data() const { return &m_buffer[m_offset]; }
+
+			std::vector<char> m_buffer;
+			unsigned int      m_offset;     // start of the frame in m_buffer
+			unsigned int      m_size;
+			timeval           m_timestamp;
+			uint64_t          m_id;
+			int               m_width;
+			int               m_height;
+		};
+		typedef std::shared_ptr<const Frame> Handle;
+		typedef void (AfterFrameFunc)(void* clientData);
+
+		static FrameFeed* createNew(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format)
+		{
+			return new FrameFeed(env, replicator, format);
+		}
+
+		// last frame received, NULL before the first one
+		Handle latest() const                { return m_latest; }
+		const std::string & getFormat() const { return m_format; }
+
+		// frame coded with DepthCodec, the latest frame is encoded once for all the viewers
+		std::shared_ptr<const std::string> delta(const Handle & frame);
+
+		// called each time a frame is received
+		void addListener(AfterFrameFunc* func, void* clientData);
+		void removeListener(void* clientData);
+
+	protected:
+		FrameFeed(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format);
+		virtual ~FrameFeed();
+
+		virtual Boolean continuePlaying();
+
+		static void afterGettingFrame(void* clientData, unsigned frameSize,
+						 unsigned numTruncatedBytes,
+						 struct timeval presentationTime,
+						 unsigned durationInMicroseconds) {
+			FrameFeed* feed = (FrameFeed*)clientData;
+			feed->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
+		}
+		void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+		bool addJPEGHeader(unsigned frameSize, const timeval & presentationTime);
+
+	private:
+		void start();
+		void stop();
+		static void stopStub(void* clientData) { FrameFeed* feed = (FrameFeed*)clientData; feed->m_stopTask = NULL; feed->stop(); }
+
+	private:
+		StreamReplicator*                   m_replicator;
+		MJPEG_V4L2DeviceSource*             m_jpegSource;   // gives the header of the scan data it delivers
+		FramedSource*                       m_replica;
+		std::string                         m_format;
+		std::vector<std::shared_ptr<Frame>> m_frames;
+		std::shared_ptr<Frame>              m_reading;
+		Handle                              m_latest;
+		uint64_t                            m_frameId;
+		TaskToken                           m_stopTask;
+		uint64_t                            m_deltaId;
+		std::shared_ptr<const std::string>  m_delta;
+		std::list<std::pair<AfterFrameFunc*,void*> > m_listeners;
+};
@@ -15,6 +15,7 @@
 
 // project
 #include "DeviceSource.h"
+#include "AnnexBScanner.h"
 
 // ---------------------------------
 // H264 V4L2 FramedSource
@@ -31,6 +32,9 @@ class H26X_V4L2DeviceSource : public V4L2DeviceSource
 		virtual ~H26X_V4L2DeviceSource() {}
 
 		unsigned char* extractFrame(unsigned char* frame, size_t& size, size_t& outsize, int& frameType);
+		bool updateConfig(std::string & config, const AnnexBScanner::Nal & nal, const char* name);
+		int nalHeader(unsigned char* frame, size_t frameSize);
+		std::string withoutMarker(const std::string & config);
 				
 	protected:
 		std::string m_sps;
@@ -52,6 +56,7 @@ class H264_V4L2DeviceSource : public H26X_V4L2DeviceSource
 	
 		// overide V4L2DeviceSource
 		virtual std::list< std::pair<unsigned char*,size_t> > splitFrames(unsigned char* frame, unsigned frameSize);			
+		virtual int getFrameFlags(unsigned char* frame, size_t frameSize);
 };
 
 class H265_V4L2DeviceSource : public H26X_V4L2DeviceSource
@@ -67,6 +72,7 @@ class H265_V4L2DeviceSource : public H26X_V4L2DeviceSource
 	
 		// overide V4L2DeviceSource
 		virtual std::list< std::pair<unsigned char*,size_t> > splitFrames(unsigned char* frame, unsigned frameSize);			
+		virtual int getFrameFlags(unsigned char* frame, size_t frameSize);
 				
 	protected:
 		std::string m_vps;
@@ -11,10 +11,19 @@
 **                                                                                    
 ** -------------------------------------------------------------------------*/
 
+#include <map>
+#include <deque>
 
 #include "RTSPServer.hh"
 #include "RTSPCommon.hh"
 
+#include "SegmentStore.h"
+#include "BufferSender.h"
+#include "FileCache.h"
+#include "FrameFeed.h"
+#include "SnapshotEncoder.h"
+#include "SegmentServerMediaSubsession.h"
+
 // ---------------------------------------------------------
 //  Extend RTSP server to add support for HLS and MPEG-DASH
 // ---------------------------------------------------------
@@ -23,9 +32,15 @@ class HTTPServer : public RTSPServer
 
 	class HTTPClientConnection : public RTSPServer::RTSPClientConnection
 	{
+		enum FeedMode { FEED_MULTIPART, FEED_CHUNKED, FEED_WEBSOCKET, FEED_WEBSOCKET_DELTA };
+
 		public:
 			HTTPClientConnection(RTSPServer& ourServer, int clientSocket, struct sockaddr_in clientAddr)
-			  : RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr), fTCPSink(NULL), fStreamToken(NULL), fSubsession(NULL), fSource(NULL) {
+			  : RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr), fTCPSink(NULL), fSource(NULL), fSender(NULL), fSegment(false)
+			  , fWaitSubsession(NULL), fWaitSink(NULL), fWaitPlayList(false), fWaitMsn(0), fWaitPart(-1), fWaitTask(NULL)
+			  , fKeepAlive(false), fBusy(false), fDoneTask(NULL), fIdleTask(NULL)
+			  , fFeed(NULL), fFeedId(0), fFeedMode(FEED_MULTIPART), fFeedSending(false)
+			  , fSnapshotFeed(NULL), fSnapshotEncoder(NULL), fSnapshotTask(NULL) {
 			}
 			virtual ~HTTPClientConnection();
 
@@ -34,20 +49,70 @@ class HTTPServer : public RTSPServer
 			void sendHeader(const char* contentType, unsigned int contentLength);		
 			void streamSource(FramedSource* source);	
 			void streamSource(const std::string & content);
+			void streamSegment(const SegmentStore::Handle & segment, size_t offset, size_t size);
 			ServerMediaSubsession* getSubsesion(const char* urlSuffix);
-			bool sendFile(char const* urlSuffix);
-			bool sendM3u8PlayList(char const* urlSuffix);
-			bool sendMpdPlayList(char const* urlSuffix);
+			bool sendFile(char const* fullRequestStr);
+			void startResponse(const std::string & headers);
+			void sendNotModified(const std::string & etag);
+			std::shared_ptr<const std::string> buildM3u8PlayList(SegmentServerMediaSubsession* subsession, char const* urlSuffix);
+			std::shared_ptr<const std::string> buildMpdPlayList(SegmentServerMediaSubsession* subsession, char const* urlSuffix);
+			bool sendPlayList(const std::string & streamName, const std::string & ext, const char* fullRequestStr);
+			bool waitPlayList(const std::string & streamName, int msn, int part);
+			bool waitPart(SegmentServerMediaSubsession* subsession, unsigned int id, int part);
+			int  waitStatus();
+			void startWait();
+			void cancelWait();
+			void endWait();
+			static void partCompleted(void* clientData);
+			static void waitTimeout(void* clientData);
+			void startFeed(FrameFeed* feed, FeedMode mode, const std::string & webSocketKey);
+			void sendFeedFrame();
+			static void feedFrame(void* clientData);
+			static void feedSent(void* clientData);
+			void receiveWebSocket();
+			static void webSocketHandler(void* clientData, int mask) { ((HTTPClientConnection*)clientData)->receiveWebSocket(); }
+			void startSnapshot(FrameFeed* feed, SnapshotEncoder* encoder);
+			void sendSnapshot(const FrameFeed::Handle & frame, const std::string & format);
+			void cancelSnapshot();
+			static void snapshotFrame(void* clientData);
+			static void snapshotTimeout(void* clientData);
+			static void snapshotEncoded(void* clientData, const SnapshotEncoder::Snapshot & snapshot);
+			void sendNotSupported();
+			virtual void handleRequestBytes(int newBytesRead);
 			virtual void handleHTTPCmd_StreamingGET(char const* urlSuffix, char const* fullRequestStr);
+			void handleRequest(char const* urlSuffix, char const* fullRequestStr);
 			virtual void handleCmd_notFound();
+			std::string connectionHeader();
 			static void afterStreaming(void* clientData);
+			static void responseDone(void* clientData);
+			static void idleTimeout(void* clientData);
 		
 		private:
-			static u_int32_t fClientSessionId;
 			TCPStreamSink* fTCPSink;
-			void*          fStreamToken;
-			ServerMediaSubsession* fSubsession;
 			FramedSource*          fSource;
+			BufferSender*          fSender;
+			bool                   fSegment;
+			SegmentServerMediaSubsession* fWaitSubsession;
+			MemoryBufferSink*      fWaitSink;
+			std::string            fWaitStream;
+			bool                   fWaitPlayList;
+			int                    fWaitMsn;
+			int                    fWaitPart;
+			TaskToken              fWaitTask;
+			bool                   fKeepAlive;
+			bool                   fBusy;
+			TaskToken              fDoneTask;
+			TaskToken              fIdleTask;
+			std::deque<std::pair<std::string,std::string> > fPending;
+			FrameFeed*             fFeed;
+			uint64_t               fFeedId;
+			FeedMode               fFeedMode;
+			bool                   fFeedSending;
+			std::string            fWebSocketInput;
+			std::string            fWebSocketControl;
+			FrameFeed*             fSnapshotFeed;
+			SnapshotEncoder*       fSnapshotEncoder;
+			TaskToken              fSnapshotTask;
 	};
 	
 	public:
@@ -70,13 +135,36 @@ class HTTPServer : public RTSPServer
                        }
 		}
 
+		virtual ~HTTPServer();
+
 		RTSPServer::RTSPClientConnection* createNewClientConnection(int clientSocket, struct sockaddr_in clientAddr) 
 		{
 			return new HTTPClientConnection(*this, clientSocket, clientAddr);
 		}
+
+		// frames of a stream shared by its HTTP viewers, NULL if the stream doesn't exist
+		FrameFeed* getFeed(const std::string & streamName);
+		// PNG encoder of the snapshots of a stream
+		SnapshotEncoder* getSnapshotEncoder(const std::string & streamName);
 		
         private:
+		// playlist kept until the segments change
+		struct PlayList
+		{
+			PlayList() : m_sink(NULL), m_generation(0) {}
+
+			MemoryBufferSink*                  m_sink;
+			unsigned int                       m_generation;
+			std::string                        m_etag;
+			std::string                        m_headers;
+			std::shared_ptr<const std::string> m_content;
+		};
+
 		const unsigned int m_hlsSegment;
 		std::string  m_webroot;
+		FileCache    m_fileCache;
+		std::map<std::string, PlayList> m_playLists;
+		std::map<std::string, FrameFeed*> m_feeds;
+		std::map<std::string, SnapshotEncoder*> m_snapshotEncoders;
 };
 
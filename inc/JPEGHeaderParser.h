@@ -0,0 +1,55 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** JPEGHeaderParser.h
+**
+** Parse the JPEG header fields needed by RTP/JPEG (RFC 2435)
+**
+** The parser jumps from segment to segment and keeps the header of the
+** previous frame, when the header bytes are identical the tables are not
+** parsed again.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <string>
+
+class JPEGHeaderParser
+{
+	public:
+		JPEGHeaderParser();
+
+		// parse a frame, return the offset of the scan data or 0 if the header is not valid
+		unsigned int parse(const unsigned char* frame, unsigned int size);
+
+		// true if the last parsed header differ from the previous one
+		bool changed() const             { return m_changed; }
+		// bytes of the last header, up to the start of scan
+		const std::string & header() const { return m_header; }
+
+		u_int16_t width() const          { return m_width; }
+		u_int16_t height() const         { return m_height; }
+		u_int8_t type() const            { return m_type; }
+		u_int16_t restartInterval() const { return m_restartInterval; }
+		u_int8_t const* quantizationTables(u_int8_t& precision, u_int16_t& length) const;
+
+	protected:
+		unsigned int walk(const unsigned char* frame, unsigned int size, bool parseSegments);
+		void parseSegment(unsigned char marker, const unsigned char* segment, unsigned int length);
+
+	protected:
+		std::string m_header;
+		bool        m_changed;
+		u_int16_t   m_width;
+		u_int16_t   m_height;
+		u_int8_t    m_type;
+		u_int16_t   m_restartInterval;
+		u_int8_t    m_qTable[128*2];
+		unsigned int m_qTableSize;
+		u_int8_t    m_precision;
+};
@@ -0,0 +1,74 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** KeyFrameFilter.h
+**
+** Pass-through filter that signals the H264/H265 keyframes to the segmenter
+**
+** The keyframe starts at the first parameter set or IDR NAL of the access
+** unit, so the SPS/PPS are at the beginning of the segment.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "MemoryBufferSink.h"
+
+class KeyFrameFilter : public FramedFilter {
+	public:
+		KeyFrameFilter (UsageEnvironment& env, FramedSource* inputSource, const std::string& format, MemoryBufferSink* sink)
+			: FramedFilter(env, inputSource), m_h265(format == "video/H265"), m_sink(sink), m_inKeyFrame(false) {
+		}
+
+	private:
+		static void afterGettingFrame(void* clientData, unsigned frameSize,
+						 unsigned numTruncatedBytes,
+						 struct timeval presentationTime,
+						 unsigned durationInMicroseconds) {
+			KeyFrameFilter* filter = (KeyFrameFilter*)clientData;
+			filter->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime, durationInMicroseconds);
+		}
+
+		void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds)
+		{
+			bool keyFrame = false;
+			if (frameSize > 0) {
+				bool key = this->isKeyFrameNal(fTo[0]);
+				keyFrame = key && !m_inKeyFrame;
+				m_inKeyFrame = key;
+			}
+			m_sink->inputFrame(presentationTime, keyFrame);
+
+			fFrameSize = frameSize;
+			fNumTruncatedBytes = numTruncatedBytes;
+			fPresentationTime = presentationTime;
+			fDurationInMicroseconds = durationInMicroseconds;
+			afterGetting(this);
+		}
+
+		bool isKeyFrameNal(u_int8_t header)
+		{
+			if (m_h265) {
+				int type = (header & 0x7E)>>1;
+				return ( (type >= 16) && (type <= 21) ) || ( (type >= 32) && (type <= 34) ); // IRAP, VPS, SPS, PPS
+			}
+			int type = header & 0x1F;
+			return (type == 5) || (type == 7) || (type == 8); // IDR, SPS, PPS
+		}
+
+		// the input source write directly in the buffer of our consumer
+		virtual void doGetNextFrame() {
+			if (fInputSource != NULL)
+			{
+				fInputSource->getNextFrame(fTo, fMaxSize,
+						afterGettingFrame, this,
+						handleClosure, this);
+			}
+		}
+
+		bool              m_h265;
+		MemoryBufferSink* m_sink;
+		bool              m_inKeyFrame;
+};
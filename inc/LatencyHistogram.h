@@ -0,0 +1,122 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** LatencyHistogram.h
+**
+** Lock-free log-linear (HDR style) latency histogram in microseconds
+**
+** Each power of two is divided in 32 linear buckets, that give a relative
+** precision better than 3% from 1us to 2^36us. Recording is three relaxed
+** atomic additions (bucket, count, sum) and a compare-exchange only when
+** the maximum grows, without lock. Snapshots can be taken from any thread.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+#include <string.h>
+
+#include <atomic>
+
+class LatencyHistogram
+{
+	public:
+		static const unsigned int SUB_BITS = 5;
+		static const unsigned int SUB_COUNT = 1 << SUB_BITS;
+		static const unsigned int GROUPS = 32;
+		static const unsigned int BUCKETS = GROUPS * SUB_COUNT;
+
+		// ---------------------------------
+		// Copy of the histogram at a given time
+		// ---------------------------------
+		struct Snapshot
+		{
+			Snapshot() : m_count(0), m_sum(0), m_max(0) { memset(&m_buckets, 0, sizeof(m_buckets)); }
+
+			// value (us) below which the given fraction of the samples are
+			uint64_t percentile(double fraction) const {
+				uint64_t total = 0;
+				for (unsigned int i = 0; i < BUCKETS; ++i) {
+					total += m_buckets[i];
+				}
+				uint64_t rank = (uint64_t)(fraction * total + 0.5);
+				uint64_t seen = 0;
+				for (unsigned int i = 0; (i < BUCKETS) && (total != 0); ++i) {
+					seen += m_buckets[i];
+					if ( (seen >= rank) && (seen != 0) ) {
+						uint64_t value = highest(i);
+						return (value < m_max) ? value : m_max;
+					}
+				}
+				return m_max;
+			}
+
+			uint64_t m_count;
+			uint64_t m_sum;
+			uint64_t m_max;
+			uint64_t m_buckets[BUCKETS];
+		};
+
+	public:
+		LatencyHistogram() : m_count(0), m_sum(0), m_max(0) {
+			for (unsigned int i = 0; i < BUCKETS; ++i) {
+				m_buckets[i].store(0, std::memory_order_relaxed);
+			}
+		}
+
+		void record(uint64_t us) {
+			m_buckets[index(us)].fetch_add(1, std::memory_order_relaxed);
+			m_count.fetch_add(1, std::memory_order_relaxed);
+			m_sum.fetch_add(us, std::memory_order_relaxed);
+			uint64_t max = m_max.load(std::memory_order_relaxed);
+			while ( (us > max) && (!m_max.compare_exchange_weak(max, us, std::memory_order_relaxed)) ) {
+			}
+		}
+
+		void snapshot(Snapshot & snap) const {
+			snap.m_count = m_count.load(std::memory_order_relaxed);
+			snap.m_sum = m_sum.load(std::memory_order_relaxed);
+			snap.m_max = m_max.load(std::memory_order_relaxed);
+			for (unsigned int i = 0; i < BUCKETS; ++i) {
+				snap.m_buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+			}
+		}
+
+		// monotonic clock in microseconds
+		static uint64_t now() {
+			timespec ts;
+			clock_gettime(CLOCK_MONOTONIC, &ts);
+			return (uint64_t)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+		}
+
+		static unsigned int index(uint64_t us) {
+			if (us < SUB_COUNT) {
+				return us;
+			}
+			unsigned int msb = 63 - __builtin_clzll(us);
+			unsigned int group = msb - SUB_BITS + 1;
+			if (group >= GROUPS) {
+				return BUCKETS - 1;
+			}
+			return group*SUB_COUNT + ((us >> (msb - SUB_BITS)) - SUB_COUNT);
+		}
+
+		static uint64_t highest(unsigned int idx) {
+			unsigned int group = idx / SUB_COUNT;
+			uint64_t sub = idx % SUB_COUNT;
+			if (group == 0) {
+				return sub;
+			}
+			return ((SUB_COUNT + sub + 1) << (group - 1)) - 1;
+		}
+
+	private:
+		std::atomic<uint64_t> m_count;
+		std::atomic<uint64_t> m_sum;
+		std::atomic<uint64_t> m_max;
+		std::atomic<uint64_t> m_buckets[BUCKETS];
+};
@@ -13,13 +13,17 @@
 
 #include "logger.h"
 #include "JPEGVideoSource.hh"
+#include "JPEGHeaderParser.h"
+#include "MJPEG_V4l2DeviceSource.h"
 
 class MJPEGVideoSource : public JPEGVideoSource
 {
    public:
-      static MJPEGVideoSource* createNew (UsageEnvironment& env, FramedSource* source)
+      // when the frames come from an MJPEG_V4L2DeviceSource, they are scan data and the device gives their header
+      // otherwise the header of each frame is parsed and removed, the tables are parsed again only when it changes
+      static MJPEGVideoSource* createNew (UsageEnvironment& env, FramedSource* source, MJPEG_V4L2DeviceSource* device = NULL)
       {
-         return new MJPEGVideoSource(env,source);
+         return new MJPEGVideoSource(env,source,device);
       }
       virtual void doGetNextFrame()
       {
@@ -41,21 +45,19 @@ class MJPEGVideoSource : public JPEGVideoSource
       } 
       
       void afterGettingFrame(unsigned frameSize,unsigned numTruncatedBytes,struct timeval presentationTime,unsigned durationInMicroseconds);
-      virtual u_int8_t type() { return m_type; };
+      virtual u_int8_t type() { return header().type(); };
       virtual u_int8_t qFactor() { return 128; };
-      virtual u_int8_t width() { return m_width; };
-      virtual u_int8_t height() { return m_height; };
-      virtual u_int16_t restartInterval() { return m_restartInterval; }
+      // RTP/JPEG dimensions are in 8 pixels unit, 0 above 2040 (the SDP x-dimensions give the real size)
+      virtual u_int8_t width() { return (header().width() > 2040) ? 0 : header().width()>>3; };
+      virtual u_int8_t height() { return (header().height() > 2040) ? 0 : header().height()>>3; };
+      virtual u_int16_t restartInterval() { return header().restartInterval(); }
 
       u_int8_t const* quantizationTables( u_int8_t& precision, u_int16_t& length );
 
    protected:
-      MJPEGVideoSource(UsageEnvironment& env, FramedSource* source) : JPEGVideoSource(env),
-         m_inputSource(source),
-         m_width(0), m_height(0), m_qTableSize(0), m_precision(0),
-         m_type(0), m_restartInterval(0)
+      MJPEGVideoSource(UsageEnvironment& env, FramedSource* source, MJPEG_V4L2DeviceSource* device) : JPEGVideoSource(env),
+         m_inputSource(source), m_device(device)
       {
-         memset(&m_qTable,0,sizeof(m_qTable));
       }
       virtual ~MJPEGVideoSource() 
       { 
@@ -63,12 +65,10 @@ class MJPEGVideoSource : public JPEGVideoSource
       }
 
       protected:
-      FramedSource* m_inputSource;
-      u_int8_t      m_width;
-      u_int8_t      m_height;
-      u_int8_t      m_qTable[128*2];
-      unsigned int  m_qTableSize;
-      unsigned int  m_precision;
-      u_int8_t      m_type;
-      u_int16_t     m_restartInterval;
+      const JPEGHeaderParser & header() { return m_fields ? *m_fields : m_header; }
+
+      FramedSource*           m_inputSource;
+      MJPEG_V4L2DeviceSource* m_device;
+      std::shared_ptr<const JPEGHeaderParser> m_fields;   // header of the last frame given by the device
+      JPEGHeaderParser        m_header;
 };
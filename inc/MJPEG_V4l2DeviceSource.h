@@ -0,0 +1,70 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** MJPEG_V4l2DeviceSource.h
+** 
+** MJPEG V4L2 live555 source 
+**
+** The JPEG header is parsed once in the capture path and only the scan data
+** is queued, so MJPEGVideoSource doesn't need to move the payload. The
+** header is kept with the frame it belongs to and published when the frame
+** is delivered : MJPEGVideoSource takes the RTP/JPEG fields from it and
+** FrameFeed puts the header bytes back in front of the scan data, so the
+** HTTP consumers get whole JPEG images.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/time.h>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// project
+#include "DeviceSource.h"
+#include "JPEGHeaderParser.h"
+
+class MJPEG_V4L2DeviceSource : public V4L2DeviceSource
+{
+	public:
+		static MJPEG_V4L2DeviceSource* createNew(UsageEnvironment& env, DeviceInterface * device, int outputFd, unsigned int queueSize, bool useThread) {
+			return new MJPEG_V4L2DeviceSource(env, device, outputFd, queueSize, useThread);
+		}
+
+		// ---------------------------------
+		// Header of a frame, shared by the frames while it doesn't change
+		// ---------------------------------
+		struct Header
+		{
+			std::shared_ptr<const JPEGHeaderParser> m_fields;
+			std::shared_ptr<const std::string>      m_bytes;
+		};
+
+		// header of the frame delivered with this presentation time, the replicator doesn't read the next
+		// frame before all its replicas got this one. false if the frame is not the last one delivered
+		bool getHeader(const timeval & presentationTime, Header & header);
+
+	protected:
+		MJPEG_V4L2DeviceSource(UsageEnvironment& env, DeviceInterface * device, int outputFd, unsigned int queueSize, bool useThread)
+			: V4L2DeviceSource(env, device, outputFd, queueSize, useThread) { timerclear(&m_deliveredTime); }
+
+		// overide V4L2DeviceSource
+		virtual std::list< std::pair<unsigned char*,size_t> > splitFrames(unsigned char* frame, unsigned frameSize);
+		virtual void frameDelivered(const Frame & frame);
+
+	protected:
+		// capture thread
+		JPEGHeaderParser          m_parser;
+		Header                    m_parsed;
+
+		// headers of the queued frames by frame id, and the header of the frame delivered
+		std::mutex                m_headerMutex;
+		std::map<uint64_t,Header> m_headers;
+		Header                    m_delivered;
+		timeval                   m_deliveredTime;
+};
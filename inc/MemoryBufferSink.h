@@ -11,21 +11,26 @@
 
 #pragma once
 
+#include <list>
 #include <string>
-#include <map>
 
 #include "MediaSink.hh"
 
+#include "SegmentStore.h"
+
 class MemoryBufferSink : public MediaSink
 {
 	public:
-		static MemoryBufferSink* createNew(UsageEnvironment& env, unsigned int bufferSize, unsigned int sliceDuration) 
+		typedef void (AfterPartFunc)(void* clientData);
+
+		// retention: seconds kept (0 for 3 slices), maxBytes: memory of the segment store, partDuration: ms of the LL-HLS parts (0 disable)
+		static MemoryBufferSink* createNew(UsageEnvironment& env, unsigned int bufferSize, unsigned int sliceDuration, unsigned int retention = 0, size_t maxBytes = 32<<20, unsigned int partDuration = 0, size_t chunkSize = 64<<10) 
 		{
-			return new MemoryBufferSink(env, bufferSize, sliceDuration);
+			return new MemoryBufferSink(env, bufferSize, sliceDuration, retention, maxBytes, partDuration, chunkSize);
 		}
 		
 	protected:
-		MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration);
+		MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration, unsigned int retention, size_t maxBytes, unsigned int partDuration, size_t chunkSize);
 		virtual ~MemoryBufferSink(); 
 		
 		virtual Boolean continuePlaying();
@@ -41,17 +46,48 @@ class MemoryBufferSink : public MediaSink
 		void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
 		
 	public:
-		unsigned int getBufferSize(unsigned int slice);
-		std::string  getBuffer(unsigned int slice);			
+		// frame given to the multiplexer, the segments start with the keyframes when they are signaled
+		void inputFrame(const timeval & pts, bool keyFrame);
+
+		unsigned int getBufferSize(unsigned int id);
+		// handle on the segment, its memory stay valid while the handle is kept
+		SegmentStore::Handle getSegment(unsigned int id) { return m_store.get(id); }
+		void getSegments(std::vector<SegmentStore::Handle> & segments) { m_store.segments(segments); }
+		// changes when the playlists change
+		unsigned int getGeneration()    	{ return m_store.generation(); }
+		// time of the first segment since the first frame
 		unsigned int firstTime();
 		unsigned int duration();
+		const timeval & getRefTime()     	{ return m_refTime; }
 		unsigned int getSliceDuration() 	{ return m_sliceDuration; }
+		unsigned int getPartDuration()  	{ return m_partDuration; }
+		// longest part published, in ms
+		unsigned int getPartTarget()    	{ return m_partTarget; }
+
+		// called each time a part or a segment is completed
+		void addPartListener(AfterPartFunc* func, void* clientData);
+		void removePartListener(void* clientData);
+
+	private:
+		void partCompleted();
+		void keepTables(const unsigned char* buffer, unsigned int size);
 		
 	private:
 		unsigned char *                    m_buffer;
 		unsigned int                       m_bufferSize;
-		std::map<unsigned int,std::string> m_outputBuffers;
-		unsigned int                       m_refTime;
+		SegmentStore                       m_store;
+		timeval                            m_refTime;
 		unsigned int                       m_sliceDuration;
+		unsigned int                       m_nextId;
+		bool                               m_keyFrameAligned;
+		bool                               m_keyFramePending;
+		timeval                            m_inputTime;
+		std::string                        m_pat;
+		std::string                        m_pmt;
+		unsigned int                       m_pmtPid;
+		unsigned int                       m_partDuration;
+		unsigned int                       m_partTarget;
+		timeval                            m_partStart;
+		std::list<std::pair<AfterPartFunc*,void*> > m_listeners;
 };
 	
@@ -0,0 +1,210 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** Metrics.h
+**
+** Lock-free counters exported in Prometheus text format
+**
+** Counters and latency histograms are updated on the capture and delivery
+** paths with relaxed atomic increments only. Formatting is done when /metrics
+** is scraped.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <string>
+#include <list>
+#include <ostream>
+#include <atomic>
+#include <mutex>
+
+#include "LatencyHistogram.h"
+
+// ---------------------------------
+// Counters and per-stage latency of a capture source
+// ---------------------------------
+class SourceMetrics
+{
+	friend class Metrics;
+
+	public:
+		enum Stage
+		{
+			CAPTURE_WAIT,   // waiting for the device to give a frame
+			QUEUE,          // from capture to dequeue by the live555 thread
+			DELIVERY,       // copy to the consumer buffer
+			SEND,           // consumer processing (replication, RTP send)
+			NB_STAGES
+		};
+
+	public:
+		SourceMetrics(const std::string & name);
+		~SourceMetrics();
+
+		void captured(unsigned int size) {
+			m_framesIn.fetch_add(1, std::memory_order_relaxed);
+			m_bytesIn.fetch_add(size, std::memory_order_relaxed);
+		}
+		void delivered(unsigned int size) {
+			m_framesOut.fetch_add(1, std::memory_order_relaxed);
+			m_bytesOut.fetch_add(size, std::memory_order_relaxed);
+		}
+		void dropped() {
+			m_drops.fetch_add(1, std::memory_order_relaxed);
+		}
+		void queueDepth(size_t depth) {
+			m_queueDepth.store(depth, std::memory_order_relaxed);
+		}
+		void starved() {
+			m_starvations.fetch_add(1, std::memory_order_relaxed);
+		}
+		void driverDropped(uint32_t frames) {
+			m_driverDrops.fetch_add(frames, std::memory_order_relaxed);
+		}
+		void buffersInFlight(uint32_t buffers) {
+			m_buffersInFlight.store(buffers, std::memory_order_relaxed);
+		}
+		void stalled() {
+			m_stalls.fetch_add(1, std::memory_order_relaxed);
+		}
+		void recovered(uint64_t us) {
+			m_recoveries.fetch_add(1, std::memory_order_relaxed);
+			m_recoveryUs.fetch_add(us, std::memory_order_relaxed);
+			m_lastRecoveryUs.store(us, std::memory_order_relaxed);
+		}
+		void latency(Stage stage, uint64_t us) {
+			m_latency[stage].record(us);
+		}
+		void snapshot(Stage stage, LatencyHistogram::Snapshot & snap) const {
+			m_latency[stage].snapshot(snap);
+		}
+
+		static const char* stageName(Stage stage);
+
+	private:
+		std::string           m_name;
+		std::atomic<uint64_t> m_framesIn;
+		std::atomic<uint64_t> m_bytesIn;
+		std::atomic<uint64_t> m_framesOut;
+		std::atomic<uint64_t> m_bytesOut;
+		std::atomic<uint64_t> m_drops;
+		std::atomic<uint32_t> m_queueDepth;
+		std::atomic<uint64_t> m_starvations;
+		std::atomic<uint64_t> m_driverDrops;
+		std::atomic<uint32_t> m_buffersInFlight;
+		std::atomic<uint64_t> m_stalls;
+		std::atomic<uint64_t> m_recoveries;
+		std::atomic<uint64_t> m_recoveryUs;
+		std::atomic<uint64_t> m_lastRecoveryUs;
+		LatencyHistogram      m_latency[NB_STAGES];
+
+		// previous scrape, only accessed by Metrics
+		uint64_t              m_lastFramesIn;
+		timeval               m_lastScrape;
+};
+
+// ---------------------------------
+// Bytes copied and heap allocations of each stage of the pipeline
+// ---------------------------------
+class CopyMetrics
+{
+	friend class Metrics;
+
+	public:
+		enum Stage
+		{
+			CAPTURE,        // device or SDK buffer to the capture queue
+			SPLIT,          // per-NAL copy of processFrame()
+			DELIVERY,       // capture queue to the consumer buffer
+			REPLICA,        // StreamReplicator copy to each additional client
+			MARKER,         // AddH26xMarkerFilter
+			JPEG,           // JPEG header removed for RTP or put back for HTTP
+			SEGMENT,        // HLS/MPEG-DASH slice buffers
+			FEED,           // frames shared by the HTTP live viewers
+			NB_STAGES
+		};
+
+	public:
+		static void copied(Stage stage, size_t size) {
+			s_copies[stage].fetch_add(1, std::memory_order_relaxed);
+			s_copiedBytes[stage].fetch_add(size, std::memory_order_relaxed);
+		}
+		static void allocated(Stage stage, size_t size) {
+			s_allocations[stage].fetch_add(1, std::memory_order_relaxed);
+			s_allocatedBytes[stage].fetch_add(size, std::memory_order_relaxed);
+		}
+
+		static uint64_t copies(Stage stage)         { return s_copies[stage].load(std::memory_order_relaxed); }
+		static uint64_t copiedBytes(Stage stage)    { return s_copiedBytes[stage].load(std::memory_order_relaxed); }
+		static uint64_t allocations(Stage stage)    { return s_allocations[stage].load(std::memory_order_relaxed); }
+		static uint64_t allocatedBytes(Stage stage) { return s_allocatedBytes[stage].load(std::memory_order_relaxed); }
+
+		static const char* stageName(Stage stage);
+
+	private:
+		static std::atomic<uint64_t> s_copies[NB_STAGES];
+		static std::atomic<uint64_t> s_copiedBytes[NB_STAGES];
+		static std::atomic<uint64_t> s_allocations[NB_STAGES];
+		static std::atomic<uint64_t> s_allocatedBytes[NB_STAGES];
+};
+
+// ---------------------------------
+// Counters of an RTSP client
+// ---------------------------------
+class ClientMetrics
+{
+	friend class Metrics;
+
+	public:
+		ClientMetrics(unsigned int clientSessionId);
+		~ClientMetrics();
+
+		void sent(unsigned int size) {
+			m_frames.fetch_add(1, std::memory_order_relaxed);
+			m_bytes.fetch_add(size, std::memory_order_relaxed);
+		}
+
+	private:
+		unsigned int          m_clientSessionId;
+		std::atomic<uint64_t> m_frames;
+		std::atomic<uint64_t> m_bytes;
+
+		// previous scrape, only accessed by Metrics
+		uint64_t              m_lastBytes;
+		timeval               m_lastScrape;
+};
+
+// ---------------------------------
+// Registry of the counters
+// ---------------------------------
+class Metrics
+{
+	public:
+		static Metrics& instance();
+
+		void add(SourceMetrics* source);
+		void remove(SourceMetrics* source);
+		void add(ClientMetrics* client);
+		void remove(ClientMetrics* client);
+
+		void httpStreamStarted() { m_httpStreams.fetch_add(1, std::memory_order_relaxed); }
+		void httpStreamStopped() { m_httpStreams.fetch_sub(1, std::memory_order_relaxed); }
+
+		// write all the counters in Prometheus text format (called from the live555 thread)
+		void write(std::ostream & os, unsigned int rtspSessions);
+
+	protected:
+		Metrics() : m_httpStreams(0) {}
+
+	private:
+		std::mutex               m_mutex;
+		std::list<SourceMetrics*> m_sources;
+		std::list<ClientMetrics*> m_clients;
+		std::atomic<int32_t>     m_httpStreams;
+};
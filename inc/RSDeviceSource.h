@@ -19,6 +19,8 @@
 #include <iomanip>
 #include <cassert>
 
+#include <atomic>
+
 #include <pthread.h>
 
 // live555
@@ -27,6 +29,9 @@
 // Include RealSense Cross Platform API
 #include <librealsense2/rs.hpp> 
 
+#include "Metrics.h"
+#include "Tracer.h"
+
 using namespace rs2;
 
 class RSDeviceSource: public FramedSource
@@ -37,7 +42,7 @@ class RSDeviceSource: public FramedSource
 		// ---------------------------------
 		struct Frame
 		{
-			Frame(char* buffer, int size, timeval timestamp) : m_buffer(buffer), m_size(size), m_timestamp(timestamp) {};
+			Frame(char* buffer, int size, timeval timestamp, uint64_t id) : m_buffer(buffer), m_size(size), m_timestamp(timestamp), m_id(id) {};
 			Frame(const Frame&);
 			Frame& operator=(const Frame&);
 			~Frame()  { delete [] m_buffer; };
@@ -45,41 +50,62 @@ class RSDeviceSource: public FramedSource
 			char* m_buffer;
 			unsigned int m_size;
 			timeval m_timestamp;
-		};
-		
-		// ---------------------------------
-		// Compute simple stats
-		// ---------------------------------
-		class Stats
-		{
-			public:
-				Stats(const std::string & msg) : m_fps(0), m_fps_sec(0), m_size(0), m_msg(msg) {};
-				
-			public:
-				int notify(int tv_sec, int framesize);
-			
-			protected:
-				int m_fps;
-				int m_fps_sec;
-				int m_size;
-				const std::string m_msg;
+			uint64_t m_id;
 		};
 		
 	public:
-		static RSDeviceSource* createNew(UsageEnvironment& env, pipeline pipe, unsigned int queueSize);
+		// useCallback: frames are queued from the SDK callback thread, otherwise from a thread waiting for them
+		// sdkQueueSize: frames queue size of the SDK, 0 keeps its default
+		// keepWarm: capture from the creation, otherwise start on the first consumer and stop idleTimeout seconds after the last one
+		// stallTimeout: milliseconds without frame before restarting the pipeline, 0 disables the watchdog
+		static RSDeviceSource* createNew(UsageEnvironment& env, pipeline pipe, const config & cfg, unsigned int queueSize, bool useCallback, unsigned int sdkQueueSize, bool keepWarm, unsigned int idleTimeout, unsigned int stallTimeout);
 		std::string getAuxLine() { return m_auxLine; };	
 		void setAuxLine(const std::string auxLine) { m_auxLine = auxLine; };	
 		int getWidth() { return m_width; };	
 		int getHeight() { return m_height; };	
 		int getBPP() { return m_bpp; };	
+		// buffer of the consumer being delivered
+		const unsigned char* getDeliveryBuffer() const { return fTo; };
+
+		// pause a playback device to check the stall recovery
+		void simulateStall();
 
 	protected:
-		RSDeviceSource(UsageEnvironment& env, pipeline pipe, unsigned int queueSize);
+		RSDeviceSource(UsageEnvironment& env, pipeline pipe, const config & cfg, unsigned int queueSize, bool useCallback, unsigned int sdkQueueSize, bool keepWarm, unsigned int idleTimeout, unsigned int stallTimeout);
 		virtual ~RSDeviceSource();
 
+		// capture requested by the consumers, the watchdog keeps the pipeline running meanwhile
+		// wait: start the pipeline in the calling thread, otherwise in a worker thread
+		bool run(bool wait);
+		void halt();
+
+		bool start();
+		bool openPipeline();
+		void started();
+		void stop();
+		void closePipeline();
+		void flush();
+
+		// the SDK calls that wait for the device run in a worker thread, the result comes back with an event trigger
+		static void* workerStub(void* clientData) { return ((RSDeviceSource*) clientData)->worker();};
+		void* worker();
+		void startWorker(bool recover, bool reset);
+		bool joinWorker();
+		static void workerDoneStub(void* clientData) { ((RSDeviceSource*) clientData)->workerDone(); };
+		void workerDone();
+
+		static void idleStub(void* clientData) { ((RSDeviceSource*) clientData)->idle(); };
+		void idle();
+
+		static void watchdogStub(void* clientData) { ((RSDeviceSource*) clientData)->watchdog(); };
+		void watchdog();
+		void recover();
+
 	protected:	
 		static void* threadStub(void* clientData) { return ((RSDeviceSource*) clientData)->thread();};
 		void* thread();
+		void callback(const frame & f);
+		void queueFrame(const frame & f, uint64_t frameId);
 
 		static void deliverFrameStub(void* clientData) {((RSDeviceSource*) clientData)->deliverFrame();};
 		void deliverFrame();
@@ -95,13 +121,35 @@ class RSDeviceSource: public FramedSource
 					
 	protected:
 		std::list<Frame*> m_captureQueue;
-		Stats m_in;
-		Stats m_out;
+		SourceMetrics m_metrics;
+		uint64_t m_frameId;
 		EventTriggerId m_eventTriggerId;
 		pipeline m_pipe;
+		config m_config;
 		unsigned int m_queueSize;
+		bool m_useCallback;
+		unsigned int m_sdkQueueSize;
+		bool m_keepWarm;
+		unsigned int m_idleTimeout;
+		TaskToken m_idleTask;
+		unsigned int m_stallTimeout;
+		TaskToken m_watchdogTask;
+		std::atomic<uint64_t> m_lastFrame;
+		std::atomic<uint64_t> m_recoveryStart;
+		unsigned int m_recoveryAttempts;
+		device m_device;
+		bool m_running;
+		bool m_started;
+		std::atomic<bool> m_stop;
 		pthread_t m_thid;
 		pthread_mutex_t m_mutex;
+		bool m_workerRunning;
+		bool m_workerStop;
+		bool m_workerReset;
+		bool m_workerRecover;
+		std::atomic<bool> m_workerResult;
+		pthread_t m_workerThid;
+		EventTriggerId m_workerTriggerId;
 		std::string m_auxLine;
 
 	private:
@@ -0,0 +1,48 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SegmentServerMediaSubsession.h
+** 
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include "UnicastServerMediaSubsession.h"
+#include "MemoryBufferSink.h"
+
+class CMAFMuxer;
+
+// -----------------------------------------
+//    ServerMediaSubsession for HLS & MPEG-DASH
+// -----------------------------------------
+class SegmentServerMediaSubsession : public UnicastServerMediaSubsession
+{
+	public:
+		// container: "ts" for MPEG-TS segments, "mp4" for CMAF segments shared by HLS and MPEG-DASH
+		static SegmentServerMediaSubsession* createNew(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format, const std::string& container, unsigned int sliceDuration, unsigned int retention, size_t maxBytes, unsigned int partDuration)
+		{
+			return new SegmentServerMediaSubsession(env, replicator, format, container, sliceDuration, retention, maxBytes, partDuration);
+		}
+
+		// segment with this sequence number, NULL if it is not stored
+		SegmentStore::Handle getSegment(unsigned int id);
+		MemoryBufferSink* getSink() { return m_slice; }
+
+		// CMAF init segment, NULL for MPEG-TS
+		std::shared_ptr<const std::string> getInitSegment();
+		const char* getContentType()  { return m_cmaf ? "video/mp4" : "video/mp2t"; }
+		std::string getCodecs();
+		
+	protected:
+		SegmentServerMediaSubsession(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format, const std::string& container, unsigned int sliceDuration, unsigned int retention, size_t maxBytes, unsigned int partDuration);
+		virtual ~SegmentServerMediaSubsession();
+			
+		virtual float getCurrentNPT(void* streamToken);
+		virtual float duration() const ;
+					
+	protected:
+		MemoryBufferSink* m_slice;
+		CMAFMuxer*        m_cmaf;
+};
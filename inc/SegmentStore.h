@@ -0,0 +1,145 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SegmentStore.h
+**
+** Store of the HTTP streaming segments in fixed size chunks
+**
+** The chunks come from a pool allocated once, so the memory used doesn't
+** depend on the bitrate. A segment is a list of chunks shared with the HTTP
+** connections that send it, its chunks go back to the pool when the last
+** handle is released. Old segments are removed when they are older than the
+** retention duration or when the pool is empty.
+**
+** The store is used from the live555 thread only.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/time.h>
+
+#include <vector>
+#include <deque>
+#include <memory>
+
+class SegmentStore
+{
+	private:
+		// ---------------------------------
+		// Preallocated chunks
+		// ---------------------------------
+		class ChunkPool
+		{
+			public:
+				ChunkPool(size_t chunkSize, size_t nbChunks);
+				char* get();
+				void release(char* chunk) { m_free.push_back(chunk); }
+				size_t chunkSize() const   { return m_chunkSize; }
+				size_t available() const   { return m_free.size(); }
+
+			private:
+				size_t            m_chunkSize;
+				std::vector<char> m_memory;
+				std::deque<char*> m_free;
+		};
+
+	public:
+		// ---------------------------------
+		// Segment made of chunks
+		// ---------------------------------
+		class Segment
+		{
+			friend class SegmentStore;
+
+			public:
+				struct Piece
+				{
+					const char* m_data;
+					size_t      m_size;
+				};
+
+				// partial segment, a byte range of the segment
+				struct Part
+				{
+					size_t  m_offset;
+					size_t  m_size;
+					timeval m_start;
+					timeval m_end;
+					bool    m_independent;
+				};
+
+				// position of a keyframe in the segment
+				struct KeyFrame
+				{
+					size_t  m_offset;
+					timeval m_time;
+				};
+
+				Segment(const std::shared_ptr<ChunkPool> & pool, unsigned int id, const timeval & start);
+				~Segment();
+
+				unsigned int id() const          { return m_id; }
+				size_t size() const              { return m_size; }
+				const timeval & start() const    { return m_start; }
+				const timeval & end() const      { return m_end; }
+				// seconds until the next segment when it is complete
+				double duration() const          { return (m_end.tv_sec - m_start.tv_sec) + (m_end.tv_usec - m_start.tv_usec)/1000000.0; }
+				bool complete() const            { return m_complete; }
+				const std::vector<Part> & parts() const { return m_parts; }
+				const std::vector<KeyFrame> & keyFrames() const { return m_keyFrames; }
+
+				// data written so far, the chunks content doesn't change after it is written
+				size_t pieces(std::vector<Piece> & pieces) const { return this->pieces(pieces, 0, m_size); }
+				size_t pieces(std::vector<Piece> & pieces, size_t offset, size_t size) const;
+
+			private:
+				std::shared_ptr<ChunkPool> m_pool;
+				unsigned int               m_id;
+				timeval                    m_start;
+				timeval                    m_end;
+				bool                       m_complete;
+				size_t                     m_size;
+				std::vector<char*>         m_chunks;
+				std::vector<Part>          m_parts;
+				std::vector<KeyFrame>      m_keyFrames;
+				size_t                     m_partOffset;
+				timeval                    m_partStart;
+		};
+		typedef std::shared_ptr<const Segment> Handle;
+
+	public:
+		// maxDuration: retention in seconds, maxBytes: memory of the chunk pool
+		SegmentStore(size_t chunkSize, size_t maxBytes, unsigned int maxDuration);
+
+		// close the current segment and start a new one
+		void begin(unsigned int id, const timeval & start);
+		// append to the current segment, false if the data was dropped whole
+		bool append(const char* data, size_t size, const timeval & pts);
+		// close the current part of the current segment, false if it is empty
+		bool closePart(const timeval & end);
+		// a keyframe starts with the next appended data
+		void keyFrame(const timeval & time);
+
+		Handle get(unsigned int id) const;
+		Handle front() const                { return m_segments.empty() ? Handle() : m_segments.front(); }
+		Handle back() const                 { return m_segments.empty() ? Handle() : m_segments.back(); }
+		size_t count() const                { return m_segments.size(); }
+		void segments(std::vector<Handle> & segments) const { segments.assign(m_segments.begin(), m_segments.end()); }
+		uint64_t droppedBytes() const       { return m_droppedBytes; }
+		// changes each time a segment or a part is added or removed
+		unsigned int generation() const     { return m_generation; }
+
+	private:
+		bool evictOldest();
+
+	private:
+		std::shared_ptr<ChunkPool>           m_pool;
+		std::deque<std::shared_ptr<Segment>> m_segments;
+		unsigned int                         m_maxDuration;
+		uint64_t                             m_droppedBytes;
+		unsigned int                         m_generation;
+};
@@ -19,9 +19,6 @@
 // live555
 #include <liveMedia.hh>
 
-// forward declaration
-class RSDeviceSource;
-
 // ---------------------------------
 //   BaseServerMediaSubsession
 // ---------------------------------
@@ -31,9 +28,13 @@ class BaseServerMediaSubsession
 		BaseServerMediaSubsession(StreamReplicator* replicator): m_replicator(replicator) {};
 	
 	public:
-		static FramedSource* createSource(UsageEnvironment& env, FramedSource * videoES, const std::string& format);
-		static RTPSink* createSink(UsageEnvironment& env, Groupsock * rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, const std::string& format, RSDeviceSource* source);
-		char const* getAuxLine(RSDeviceSource* source, RTPSink* rtpSink);
+		static FramedSource* createSource(UsageEnvironment& env, FramedSource * videoES, const std::string& format, FramedSource* captureSource);
+		static RTPSink* createSink(UsageEnvironment& env, Groupsock * rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, const std::string& format, FramedSource* source);
+		static std::string getFormat(int captureFormat);
+		// dimensions and aux line of the capture source
+		static bool getSourceInfo(FramedSource* source, int& width, int& height, std::string& auxLine);
+		char const* getAuxLine(FramedSource* source, RTPSink* rtpSink);
+		StreamReplicator* getReplicator() { return m_replicator; }
 		
 	protected:
 		StreamReplicator* m_replicator;
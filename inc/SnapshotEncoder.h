@@ -0,0 +1,94 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SnapshotEncoder.h
+**
+** Encode the snapshots of a frame feed as PNG in a background thread
+**
+** A frame is encoded once whatever the number of requests, the last PNG is
+** kept and given to the requests for the same frame. The requests received
+** while a frame is encoded wait for it, or for the next one when they ask
+** for a newer frame. The encoded image is given back to the live555 thread
+** with an event trigger.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/time.h>
+
+#include <list>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "UsageEnvironment.hh"
+
+#include "FrameFeed.h"
+
+class SnapshotEncoder
+{
+	public:
+		// ---------------------------------
+		// Encoded frame
+		// ---------------------------------
+		struct Snapshot
+		{
+			Snapshot() : m_id(0), m_width(0), m_height(0) { m_timestamp.tv_sec = 0; m_timestamp.tv_usec = 0; }
+
+			uint64_t                           m_id;
+			int                                m_width;
+			int                                m_height;
+			timeval                            m_timestamp;
+			std::shared_ptr<const std::string> m_png;    // NULL if the frame cannot be encoded
+		};
+		typedef void (AfterEncodingFunc)(void* clientData, const Snapshot & snapshot);
+
+		static SnapshotEncoder* createNew(UsageEnvironment& env)
+		{
+			return new SnapshotEncoder(env);
+		}
+		virtual ~SnapshotEncoder();
+
+		// afterFunc is called from the live555 thread, immediately when the frame is already encoded
+		void encode(const FrameFeed::Handle & frame, AfterEncodingFunc* afterFunc, void* clientData);
+		void cancel(void* clientData);
+
+	protected:
+		SnapshotEncoder(UsageEnvironment& env);
+
+	private:
+		void start(const FrameFeed::Handle & frame);
+		void run();
+		static void encodedStub(void* clientData) { ((SnapshotEncoder*)clientData)->encoded(); }
+		void encoded();
+
+	private:
+		struct Waiter
+		{
+			AfterEncodingFunc* m_func;
+			void*              m_clientData;
+			uint64_t           m_id;
+		};
+
+		UsageEnvironment&       m_env;
+		EventTriggerId          m_eventTriggerId;
+
+		// live555 thread
+		Snapshot                m_last;
+		uint64_t                m_encodingId;  // 0 when the thread is idle
+		FrameFeed::Handle       m_next;
+		std::list<Waiter>       m_waiters;
+
+		// shared with the encoding thread
+		std::mutex              m_mutex;
+		std::condition_variable m_cond;
+		FrameFeed::Handle       m_job;
+		Snapshot                m_done;
+		bool                    m_stop;
+		std::thread             m_thread;
+};
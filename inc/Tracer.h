@@ -0,0 +1,114 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** Tracer.h
+**
+** Opt-in per-frame pipeline tracing exported in Chrome trace format
+**
+** Each thread records begin/end events in its own ring buffer, so recording
+** takes no lock. When tracing is disabled a trace point is a relaxed atomic
+** load, the ring of a thread is only allocated with its first event and is
+** reused by a later thread once it exits. The dump can be opened in chrome://tracing or ui.perfetto.dev.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <list>
+#include <ostream>
+#include <atomic>
+#include <mutex>
+
+class Tracer
+{
+	public:
+		static const unsigned int RING_SIZE = 16384;
+
+		static bool enabled() { return s_enabled.load(std::memory_order_relaxed); }
+		static void enable(bool enabled) { s_enabled.store(enabled, std::memory_order_relaxed); }
+
+		static void begin(const char* name, uint64_t frameId) { record(name, 'B', frameId, now()); }
+		static void end(const char* name, uint64_t frameId)   { record(name, 'E', frameId, now()); }
+
+		// begin a span at a time taken before its frame is known
+		static void begin(const char* name, uint64_t frameId, uint64_t ts) { record(name, 'B', frameId, ts); }
+		static uint64_t now();
+
+		// frame being sent by the calling thread, for the consumers that don't know it
+		static void setCurrentFrame(uint64_t frameId);
+		static uint64_t currentFrame();
+
+		// name shown for the calling thread in the trace viewer
+		static void setThreadName(const char* name);
+
+		// write the content of all the rings as Chrome trace JSON
+		static void dump(std::ostream & os);
+		static bool dump(const std::string & path);
+
+	private:
+		struct Event
+		{
+			uint64_t    m_ts;
+			uint64_t    m_frameId;
+			const char* m_name;
+			char        m_phase;
+		};
+
+		struct Ring
+		{
+			Ring();
+
+			int                   m_tid;
+			std::string           m_threadName;
+			bool                  m_free;         // its thread exited, guarded by s_mutex
+			std::atomic<uint64_t> m_head;
+			Event                 m_events[RING_SIZE];
+		};
+
+		// gives the ring back when its thread exits
+		struct RingOwner
+		{
+			RingOwner() : m_ring(NULL) {}
+			~RingOwner();
+			Ring* m_ring;
+		};
+
+		static void record(const char* name, char phase, uint64_t frameId, uint64_t ts);
+		static Ring* ring(bool create);
+
+	private:
+		static std::atomic<bool> s_enabled;
+		static std::mutex        s_mutex;
+		static std::list<Ring*>  s_rings;
+};
+
+// ---------------------------------
+// Trace a scope
+// ---------------------------------
+class TraceScope
+{
+	public:
+		TraceScope(const char* name, uint64_t frameId) : m_name(name), m_frameId(frameId), m_enabled(Tracer::enabled()) {
+			if (m_enabled) {
+				Tracer::begin(m_name, m_frameId);
+			}
+		}
+		~TraceScope() {
+			if (m_enabled) {
+				Tracer::end(m_name, m_frameId);
+			}
+		}
+
+	private:
+		const char* m_name;
+		uint64_t    m_frameId;
+		bool        m_enabled;
+};
+
+#define TRACE_BEGIN(name, frameId) do { if (Tracer::enabled()) Tracer::begin(name, frameId); } while (0)
+#define TRACE_END(name, frameId)   do { if (Tracer::enabled()) Tracer::end(name, frameId); } while (0)
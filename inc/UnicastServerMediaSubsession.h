@@ -18,6 +18,7 @@ class UnicastServerMediaSubsession : public OnDemandServerMediaSubsession , publ
 {
 	public:
 		static UnicastServerMediaSubsession* createNew(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format);
+		const std::string & getStreamFormat() const { return m_format; }
 		
 	protected:
 		UnicastServerMediaSubsession(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format) 
@@ -0,0 +1,74 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2MmapDevice.h
+**
+** V4L2 capture with memory mapped buffers that can stay dequeued while the
+** frames that point in them are in flight
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "DeviceInterface.h"
+
+class V4l2MmapDevice : public DeviceInterface
+{
+	protected:
+		// ---------------------------------
+		// Memory mapped driver buffer
+		// ---------------------------------
+		class MmapBuffer : public CaptureBuffer
+		{
+			public:
+				MmapBuffer(V4l2MmapDevice* device, unsigned int index) : m_device(device), m_index(index), m_length(0), m_dmabufFd(-1) {}
+
+			protected:
+				virtual void requeue() { m_device->requeue(this); }
+
+			public:
+				V4l2MmapDevice* m_device;
+				unsigned int    m_index;
+				size_t          m_length;
+				int             m_dmabufFd;
+		};
+
+	public:
+		static V4l2MmapDevice* createNew(const std::string & device, unsigned int format, int width, int height, int fps, unsigned int nbBuffers);
+		virtual ~V4l2MmapDevice();
+
+		// DeviceInterface
+		virtual size_t read(char* buffer, size_t bufferSize);
+		virtual int getFd()                       { return m_fd; }
+		virtual unsigned long getBufferSize()     { return m_bufferSize; }
+		virtual int getWidth()                    { return m_width; }
+		virtual int getHeight()                   { return m_height; }
+		virtual int getCaptureFormat()            { return m_format; }
+		int getFormat()                           { return m_format; }
+		virtual CaptureBuffer* dequeue();
+		virtual unsigned int getBufferCount()     { return m_buffers.size(); }
+		virtual unsigned int getBuffersInFlight() { return m_inFlight.load(std::memory_order_relaxed); }
+
+		// DMABUF exported for a buffer, -1 if the driver doesn't support it
+		int getDmabufFd(const CaptureBuffer* buffer) { return ((const MmapBuffer*)buffer)->m_dmabufFd; }
+
+	protected:
+		V4l2MmapDevice(int fd);
+		bool init(unsigned int format, int width, int height, int fps, unsigned int nbBuffers);
+		void requeue(MmapBuffer* buffer);
+
+	protected:
+		int                       m_fd;
+		unsigned int              m_format;
+		int                       m_width;
+		int                       m_height;
+		unsigned long             m_bufferSize;
+		std::vector<MmapBuffer*>  m_buffers;
+		std::atomic<unsigned int> m_inFlight;
+		bool                      m_streaming;
+};
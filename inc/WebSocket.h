@@ -0,0 +1,46 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** WebSocket.h
+**
+** WebSocket (RFC 6455) handshake and framing
+**
+** Only what a server pushing binary messages needs : the accept key of the
+** upgrade, the header of the unfragmented server frames and the parsing of
+** the masked client frames.
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+class WebSocket
+{
+	public:
+		enum Opcode { CONTINUATION = 0x0, TEXT = 0x1, BINARY = 0x2, CLOSE = 0x8, PING = 0x9, PONG = 0xA };
+
+		// ---------------------------------
+		// Client frame
+		// ---------------------------------
+		struct Frame
+		{
+			bool        m_final;
+			int         m_opcode;
+			std::string m_payload;  // unmasked
+		};
+
+		// Sec-WebSocket-Accept of a Sec-WebSocket-Key
+		static std::string acceptKey(const std::string & key);
+
+		// header of a final server frame, not masked
+		static std::string frameHeader(int opcode, uint64_t size);
+
+		// parse a frame at the start of data, return the bytes used, 0 if the frame is not complete, -1 if it is not valid or bigger than maxSize
+		static ssize_t parse(const char* data, size_t size, size_t maxSize, Frame & frame);
+};
@@ -0,0 +1,106 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AnnexBScanner.cpp
+**
+** Single pass Annex-B start code scanner for H264/H265 byte streams
+**
+** Candidates are pairs of zero bytes, 16 at a time with SSE2 or NEON. Start
+** codes are rare in the slice data, so most of the blocks are skipped with
+** one compare.
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "AnnexBScanner.h"
+
+const unsigned char* AnnexBScanner::findStartCode(const unsigned char* begin, const unsigned char* end)
+{
+	const unsigned char* p = begin;
+
+#if defined(__SSE2__)
+	const __m128i zero = _mm_setzero_si128();
+	while (p + 16 + 2 <= end) {
+		__m128i current = _mm_loadu_si128((const __m128i*)p);
+		__m128i next    = _mm_loadu_si128((const __m128i*)(p+1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(current, zero), _mm_cmpeq_epi8(next, zero)));
+		while (mask != 0) {
+			unsigned int i = __builtin_ctz(mask);
+			if (p[i+2] == 1) {
+				return p+i;
+			}
+			mask &= mask - 1;
+		}
+		p += 16;
+	}
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+	const uint8x16_t zero = vdupq_n_u8(0);
+	while (p + 16 + 2 <= end) {
+		uint8x16_t pairs = vandq_u8(vceqq_u8(vld1q_u8(p), zero), vceqq_u8(vld1q_u8(p+1), zero));
+		uint64x2_t lanes = vreinterpretq_u64_u8(pairs);
+		if ( (vgetq_lane_u64(lanes, 0) | vgetq_lane_u64(lanes, 1)) != 0 ) {
+			for (unsigned int i = 0; i < 16; ++i) {
+				if ( (p[i] == 0) && (p[i+1] == 0) && (p[i+2] == 1) ) {
+					return p+i;
+				}
+			}
+		}
+		p += 16;
+	}
+#else
+	// memchr is vectorized by the libc, look for the 01 and check the two bytes before
+	if (p + 2 < end) {
+		const unsigned char* one = (const unsigned char*)memchr(p+2, 1, end-p-2);
+		while (one != NULL) {
+			if ( (one[-1] == 0) && (one[-2] == 0) ) {
+				return one-2;
+			}
+			one = (const unsigned char*)memchr(one+1, 1, end-one-1);
+		}
+		return NULL;
+	}
+#endif
+
+	// tail
+	for (; p + 2 < end; ++p) {
+		if ( (p[0] == 0) && (p[1] == 0) && (p[2] == 1) ) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+std::list<AnnexBScanner::Nal> AnnexBScanner::scan(unsigned char* buffer, size_t size, bool keepMarker)
+{
+	std::list<Nal> nalList;
+	const unsigned char* end = buffer + size;
+
+	const unsigned char* startCode = findStartCode(buffer, end);
+	while (startCode != NULL) {
+		// 4 bytes marker when the start code is preceded by a zero
+		const unsigned char* marker = ( (startCode > buffer) && (startCode[-1] == 0) ) ? startCode-1 : startCode;
+		const unsigned char* payload = startCode + 3;
+
+		const unsigned char* nextStartCode = findStartCode(payload, end);
+		const unsigned char* nalEnd = end;
+		if (nextStartCode != NULL) {
+			nalEnd = ( (nextStartCode > payload) && (nextStartCode[-1] == 0) ) ? nextStartCode-1 : nextStartCode;
+		}
+
+		if (nalEnd > payload) {
+			unsigned char* nal = (unsigned char*)(keepMarker ? marker : payload);
+			nalList.push_back(Nal(nal, nalEnd - nal, *payload));
+		}
+		startCode = nextStartCode;
+	}
+	return nalList;
+}
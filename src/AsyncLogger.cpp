@@ -0,0 +1,164 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** AsyncLogger.cpp
+**
+** Logging for the per-frame paths
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "AsyncLogger.h"
+
+std::atomic<bool>     AsyncLogger::s_running(false);
+std::atomic<uint64_t> AsyncLogger::s_dropped(0);
+std::mutex            AsyncLogger::s_mutex;
+std::list<AsyncLogger::Ring*> AsyncLogger::s_rings;
+std::thread           AsyncLogger::s_thread;
+
+AsyncLogger::Record::Record(int level, const char* file, int line)
+	: m_level(level), m_buffer(m_message, sizeof(m_message)), m_stream(&m_buffer)
+{
+	const char* base = strrchr(file, '/');
+	m_stream << (base ? base+1 : file) << ":" << line << "\t";
+}
+
+AsyncLogger::Record::~Record()
+{
+	size_t size = m_buffer.size();
+	while ( (size > 0) && (m_message[size-1] == '\n') ) {
+		size--;
+	}
+	push(m_level, m_message, size);
+}
+
+AsyncLogger::Ring::Ring() : m_free(false), m_head(0), m_tail(0)
+{
+}
+
+// the records left in the ring are still written
+AsyncLogger::RingOwner::~RingOwner()
+{
+	if (m_ring != NULL) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		m_ring->m_free = true;
+	}
+}
+
+// ring of the calling thread, taken on first use from the written ones of the exited threads or allocated
+AsyncLogger::Ring* AsyncLogger::ring()
+{
+	static thread_local RingOwner owner;
+	if (owner.m_ring == NULL) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		for (std::list<Ring*>::iterator it = s_rings.begin(); it != s_rings.end(); ++it) {
+			Ring* r = *it;
+			if ( r->m_free && (r->m_tail.load(std::memory_order_acquire) == r->m_head.load(std::memory_order_relaxed)) ) {
+				r->m_free = false;
+				owner.m_ring = r;
+				break;
+			}
+		}
+		if (owner.m_ring == NULL) {
+			owner.m_ring = new Ring();
+			s_rings.push_back(owner.m_ring);
+		}
+	}
+	return owner.m_ring;
+}
+
+void AsyncLogger::push(int level, const char* message, size_t size)
+{
+	if (!s_running.load(std::memory_order_acquire)) {
+		output(level, message, size);
+		return;
+	}
+	Ring* r = ring();
+	uint64_t head = r->m_head.load(std::memory_order_relaxed);
+	if (head - r->m_tail.load(std::memory_order_acquire) >= RING_SIZE) {
+		s_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	Entry & entry = r->m_entries[head % RING_SIZE];
+	entry.m_level = level;
+	entry.m_size = size;
+	memcpy(entry.m_message, message, size);
+	r->m_head.store(head + 1, std::memory_order_release);
+}
+
+void AsyncLogger::output(int level, const char* message, size_t size)
+{
+#ifdef HAVE_LOG4CPP
+	log4cpp::Category::getRoot().log(level, std::string(message, size));
+#else
+	// LOG takes the name of the level
+	if (level <= ERROR) {
+		LOG(ERROR) << std::string(message, size);
+	} else if (level <= WARN) {
+		LOG(WARN) << std::string(message, size);
+	} else if (level <= NOTICE) {
+		LOG(NOTICE) << std::string(message, size);
+	} else if (level <= INFO) {
+		LOG(INFO) << std::string(message, size);
+	} else {
+		LOG(DEBUG) << std::string(message, size);
+	}
+#endif
+}
+
+// copy the records out of the rings, then write them without holding the lock
+void AsyncLogger::drain()
+{
+	std::vector<Entry> entries;
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+		for (std::list<Ring*>::iterator it = s_rings.begin(); it != s_rings.end(); ++it) {
+			Ring* r = *it;
+			uint64_t tail = r->m_tail.load(std::memory_order_relaxed);
+			uint64_t head = r->m_head.load(std::memory_order_acquire);
+			for (; tail < head; ++tail) {
+				entries.push_back(r->m_entries[tail % RING_SIZE]);
+			}
+			r->m_tail.store(tail, std::memory_order_release);
+		}
+	}
+	for (std::vector<Entry>::iterator it = entries.begin(); it != entries.end(); ++it) {
+		output(it->m_level, it->m_message, it->m_size);
+	}
+}
+
+void AsyncLogger::run()
+{
+	uint64_t reported = 0;
+	while (s_running.load(std::memory_order_acquire)) {
+		drain();
+		uint64_t dropped = s_dropped.load(std::memory_order_relaxed);
+		if (dropped != reported) {
+			LOG(WARN) << "log records dropped:" << (dropped - reported);
+			reported = dropped;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	}
+}
+
+void AsyncLogger::start()
+{
+	if (!s_running.exchange(true)) {
+		s_thread = std::thread(&AsyncLogger::run);
+	}
+}
+
+void AsyncLogger::stop()
+{
+	if (s_running.exchange(false)) {
+		s_thread.join();
+		drain();
+	}
+}
@@ -0,0 +1,170 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** BufferSender.cpp
+**
+** Send memory buffers to a socket without copying them
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+
+#include "logger.h"
+#include "BufferSender.h"
+
+BufferSender::BufferSender(UsageEnvironment& env, int socket)
+	: m_env(env), m_socket(socket), m_current(0), m_pending(0), m_waiting(false), m_failed(false), m_afterFunc(NULL), m_afterClientData(NULL)
+	, m_readHandler(NULL), m_readClientData(NULL)
+{
+}
+
+BufferSender::~BufferSender()
+{
+	this->stopWaiting();
+	for (size_t i = 0; i < m_files.size(); ++i) {
+		::close(m_files[i]);
+	}
+}
+
+void BufferSender::add(const std::shared_ptr<const void> & owner, const char* data, size_t size)
+{
+	if (size > 0) {
+		Buffer buffer;
+		buffer.m_owner = owner;
+		buffer.m_data = data;
+		buffer.m_size = size;
+		buffer.m_fd = -1;
+		buffer.m_offset = 0;
+		m_buffers.push_back(buffer);
+		m_pending += size;
+	}
+}
+
+void BufferSender::addFile(int fd, off_t offset, size_t size)
+{
+	m_files.push_back(fd);
+	if (size > 0) {
+		Buffer buffer;
+		buffer.m_data = NULL;
+		buffer.m_size = size;
+		buffer.m_fd = fd;
+		buffer.m_offset = offset;
+		m_buffers.push_back(buffer);
+		m_pending += size;
+	}
+}
+
+void BufferSender::start(AfterSendingFunc* afterFunc, void* afterClientData)
+{
+	m_afterFunc = afterFunc;
+	m_afterClientData = afterClientData;
+	this->sendPending();
+}
+
+// write as much as the socket accept, then wait for it to be writable
+void BufferSender::sendPending()
+{
+	while (m_current < m_buffers.size()) {
+		ssize_t sent = (m_buffers[m_current].m_fd < 0) ? this->sendBuffers() : this->sendFile(m_buffers[m_current]);
+		if (sent < 0) {
+			if ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) {
+				if (!m_waiting) {
+					int conditions = SOCKET_WRITABLE|SOCKET_EXCEPTION | (m_readHandler ? SOCKET_READABLE : 0);
+					m_env.taskScheduler().setBackgroundHandling(m_socket, conditions, socketHandler, this);
+					m_waiting = true;
+				}
+				return;
+			}
+			LOG(NOTICE) << "send error:" << strerror(errno) << " pending:" << m_pending;
+			m_failed = true;
+			break;
+		}
+		if ( (sent == 0) && (m_buffers[m_current].m_fd >= 0) ) {
+			LOG(NOTICE) << "file truncated pending:" << m_pending;
+			m_failed = true;
+			break;
+		}
+		m_pending -= sent;
+		// release the sent buffers
+		while ( (sent > 0) && (m_current < m_buffers.size()) ) {
+			Buffer & buffer = m_buffers[m_current];
+			if ((size_t)sent >= buffer.m_size) {
+				sent -= buffer.m_size;
+				buffer.m_owner.reset();
+				m_current++;
+			} else {
+				if (buffer.m_fd < 0) {
+					buffer.m_data += sent;
+				}
+				buffer.m_size -= sent;
+				sent = 0;
+			}
+		}
+	}
+	this->done();
+}
+
+// the memory buffers until the next file
+ssize_t BufferSender::sendBuffers()
+{
+	struct iovec iov[64];
+	int nb = 0;
+	for (size_t i = m_current; (i < m_buffers.size()) && (m_buffers[i].m_fd < 0) && (nb < 64); ++i, ++nb) {
+		iov[nb].iov_base = (void*)m_buffers[i].m_data;
+		iov[nb].iov_len = m_buffers[i].m_size;
+	}
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = nb;
+	return sendmsg(m_socket, &msg, MSG_NOSIGNAL);
+}
+
+// the file range is copied by the kernel, sendfile() moves the offset
+ssize_t BufferSender::sendFile(Buffer & buffer)
+{
+	return sendfile(m_socket, buffer.m_fd, &buffer.m_offset, buffer.m_size);
+}
+
+// live555 has one handler per socket, the read handler is given back when the sender doesn't wait anymore
+void BufferSender::stopWaiting()
+{
+	if (m_waiting) {
+		if (m_readHandler != NULL) {
+			m_env.taskScheduler().setBackgroundHandling(m_socket, SOCKET_READABLE|SOCKET_EXCEPTION, m_readHandler, m_readClientData);
+		} else {
+			m_env.taskScheduler().disableBackgroundHandling(m_socket);
+		}
+		m_waiting = false;
+	}
+}
+
+void BufferSender::socketHandler(void* clientData, int mask)
+{
+	BufferSender* sender = (BufferSender*)clientData;
+	if ( (sender->m_readHandler != NULL) && (mask & (SOCKET_READABLE|SOCKET_EXCEPTION)) ) {
+		// the reader may delete the sender, the write is done on the next call
+		sender->m_readHandler(sender->m_readClientData, mask);
+	} else {
+		sender->sendPending();
+	}
+}
+
+void BufferSender::done()
+{
+	this->stopWaiting();
+	m_buffers.clear();
+	m_current = 0;
+	if (m_afterFunc != NULL) {
+		AfterSendingFunc* afterFunc = m_afterFunc;
+		m_afterFunc = NULL;
+		afterFunc(m_afterClientData);
+	}
+}
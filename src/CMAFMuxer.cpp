@@ -0,0 +1,535 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CMAFMuxer.cpp
+**
+** Package H264/H265 NAL units in CMAF fragmented MP4
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <sstream>
+#include <iomanip>
+
+#include "logger.h"
+#include "CMAFMuxer.h"
+#include "Metrics.h"
+
+#define TIMESCALE 90000
+
+// -----------------------------------------
+//    ISO BMFF boxes
+// -----------------------------------------
+class BoxWriter
+{
+	public:
+		BoxWriter(std::string & out) : m_out(out) {}
+
+		void open(const char* type)            { m_boxes.push_back(m_out.size()); u32(0); m_out.append(type, 4); }
+		void openFull(const char* type, uint8_t version, uint32_t flags) { open(type); u32((version<<24) | flags); }
+		void close()                           { size_t start = m_boxes.back(); m_boxes.pop_back(); set32(start, m_out.size() - start); }
+
+		void u8(uint8_t value)                 { m_out.push_back((char)value); }
+		void u16(uint16_t value)               { u8(value>>8); u8(value); }
+		void u32(uint32_t value)               { u16(value>>16); u16(value); }
+		void u64(uint64_t value)               { u32(value>>32); u32(value); }
+		void zero(size_t size)                 { m_out.append(size, '\0'); }
+		void bytes(const std::string & value)  { m_out.append(value); }
+		void set32(size_t pos, uint32_t value) {
+			m_out[pos] = value>>24; m_out[pos+1] = value>>16; m_out[pos+2] = value>>8; m_out[pos+3] = value;
+		}
+		void matrix()                          { u32(0x10000); u32(0); u32(0); u32(0); u32(0x10000); u32(0); u32(0); u32(0); u32(0x40000000); }
+
+	private:
+		std::string &       m_out;
+		std::vector<size_t> m_boxes;
+};
+
+// -----------------------------------------
+//    Exp-Golomb reader of a NAL payload
+// -----------------------------------------
+class BitReader
+{
+	public:
+		// remove the emulation prevention bytes
+		BitReader(const std::string & nal, size_t offset) : m_pos(0) {
+			int zeros = 0;
+			for (size_t i = offset; i < nal.size(); ++i) {
+				unsigned char value = nal[i];
+				if ( (zeros >= 2) && (value == 3) ) {
+					zeros = 0;
+					continue;
+				}
+				zeros = (value == 0) ? zeros+1 : 0;
+				m_rbsp.push_back(value);
+			}
+		}
+
+		uint32_t u(int bits) {
+			uint32_t value = 0;
+			for (int i = 0; i < bits; ++i) {
+				size_t byte = m_pos/8;
+				int bit = (byte < m_rbsp.size()) ? (m_rbsp[byte] >> (7 - m_pos%8)) & 1 : 0;
+				value = (value<<1) | bit;
+				m_pos++;
+			}
+			return value;
+		}
+		uint32_t ue() {
+			int zeros = 0;
+			while ( (u(1) == 0) && (zeros < 32) && !this->end() ) {
+				zeros++;
+			}
+			return ((1u<<zeros) - 1) + u(zeros);
+		}
+		int32_t se() {
+			uint32_t value = ue();
+			return (value & 1) ? (int32_t)((value+1)/2) : -(int32_t)(value/2);
+		}
+		bool end() const { return m_pos >= m_rbsp.size()*8; }
+		const std::string & rbsp() const { return m_rbsp; }
+
+	private:
+		std::string m_rbsp;
+		size_t      m_pos;
+};
+
+// -----------------------------------------
+//    CMAFMuxer
+// -----------------------------------------
+CMAFMuxer::CMAFMuxer(UsageEnvironment& env, FramedSource* inputSource, const std::string& format, MemoryBufferSink* sink)
+	: FramedFilter(env, inputSource), m_h265(format == "video/H265"), m_sink(sink), m_buffer(2*OutPacketBuffer::maxSize)
+	, m_auStart(0), m_end(0), m_hasAu(false), m_auKey(false), m_sequence(0)
+{
+	timerclear(&m_auTime);
+	timerclear(&m_firstTime);
+	timerclear(&m_dropTime);
+}
+
+// read the next NAL after the current access unit, with room for its length
+void CMAFMuxer::doGetNextFrame()
+{
+	if (m_buffer.size() - m_end < OutPacketBuffer::maxSize) {
+		// move the access unit in progress to the beginning of the buffer
+		memmove(&m_buffer[0], &m_buffer[m_auStart], m_end - m_auStart);
+		m_end -= m_auStart;
+		m_auStart = 0;
+		if (m_buffer.size() - m_end < 4 + OutPacketBuffer::maxSize/4) {
+			// no room left for a slice, the access unit in progress is dropped with its next NALs
+			LOG(NOTICE) << "drop access unit size:" << m_end;
+			this->dropAccessUnit(m_auTime);
+		}
+	}
+	fInputSource->getNextFrame(&m_buffer[m_end+4], m_buffer.size() - m_end - 4,
+			afterGettingFrame, this,
+			handleClosure, this);
+}
+
+void CMAFMuxer::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime)
+{
+	if (numTruncatedBytes > 0) {
+		// an access unit without all its slices cannot be a sample
+		LOG(NOTICE) << "drop access unit, NAL size:" << frameSize << " truncated:" << numTruncatedBytes;
+		if ( !m_hasAu || !timercmp(&presentationTime, &m_auTime, !=) ) {
+			this->dropAccessUnit(presentationTime);
+		} else {
+			m_dropTime = presentationTime;
+		}
+		this->doGetNextFrame();
+		return;
+	}
+	if (frameSize == 0) {
+		this->doGetNextFrame();
+		return;
+	}
+
+	const unsigned char* nal = &m_buffer[m_end+4];
+	int type = m_h265 ? (nal[0] & 0x7E)>>1 : (nal[0] & 0x1F);
+	bool config = m_h265 ? ( (type >= 32) && (type <= 34) ) : ( (type == 7) || (type == 8) );
+	bool skip = m_h265 ? (type == 35) : (type == 9); // access unit delimiter
+	if ( !config && timerisset(&m_dropTime) ) {
+		if (!timercmp(&presentationTime, &m_dropTime, !=)) {
+			// rest of a dropped access unit
+			this->doGetNextFrame();
+			return;
+		}
+		timerclear(&m_dropTime);
+	}
+
+	// the previous access unit is complete when a NAL of the next one comes
+	bool delivered = false;
+	if ( m_hasAu && (config || timercmp(&presentationTime, &m_auTime, !=)) ) {
+		delivered = this->deliverFragment(presentationTime);
+		// the NAL just read is at the beginning of the next access unit
+		m_auStart = m_end;
+		m_hasAu = false;
+	}
+
+	if (config) {
+		std::string* parameterSet = m_h265 ? (type == 32 ? &m_vps : (type == 33 ? &m_sps : &m_pps)) : (type == 7 ? &m_sps : &m_pps);
+		if ( (parameterSet->size() != frameSize) || (memcmp(parameterSet->c_str(), nal, frameSize) != 0) ) {
+			parameterSet->assign((const char*)nal, frameSize);
+			this->updateInit();
+		}
+	} else if (!skip) {
+		// 4 bytes length before the NAL
+		m_buffer[m_end] = frameSize>>24;
+		m_buffer[m_end+1] = frameSize>>16;
+		m_buffer[m_end+2] = frameSize>>8;
+		m_buffer[m_end+3] = frameSize;
+		m_end += 4 + frameSize;
+		if (!m_hasAu) {
+			m_hasAu = true;
+			m_auTime = presentationTime;
+			m_auKey = false;
+		}
+		m_auKey |= m_h265 ? ( (type >= 16) && (type <= 21) ) : (type == 5);
+	}
+
+	if (delivered) {
+		afterGetting(this);
+	} else {
+		this->doGetNextFrame();
+	}
+}
+
+// forget the access unit in progress, the next NALs with the same time are dropped too
+void CMAFMuxer::dropAccessUnit(const timeval & time)
+{
+	m_end = m_auStart;
+	m_hasAu = false;
+	m_dropTime = time;
+}
+
+// moof+mdat of the access unit, false if it can't be decoded yet
+bool CMAFMuxer::deliverFragment(const timeval & next)
+{
+	size_t size = m_end - m_auStart;
+	if ( (m_init == NULL) || (size == 0) || ( !timerisset(&m_firstTime) && !m_auKey ) ) {
+		// wait the parameter sets and the first keyframe
+		return false;
+	}
+	if (!timerisset(&m_firstTime)) {
+		m_firstTime = m_auTime;
+	}
+	uint64_t decodeTime = ((int64_t)(m_auTime.tv_sec - m_firstTime.tv_sec)*1000000 + (m_auTime.tv_usec - m_firstTime.tv_usec)) * TIMESCALE / 1000000;
+	uint64_t nextTime = ((int64_t)(next.tv_sec - m_firstTime.tv_sec)*1000000 + (next.tv_usec - m_firstTime.tv_usec)) * TIMESCALE / 1000000;
+	uint32_t duration = (nextTime > decodeTime) ? nextTime - decodeTime : 0;
+
+	std::string moof;
+	BoxWriter box(moof);
+	box.open("moof");
+		box.openFull("mfhd", 0, 0);
+			box.u32(++m_sequence);
+		box.close();
+		box.open("traf");
+			box.openFull("tfhd", 0, 0x020000); // default-base-is-moof
+				box.u32(1);
+			box.close();
+			box.openFull("tfdt", 1, 0);
+				box.u64(decodeTime);
+			box.close();
+			box.openFull("trun", 0, 0x000701); // data-offset, duration, size, flags
+				box.u32(1);
+				size_t dataOffset = moof.size();
+				box.u32(0);
+				box.u32(duration);
+				box.u32(size);
+				box.u32(m_auKey ? 0x02000000 : 0x01010000);
+			box.close();
+		box.close();
+	box.close();
+	box.set32(dataOffset, moof.size() + 8);
+
+	// mdat
+	fFrameSize = moof.size() + 8 + size;
+	if (fFrameSize > fMaxSize) {
+		LOG(NOTICE) << "fragment size:" << fFrameSize << " bigger than buffer:" << fMaxSize;
+		return false;
+	}
+	fNumTruncatedBytes = 0;
+	memcpy(fTo, moof.c_str(), moof.size());
+	unsigned char* mdat = fTo + moof.size();
+	uint32_t mdatSize = 8 + size;
+	mdat[0] = mdatSize>>24; mdat[1] = mdatSize>>16; mdat[2] = mdatSize>>8; mdat[3] = mdatSize;
+	memcpy(mdat + 4, "mdat", 4);
+	memcpy(mdat + 8, &m_buffer[m_auStart], size);
+	CopyMetrics::copied(CopyMetrics::SEGMENT, size);
+	fPresentationTime = m_auTime;
+	fDurationInMicroseconds = 0;
+
+	m_sink->inputFrame(m_auTime, m_auKey);
+	return true;
+}
+
+// ftyp+moov when the parameter sets are known
+void CMAFMuxer::updateInit()
+{
+	if ( m_sps.empty() || m_pps.empty() || (m_h265 && m_vps.empty()) ) {
+		return;
+	}
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::string config;
+	BoxWriter configBox(config);
+	if (m_h265) {
+		std::string hvcc;
+		if (!this->parseH265Sps(width, height, hvcc)) {
+			return;
+		}
+		configBox.open("hvcC");
+			configBox.bytes(hvcc);
+			configBox.u8(3);
+			const std::string* sets[] = { &m_vps, &m_sps, &m_pps };
+			const uint8_t types[] = { 32, 33, 34 };
+			for (int i = 0; i < 3; ++i) {
+				configBox.u8(0x80 | types[i]);
+				configBox.u16(1);
+				configBox.u16(sets[i]->size());
+				configBox.bytes(*sets[i]);
+			}
+		configBox.close();
+	} else {
+		if ( (m_sps.size() < 4) || !this->parseH264Sps(width, height) ) {
+			return;
+		}
+		configBox.open("avcC");
+			configBox.u8(1);
+			configBox.u8(m_sps[1]);
+			configBox.u8(m_sps[2]);
+			configBox.u8(m_sps[3]);
+			configBox.u8(0xFF);
+			configBox.u8(0xE1);
+			configBox.u16(m_sps.size());
+			configBox.bytes(m_sps);
+			configBox.u8(1);
+			configBox.u16(m_pps.size());
+			configBox.bytes(m_pps);
+		configBox.close();
+
+		std::ostringstream codecs;
+		codecs << "avc1." << std::hex << std::setfill('0');
+		for (int i = 1; i < 4; ++i) {
+			codecs << std::setw(2) << (int)(unsigned char)m_sps[i];
+		}
+		m_codecs = codecs.str();
+	}
+
+	std::string* init = new std::string();
+	BoxWriter box(*init);
+	box.open("ftyp");
+		init->append("iso6", 4);
+		box.u32(0);
+		init->append("iso6cmfcdashmp41", 16);
+	box.close();
+	box.open("moov");
+		box.openFull("mvhd", 0, 0);
+			box.u32(0); box.u32(0); box.u32(1000); box.u32(0);
+			box.u32(0x00010000); box.u16(0x0100); box.zero(10);
+			box.matrix();
+			box.zero(24);
+			box.u32(2);
+		box.close();
+		box.open("trak");
+			box.openFull("tkhd", 0, 0x000003);
+				box.u32(0); box.u32(0); box.u32(1); box.u32(0); box.u32(0);
+				box.zero(8); box.u16(0); box.u16(0); box.u16(0); box.u16(0);
+				box.matrix();
+				box.u32(width<<16); box.u32(height<<16);
+			box.close();
+			box.open("mdia");
+				box.openFull("mdhd", 0, 0);
+					box.u32(0); box.u32(0); box.u32(TIMESCALE); box.u32(0);
+					box.u16(0x55C4); box.u16(0);
+				box.close();
+				box.openFull("hdlr", 0, 0);
+					box.u32(0); init->append("vide", 4); box.zero(12);
+					init->append("VideoHandler", 13);
+				box.close();
+				box.open("minf");
+					box.openFull("vmhd", 0, 1);
+						box.zero(8);
+					box.close();
+					box.open("dinf");
+						box.openFull("dref", 0, 0);
+							box.u32(1);
+							box.openFull("url ", 0, 1);
+							box.close();
+						box.close();
+					box.close();
+					box.open("stbl");
+						box.openFull("stsd", 0, 0);
+							box.u32(1);
+							box.open(m_h265 ? "hvc1" : "avc1");
+								box.zero(6); box.u16(1);
+								box.zero(16);
+								box.u16(width); box.u16(height);
+								box.u32(0x00480000); box.u32(0x00480000); box.u32(0);
+								box.u16(1); box.zero(32);
+								box.u16(0x0018); box.u16(0xFFFF);
+								box.bytes(config);
+							box.close();
+						box.close();
+						box.openFull("stts", 0, 0); box.u32(0); box.close();
+						box.openFull("stsc", 0, 0); box.u32(0); box.close();
+						box.openFull("stsz", 0, 0); box.u32(0); box.u32(0); box.close();
+						box.openFull("stco", 0, 0); box.u32(0); box.close();
+					box.close();
+				box.close();
+			box.close();
+		box.close();
+		box.open("mvex");
+			box.openFull("trex", 0, 0);
+				box.u32(1); box.u32(1); box.u32(0); box.u32(0); box.u32(0);
+			box.close();
+		box.close();
+	box.close();
+
+	m_init.reset(init);
+	LOG(NOTICE) << "CMAF init segment codecs:" << m_codecs << " " << width << "x" << height;
+}
+
+bool CMAFMuxer::parseH264Sps(unsigned int & width, unsigned int & height)
+{
+	BitReader sps(m_sps, 1);
+	unsigned int profile = sps.u(8);
+	sps.u(16); // constraints, level
+	sps.ue();  // seq_parameter_set_id
+	unsigned int chromaFormat = 1;
+	if ( (profile == 100) || (profile == 110) || (profile == 122) || (profile == 244) || (profile == 44) || (profile == 83) || (profile == 86) || (profile == 118) || (profile == 128) || (profile == 138) || (profile == 139) || (profile == 134) || (profile == 135) ) {
+		chromaFormat = sps.ue();
+		if (chromaFormat == 3) {
+			sps.u(1);
+		}
+		sps.ue(); sps.ue(); sps.u(1);
+		if (sps.u(1)) {
+			// scaling matrix
+			for (int i = 0; i < ((chromaFormat != 3) ? 8 : 12); ++i) {
+				if (sps.u(1)) {
+					int size = (i < 6) ? 16 : 64;
+					int last = 8, next = 8;
+					for (int j = 0; j < size; ++j) {
+						if (next != 0) {
+							next = (last + sps.se() + 256) % 256;
+						}
+						last = (next == 0) ? last : next;
+					}
+				}
+			}
+		}
+	}
+	sps.ue(); // log2_max_frame_num_minus4
+	unsigned int pocType = sps.ue();
+	if (pocType == 0) {
+		sps.ue();
+	} else if (pocType == 1) {
+		sps.u(1); sps.se(); sps.se();
+		unsigned int count = sps.ue();
+		for (unsigned int i = 0; (i < count) && !sps.end(); ++i) {
+			sps.se();
+		}
+	}
+	sps.ue(); sps.u(1);
+	unsigned int widthInMbs = sps.ue() + 1;
+	unsigned int heightInMapUnits = sps.ue() + 1;
+	unsigned int frameMbsOnly = sps.u(1);
+	if (!frameMbsOnly) {
+		sps.u(1);
+	}
+	sps.u(1);
+	unsigned int cropLeft = 0, cropRight = 0, cropTop = 0, cropBottom = 0;
+	if (sps.u(1)) {
+		cropLeft = sps.ue(); cropRight = sps.ue(); cropTop = sps.ue(); cropBottom = sps.ue();
+	}
+	unsigned int cropX = (chromaFormat == 1 || chromaFormat == 2) ? 2 : 1;
+	unsigned int cropY = ((chromaFormat == 1) ? 2 : 1) * (2 - frameMbsOnly);
+	width = widthInMbs*16 - (cropLeft + cropRight)*cropX;
+	height = (2 - frameMbsOnly)*heightInMapUnits*16 - (cropTop + cropBottom)*cropY;
+	return !sps.end();
+}
+
+bool CMAFMuxer::parseH265Sps(unsigned int & width, unsigned int & height, std::string & hvcc)
+{
+	BitReader sps(m_sps, 2);
+	if (sps.rbsp().size() < 13) {
+		return false;
+	}
+	sps.u(4);
+	unsigned int maxSubLayers = sps.u(3);
+	unsigned int temporalIdNesting = sps.u(1);
+	// general profile_tier_level is byte aligned
+	std::string ptl(sps.rbsp().substr(1, 12));
+	sps.u(96);
+	unsigned int subLayerProfile = 0, subLayerLevel = 0;
+	for (unsigned int i = 0; i < maxSubLayers; ++i) {
+		subLayerProfile |= sps.u(1) << i;
+		subLayerLevel |= sps.u(1) << i;
+	}
+	if (maxSubLayers > 0) {
+		for (unsigned int i = maxSubLayers; i < 8; ++i) {
+			sps.u(2);
+		}
+	}
+	for (unsigned int i = 0; i < maxSubLayers; ++i) {
+		if (subLayerProfile & (1<<i)) {
+			sps.u(32); sps.u(32); sps.u(24);
+		}
+		if (subLayerLevel & (1<<i)) {
+			sps.u(8);
+		}
+	}
+	sps.ue(); // sps_seq_parameter_set_id
+	unsigned int chromaFormat = sps.ue();
+	if (chromaFormat == 3) {
+		sps.u(1);
+	}
+	width = sps.ue();
+	height = sps.ue();
+	if (sps.u(1)) {
+		unsigned int subWidth = (chromaFormat == 1 || chromaFormat == 2) ? 2 : 1;
+		unsigned int subHeight = (chromaFormat == 1) ? 2 : 1;
+		unsigned int left = sps.ue(), right = sps.ue(), top = sps.ue(), bottom = sps.ue();
+		width -= (left + right)*subWidth;
+		height -= (top + bottom)*subHeight;
+	}
+	unsigned int bitDepthLuma = sps.ue();
+	unsigned int bitDepthChroma = sps.ue();
+
+	BoxWriter box(hvcc);
+	box.u8(1);
+	box.bytes(ptl);
+	box.u16(0xF000);
+	box.u8(0xFC);
+	box.u8(0xFC | chromaFormat);
+	box.u8(0xF8 | bitDepthLuma);
+	box.u8(0xF8 | bitDepthChroma);
+	box.u16(0);
+	box.u8(((maxSubLayers+1)<<3) | (temporalIdNesting<<2) | 3);
+
+	// hvc1.<space><profile>.<compatibility>.<tier><level>.<constraints>
+	unsigned char profileSpace = (unsigned char)ptl[0] >> 6;
+	uint32_t compatibility = ((unsigned char)ptl[1]<<24) | ((unsigned char)ptl[2]<<16) | ((unsigned char)ptl[3]<<8) | (unsigned char)ptl[4];
+	uint32_t reversed = 0;
+	for (int i = 0; i < 32; ++i) {
+		reversed |= ((compatibility >> i) & 1) << (31 - i);
+	}
+	std::ostringstream codecs;
+	codecs << "hvc1.";
+	if (profileSpace > 0) {
+		codecs << (char)('A' + profileSpace - 1);
+	}
+	codecs << ((unsigned char)ptl[0] & 0x1F) << "." << std::hex << std::uppercase << reversed << std::dec;
+	codecs << "." << (((unsigned char)ptl[0] & 0x20) ? 'H' : 'L') << (int)(unsigned char)ptl[11];
+	int lastConstraint = 10;
+	while ( (lastConstraint > 4) && (ptl[lastConstraint] == 0) ) {
+		lastConstraint--;
+	}
+	for (int i = 5; i <= lastConstraint; ++i) {
+		codecs << "." << std::hex << std::uppercase << (int)(unsigned char)ptl[i] << std::dec;
+	}
+	m_codecs = codecs.str();
+	return !sps.end();
+}
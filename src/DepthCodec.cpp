@@ -0,0 +1,181 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** DepthCodec.cpp
+**
+** Lossless compression of the 16 bits depth frames for the browser viewers
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include "DepthCodec.h"
+
+void DepthCodec::encodeDelta(const char* data, size_t size, std::string & out)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	size_t count = size / 2;
+
+	// the worst case is 3 bytes per sample
+	out.resize(count * 3);
+	unsigned char* dst = (unsigned char*)&out[0];
+	uint16_t previous = 0;
+	size_t i = 0;
+	while (i < count) {
+		uint16_t sample = p[2*i] | (p[2*i+1] << 8);
+		if (sample == previous) {
+			size_t run = 1;
+			while ( (run < 64) && (i + run < count) && ((p[2*(i+run)] | (p[2*(i+run)+1] << 8)) == previous) ) {
+				run++;
+			}
+			*dst++ = (run == 1) ? 0 : 0xC0 + run - 1;
+			i += run;
+			continue;
+		}
+		int16_t diff = (int16_t)(sample - previous);
+		uint16_t zigzag = (uint16_t)((diff << 1) ^ (diff >> 15));
+		if (zigzag < 0x80) {
+			*dst++ = zigzag;
+		} else if (zigzag < 0x4000) {
+			*dst++ = 0x80 | (zigzag >> 8);
+			*dst++ = zigzag & 0xFF;
+		} else {
+			*dst++ = 0xC0;
+			*dst++ = sample >> 8;
+			*dst++ = sample & 0xFF;
+		}
+		previous = sample;
+		i++;
+	}
+	out.resize(dst - (unsigned char*)&out[0]);
+}
+
+// CRC of the PNG chunks, the table is built once for all the encoding threads
+struct CrcTable
+{
+	CrcTable() {
+		for (uint32_t n = 0; n < 256; ++n) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; ++k) {
+				c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+			}
+			m_table[n] = c;
+		}
+	}
+	uint32_t m_table[256];
+};
+
+static uint32_t chunkCrc(const unsigned char* data, size_t size)
+{
+	static const CrcTable crcTable;
+	uint32_t crc = 0xFFFFFFFF;
+	for (size_t i = 0; i < size; ++i) {
+		crc = crcTable.m_table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return crc ^ 0xFFFFFFFF;
+}
+
+static void appendUint32(std::string & out, uint32_t value)
+{
+	out += (char)(value >> 24);
+	out += (char)(value >> 16);
+	out += (char)(value >> 8);
+	out += (char)value;
+}
+
+static void appendChunk(std::string & out, const char* type, const std::string & data)
+{
+	appendUint32(out, data.size());
+	size_t start = out.size();
+	out.append(type, 4);
+	out += data;
+	appendUint32(out, chunkCrc((const unsigned char*)out.c_str() + start, out.size() - start));
+}
+
+// zlib stream of the filtered rows
+static void zlibStream(const std::string & data, std::string & out)
+{
+#ifdef HAVE_ZLIB
+	uLongf size = compressBound(data.size());
+	out.resize(size);
+	if (compress2((Bytef*)&out[0], &size, (const Bytef*)data.c_str(), data.size(), Z_BEST_SPEED) == Z_OK) {
+		out.resize(size);
+		return;
+	}
+#endif
+	// stored blocks
+	out.clear();
+	out += (char)0x78;
+	out += (char)0x01;
+	size_t pos = 0;
+	do {
+		size_t length = std::min(data.size() - pos, (size_t)0xFFFF);
+		out += (char)((pos + length == data.size()) ? 1 : 0);
+		out += (char)(length & 0xFF);
+		out += (char)(length >> 8);
+		out += (char)(~length & 0xFF);
+		out += (char)((~length >> 8) & 0xFF);
+		out.append(data, pos, length);
+		pos += length;
+	} while (pos < data.size());
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (size_t i = 0; i < data.size(); ++i) {
+		a = (a + (unsigned char)data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	appendUint32(out, (b << 16) | a);
+}
+
+bool DepthCodec::encodePNG(const char* data, size_t size, int width, int height, std::string & out)
+{
+	if ( (width <= 0) || (height <= 0) || (size < (size_t)width * height * 2) ) {
+		return false;
+	}
+
+	// big endian samples, each row starts with the Sub filter
+	const unsigned char* p = (const unsigned char*)data;
+	size_t stride = 1 + (size_t)width * 2;
+	std::string rows(stride * height, '\0');
+	for (int y = 0; y < height; ++y) {
+		unsigned char* row = (unsigned char*)&rows[y * stride];
+		const unsigned char* src = p + (size_t)y * width * 2;
+		row[0] = 1;
+		unsigned char previousHigh = 0;
+		unsigned char previousLow = 0;
+		for (int x = 0; x < width; ++x) {
+			unsigned char high = src[2*x+1];
+			unsigned char low = src[2*x];
+			row[1+2*x] = high - previousHigh;
+			row[2+2*x] = low - previousLow;
+			previousHigh = high;
+			previousLow = low;
+		}
+	}
+
+	std::string header;
+	appendUint32(header, width);
+	appendUint32(header, height);
+	header += (char)16;  // bit depth
+	header += (char)0;   // grayscale
+	header += (char)0;   // deflate
+	header += (char)0;   // adaptive filtering
+	header += (char)0;   // no interlace
+
+	std::string compressed;
+	zlibStream(rows, compressed);
+
+	out.assign("\x89PNG\r\n\x1a\n", 8);
+	appendChunk(out, "IHDR", header);
+	appendChunk(out, "IDAT", compressed);
+	appendChunk(out, "IEND", std::string());
+	return true;
+}
@@ -10,28 +10,23 @@
 ** -------------------------------------------------------------------------*/
 
 #include <fcntl.h>
+#include <errno.h>
 #include <iomanip>
 #include <sstream>
 
 // project
 #include "logger.h"
+#include "AsyncLogger.h"
 #include "DeviceSource.h"
 
-// ---------------------------------
-// V4L2 FramedSource Stats
-// ---------------------------------
-int  V4L2DeviceSource::Stats::notify(int tv_sec, int framesize)
+// milliseconds since a timestamp, only computed when it is logged
+static long elapsedMs(const timeval & ref)
 {
-	m_fps++;
-	m_size+=framesize;
-	if (tv_sec != m_fps_sec)
-	{
-		LOG(INFO) << m_msg  << "tv_sec:" <<   tv_sec << " fps:" << m_fps << " bandwidth:"<< (m_size/128) << "kbps";		
-		m_fps_sec = tv_sec;
-		m_fps = 0;
-		m_size = 0;
-	}
-	return m_fps;
+	timeval tv;
+	gettimeofday(&tv, NULL);
+	timeval diff;
+	timersub(&tv,&ref,&diff);
+	return diff.tv_sec*1000+diff.tv_usec/1000;
 }
 
 // ---------------------------------
@@ -50,17 +45,28 @@ V4L2DeviceSource* V4L2DeviceSource::createNew(UsageEnvironment& env, DeviceInter
 // Constructor
 V4L2DeviceSource::V4L2DeviceSource(UsageEnvironment& env, DeviceInterface * device, int outputFd, unsigned int queueSize, bool useThread) 
 	: FramedSource(env), 
-	m_in("in"), 
-	m_out("out") , 
+	m_metrics("v4l2"),
+	m_frameId(0),
+	m_deliveringId(0),
+	m_hasKeyframes(false),
+	m_dropUntilKeyframe(false),
 	m_outfd(outputFd),
 	m_device(device),
-	m_queueSize(queueSize)
+	m_queueSize(queueSize),
+	m_lastSequence(0)
 {
 	m_eventTriggerId = envir().taskScheduler().createEventTrigger(V4L2DeviceSource::deliverFrameStub);
 	memset(&m_thid, 0, sizeof(m_thid));
 	memset(&m_mutex, 0, sizeof(m_mutex));
 	if (m_device)
 	{
+		unsigned int bufferCount = m_device->getBufferCount();
+		if ( (bufferCount > 1) && (m_queueSize > bufferCount - 1) )
+		{
+			// zero-copy : the queue is full before the driver runs out of buffers
+			LOG(NOTICE) << "queue size:" << m_queueSize << " limited to the driver buffers:" << bufferCount - 1;
+			m_queueSize = bufferCount - 1;
+		}
 		if (useThread)
 		{
 			pthread_mutex_init(&m_mutex, NULL);
@@ -79,6 +85,12 @@ V4L2DeviceSource::~V4L2DeviceSource()
 	envir().taskScheduler().deleteEventTrigger(m_eventTriggerId);
 	pthread_join(m_thid, NULL);	
 	pthread_mutex_destroy(&m_mutex);
+	// give the driver buffers back before closing the device
+	while (!m_captureQueue.empty())
+	{
+		delete m_captureQueue.front();
+		m_captureQueue.pop_front();
+	}
 	delete m_device;
 }
 
@@ -91,18 +103,23 @@ void* V4L2DeviceSource::thread()
 	timeval tv;
 	
 	LOG(NOTICE) << "begin thread"; 
+	Tracer::setThreadName("capture");
 	while (!stop) 
 	{
 		int fd = m_device->getFd();
 		FD_SET(fd, &fdset);
 		tv.tv_sec=1;
 		tv.tv_usec=0;	
+		TRACE_BEGIN("select", m_frameId+1);
+		uint64_t waitStart = LatencyHistogram::now();
 		int ret = select(fd+1, &fdset, NULL, NULL, &tv);
+		TRACE_END("select", m_frameId+1);
 		if (ret == 1)
 		{
+			m_metrics.latency(SourceMetrics::CAPTURE_WAIT, LatencyHistogram::now() - waitStart);
 			if (FD_ISSET(fd, &fdset))
 			{
-				if (this->getNextFrame() <= 0)
+				if (this->getNextFrame() == READ_ERROR)
 				{
 					LOG(ERROR) << "error:" << strerror(errno); 						
 					stop=1;
@@ -139,11 +156,23 @@ void V4L2DeviceSource::deliverFrame()
 	{
 		fDurationInMicroseconds = 0;
 		fFrameSize = 0;
+		uint64_t frameId = 0;
 		
+		// the span includes the wait for the mutex and is tagged with the frame it dequeues
+		bool tracing = Tracer::enabled();
+		uint64_t dequeueStart = tracing ? Tracer::now() : 0;
 		pthread_mutex_lock (&m_mutex);
+		if (!m_captureQueue.empty())
+		{
+			frameId = m_captureQueue.front()->m_id;
+		}
+		if (tracing)
+		{
+			Tracer::begin("dequeue", frameId, dequeueStart);
+		}
 		if (m_captureQueue.empty())
 		{
-			LOG(DEBUG) << "Queue is empty";		
+			ALOG(DEBUG) << "Queue is empty";		
 		}
 		else
 		{				
@@ -151,8 +180,10 @@ void V4L2DeviceSource::deliverFrame()
 			gettimeofday(&curTime, NULL);			
 			Frame * frame = m_captureQueue.front();
 			m_captureQueue.pop_front();
+			frameId = frame->m_id;
+			m_deliveringId = frame->m_id;
 	
-			m_out.notify(curTime.tv_sec, frame->m_size);
+			m_metrics.queueDepth(m_captureQueue.size());
 			if (frame->m_size > fMaxSize) 
 			{
 				fFrameSize = fMaxSize;
@@ -164,19 +195,42 @@ void V4L2DeviceSource::deliverFrame()
 			}
 			timeval diff;
 			timersub(&curTime,&(frame->m_timestamp),&diff);
+			if (diff.tv_sec >= 0)
+			{
+				m_metrics.latency(SourceMetrics::QUEUE, diff.tv_sec*1000000ULL + diff.tv_usec);
+			}
 
-			LOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec << "." << curTime.tv_usec << "\tsize:" << fFrameSize <<"\tdiff:" <<  (diff.tv_sec*1000+diff.tv_usec/1000) << "ms\tqueue:" << m_captureQueue.size();		
+			ALOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec << "." << curTime.tv_usec << "\tsize:" << fFrameSize <<"\tdiff:" <<  (diff.tv_sec*1000+diff.tv_usec/1000) << "ms\tqueue:" << m_captureQueue.size();		
 			
 			fPresentationTime = frame->m_timestamp;
+			TRACE_BEGIN("delivery_copy", frameId);
+			uint64_t copyStart = LatencyHistogram::now();
 			memcpy(fTo, frame->m_buffer, fFrameSize);
+			CopyMetrics::copied(CopyMetrics::DELIVERY, fFrameSize);
+			m_metrics.latency(SourceMetrics::DELIVERY, LatencyHistogram::now() - copyStart);
+			TRACE_END("delivery_copy", frameId);
+			m_metrics.delivered(fFrameSize);
+			this->frameDelivered(*frame);
 			delete frame;
+			if (m_device)
+			{
+				m_metrics.buffersInFlight(m_device->getBuffersInFlight());
+			}
 		}
 		pthread_mutex_unlock (&m_mutex);
+		if (tracing)
+		{
+			Tracer::end("dequeue", frameId);
+		}
 		
 		if (fFrameSize > 0)
 		{
 			// send Frame to the consumer
+			TraceScope trace("send", frameId);
+			Tracer::setCurrentFrame(frameId);
+			uint64_t sendStart = LatencyHistogram::now();
 			FramedSource::afterGetting(this);			
+			m_metrics.latency(SourceMetrics::SEND, LatencyHistogram::now() - sendStart);
 		}
 	}
 }
@@ -184,83 +238,343 @@ void V4L2DeviceSource::deliverFrame()
 // FrameSource callback on read event
 void V4L2DeviceSource::incomingPacketHandler()
 {
-	if (this->getNextFrame() <= 0)
+	if (this->getNextFrame() == READ_ERROR)
 	{
 		handleClosure(this);
 	}
 }
 
 // read from device
-int V4L2DeviceSource::getNextFrame() 
+V4L2DeviceSource::ReadStatus V4L2DeviceSource::getNextFrame() 
 {
 	timeval ref;
 	gettimeofday(&ref, NULL);											
-	char buffer[m_device->getBufferSize()];	
-	int frameSize = m_device->read(buffer,  m_device->getBufferSize());	
-	if (frameSize < 0)
+	uint64_t frameId = ++m_frameId;
+	int frameSize = 0;
+	char* buffer = NULL;
+	bool skipped = false;
+	CaptureBuffer* captureBuffer = NULL;
+
+	TRACE_BEGIN("read", frameId);
+	if (m_device->getBufferCount() > 0)
+	{
+		// zero-copy : keep the driver buffer while its frames are in flight
+		captureBuffer = m_device->dequeue();
+		if (captureBuffer != NULL)
+		{
+			if (m_device->getBuffersInFlight() >= m_device->getBufferCount())
+			{
+				// nothing left to the driver, give back the buffer of an access unit
+				m_metrics.starved();
+				pthread_mutex_lock (&m_mutex);
+				while ( (m_device->getBuffersInFlight() >= m_device->getBufferCount()) && this->dropAccessUnit() )
+				{
+					ALOG(DEBUG) << "Driver starved drop access unit size:"  << (int)m_captureQueue.size() ;
+				}
+				if (m_device->getBuffersInFlight() >= m_device->getBufferCount())
+				{
+					this->releaseCaptureBuffer();
+				}
+				pthread_mutex_unlock (&m_mutex);
+			}
+			buffer = captureBuffer->m_data;
+			frameSize = captureBuffer->m_size;
+			if ( (m_lastSequence != 0) && (captureBuffer->m_sequence > m_lastSequence + 1) )
+			{
+				m_metrics.driverDropped(captureBuffer->m_sequence - m_lastSequence - 1);
+			}
+			m_lastSequence = captureBuffer->m_sequence;
+			m_metrics.buffersInFlight(m_device->getBuffersInFlight());
+		}
+		else if (errno == EAGAIN)
+		{
+			// nothing to read or a buffer in error given back to the driver
+			skipped = true;
+		}
+		else
+		{
+			frameSize = -1;
+		}
+	}
+	else
+	{
+		if (m_readBuffer.size() < m_device->getBufferSize())
+		{
+			m_readBuffer.resize(m_device->getBufferSize());
+		}
+		buffer = &m_readBuffer[0];
+		frameSize = m_device->read(buffer, m_readBuffer.size());
+		if (frameSize > 0)
+		{
+			CopyMetrics::copied(CopyMetrics::CAPTURE, frameSize);
+		}
+	}
+	TRACE_END("read", frameId);
+
+	if (skipped)
 	{
-		LOG(NOTICE) << "V4L2DeviceSource::getNextFrame errno:" << errno << " "  << strerror(errno);		
+		ALOG(DEBUG) << "V4L2DeviceSource::getNextFrame skipped";
+	}
+	else if (frameSize < 0)
+	{
+		ALOG(NOTICE) << "V4L2DeviceSource::getNextFrame errno:" << errno << " "  << strerror(errno);		
 	}
 	else if (frameSize == 0)
 	{
-		LOG(NOTICE) << "V4L2DeviceSource::getNextFrame no data errno:" << errno << " "  << strerror(errno);		
+		ALOG(NOTICE) << "V4L2DeviceSource::getNextFrame no data errno:" << errno << " "  << strerror(errno);		
 	}
-	else
+	else if (buffer != NULL)
 	{
-		timeval tv;
-		gettimeofday(&tv, NULL);												
-		timeval diff;
-		timersub(&tv,&ref,&diff);
-		m_in.notify(tv.tv_sec, frameSize);
-		LOG(DEBUG) << "getNextFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << frameSize <<"\tdiff:" <<  (diff.tv_sec*1000+diff.tv_usec/1000) << "ms";
-		processFrame(buffer,frameSize,ref);
+		m_metrics.captured(frameSize);
+		ALOG(DEBUG) << "getNextFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << frameSize <<"\tdiff:" << elapsedMs(ref) << "ms";
+		TRACE_BEGIN("process", frameId);
+		processFrame(buffer,frameSize,ref,captureBuffer);
+		TRACE_END("process", frameId);
 		if (m_outfd != -1) 
 		{
 			write(m_outfd, buffer, frameSize);
 		}		
 	}			
-	return frameSize;
+	if (captureBuffer != NULL)
+	{
+		// the frames queued hold their own reference
+		captureBuffer->release();
+	}
+	if (skipped)
+	{
+		return READ_SKIPPED;
+	}
+	return (frameSize > 0) ? READ_FRAME : READ_ERROR;
 }	
 
-		
-void V4L2DeviceSource::processFrame(char * frame, int frameSize, const timeval &ref) 
+// give back a driver buffer when dropping access units didn't, called with the mutex locked
+//  the oldest frames pointing in a driver buffer are dropped whatever their access unit, so the next pictures wait for a keyframe
+void V4L2DeviceSource::releaseCaptureBuffer() 
 {
-	timeval tv;
-	gettimeofday(&tv, NULL);												
-	timeval diff;
-	timersub(&tv,&ref,&diff);
+	std::list<Frame*>::iterator it = m_captureQueue.begin();
+	while ( (m_device->getBuffersInFlight() >= m_device->getBufferCount()) && (it != m_captureQueue.end()) )
+	{
+		if ( ((*it)->m_captureBuffer != NULL) && ((*it)->m_id != m_deliveringId) )
+		{
+			ALOG(DEBUG) << "Driver starved drop frame id:" << (*it)->m_id << " size:" << (int)m_captureQueue.size();
+			delete *it;
+			it = m_captureQueue.erase(it);
+			m_metrics.dropped();
+			m_dropUntilKeyframe = m_hasKeyframes;
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
 		
+void V4L2DeviceSource::processFrame(char * frame, int frameSize, const timeval &ref, CaptureBuffer* captureBuffer) 
+{
 	std::list< std::pair<unsigned char*,size_t> > frameList = this->splitFrames((unsigned char*)frame, frameSize);
 	while (!frameList.empty())
 	{
 		std::pair<unsigned char*,size_t>& frame = frameList.front();
 		size_t size = frame.second;
-		char* buf = new char[size];
-		memcpy(buf, frame.first, size);
-		queueFrame(buf,size,ref);
+		int flags = this->getFrameFlags(frame.first, size);
+		bool inCaptureBuffer = (captureBuffer != NULL) 
+				&& (frame.first >= (unsigned char*)captureBuffer->m_data) && (frame.first + size <= (unsigned char*)captureBuffer->m_data + captureBuffer->m_size);
+		if ( inCaptureBuffer && !(flags & Frame::CONFIG) )
+		{
+			// point in the driver buffer, parameter sets are copied so they never pin it
+			queueFrame((char*)frame.first,size,ref,flags,captureBuffer);
+		}
+		else
+		{
+			char* buf = new char[size];
+			memcpy(buf, frame.first, size);
+			CopyMetrics::allocated(CopyMetrics::SPLIT, size);
+			CopyMetrics::copied(CopyMetrics::SPLIT, size);
+			queueFrame(buf,size,ref,flags,NULL);
+		}
 
-		LOG(DEBUG) << "queueFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << size <<"\tdiff:" <<  (diff.tv_sec*1000+diff.tv_usec/1000) << "ms";		
+		ALOG(DEBUG) << "queueFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << size <<"\tdiff:" << elapsedMs(ref) << "ms";		
 		frameList.pop_front();
 	}			
 }	
 
 // post a frame to fifo
-void V4L2DeviceSource::queueFrame(char * frame, int frameSize, const timeval &tv) 
+void V4L2DeviceSource::queueFrame(char * frame, int frameSize, const timeval &tv, int flags, CaptureBuffer* captureBuffer) 
 {
 	pthread_mutex_lock (&m_mutex);
-	while (m_captureQueue.size() >= m_queueSize)
+	if (flags & Frame::KEYFRAME)
 	{
-		LOG(DEBUG) << "Queue full size drop frame size:"  << (int)m_captureQueue.size() ;		
-		delete m_captureQueue.front();
-		m_captureQueue.pop_front();
+		m_hasKeyframes = true;
+		m_dropUntilKeyframe = false;
+	}
+	if ( m_dropUntilKeyframe && !(flags & Frame::CONFIG) )
+	{
+		// the pictures it refers to were dropped, wait for the next keyframe
+		if (captureBuffer == NULL)
+		{
+			delete [] frame;
+		}
+		m_metrics.dropped();
+		pthread_mutex_unlock (&m_mutex);
+		return;
+	}
+	while ( (m_captureQueue.size() >= m_queueSize) && this->dropAccessUnit() )
+	{
+		ALOG(DEBUG) << "Queue full size drop access unit size:"  << (int)m_captureQueue.size() ;		
 	}
-	m_captureQueue.push_back(new Frame(frame, frameSize, tv));	
+	m_captureQueue.push_back(new Frame(frame, frameSize, tv, m_frameId, flags, captureBuffer));	
+	CopyMetrics::allocated(CopyMetrics::CAPTURE, sizeof(Frame));
+	CopyMetrics::allocated(CopyMetrics::CAPTURE, sizeof(Frame*) + 2*sizeof(void*)); // list node
+	m_metrics.queueDepth(m_captureQueue.size());
 	pthread_mutex_unlock (&m_mutex);
 	
 	// post an event to ask to deliver the frame
 	envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
 }	
 
+// drop access units of the fifo, called with the mutex locked
+//  prefer a non-reference picture, then a picture that precede a keyframe, then the rest of the oldest GOP up to the next keyframe
+//  keyframes are dropped last, with the pictures that refer to them, so an intra-only stream stays bounded too
+//  never drop parameter sets that are still needed or the access unit being delivered
+//  when no keyframe ends the dropped GOP, its next pictures are dropped as they are captured
+//  the pictures of a source without keyframes (MJPEG, raw) are independent, the oldest one is dropped
+bool V4L2DeviceSource::dropAccessUnit() 
+{
+	struct AccessUnit
+	{
+		uint64_t m_id;
+		int      m_flags;
+		bool     m_nonReference;
+		bool     m_hasPicture;
+	};
+	std::vector<AccessUnit> units;
+	std::list<Frame*>::iterator it;
+	for (it = m_captureQueue.begin(); it != m_captureQueue.end(); ++it)
+	{
+		if ( units.empty() || (units.back().m_id != (*it)->m_id) )
+		{
+			AccessUnit unit = { (*it)->m_id, 0, true, false };
+			units.push_back(unit);
+		}
+		AccessUnit & unit = units.back();
+		unit.m_flags |= (*it)->m_flags;
+		if (!((*it)->m_flags & Frame::CONFIG))
+		{
+			unit.m_hasPicture = true;
+			unit.m_nonReference &= (((*it)->m_flags & Frame::NON_REFERENCE) != 0);
+		}
+	}
+
+	size_t none = units.size();
+	size_t nonReference = none;
+	size_t beforeKeyframe = none;
+	size_t oldest = none;
+	size_t oldestKeyframe = none;
+	for (size_t i = 0; i < units.size(); ++i)
+	{
+		const AccessUnit & unit = units[i];
+		if ( (unit.m_id == m_deliveringId) || !unit.m_hasPicture )
+		{
+			continue;
+		}
+		if (unit.m_flags & Frame::KEYFRAME)
+		{
+			if ( (unit.m_id != m_frameId) && (oldestKeyframe == none) )
+			{
+				oldestKeyframe = i;
+			}
+			continue;
+		}
+		if (oldest == none)
+		{
+			oldest = i;
+		}
+		if (unit.m_id == m_frameId)
+		{
+			continue;
+		}
+		if ( (unit.m_nonReference || !m_hasKeyframes) && (nonReference == none) )
+		{
+			nonReference = i;
+		}
+		if ( (i + 1 < units.size()) && (units[i+1].m_flags & Frame::KEYFRAME) && (beforeKeyframe == none) )
+		{
+			beforeKeyframe = i;
+		}
+	}
+
+	// range of access units to drop
+	size_t first = none;
+	size_t last = none;
+	if (nonReference != none)
+	{
+		first = last = nonReference;
+	}
+	else if (beforeKeyframe != none)
+	{
+		first = last = beforeKeyframe;
+	}
+	else if ( (oldest != none) && m_hasKeyframes )
+	{
+		first = last = oldest;
+		while ( (last + 1 < units.size()) && !(units[last+1].m_flags & Frame::KEYFRAME) )
+		{
+			last++;
+		}
+		if (last + 1 == units.size())
+		{
+			m_dropUntilKeyframe = true;
+		}
+	}
+	else if (oldestKeyframe != none)
+	{
+		// nothing else left to drop, the oldest GOP goes with its keyframe
+		first = last = oldestKeyframe;
+		while ( (last + 1 < units.size()) && !(units[last+1].m_flags & Frame::KEYFRAME) )
+		{
+			last++;
+		}
+		if (last + 1 == units.size())
+		{
+			m_dropUntilKeyframe = true;
+		}
+	}
+	if (first == none)
+	{
+		return false;
+	}
+
+	// parameter sets are dropped only when a following keyframe repeats them
+	bool keepConfig = true;
+	for (size_t i = last + 1; i < units.size(); ++i)
+	{
+		if ( (units[i].m_flags & Frame::KEYFRAME) && (units[i].m_flags & Frame::CONFIG) )
+		{
+			keepConfig = false;
+		}
+	}
+
+	bool dropped = false;
+	it = m_captureQueue.begin();
+	while (it != m_captureQueue.end())
+	{
+		uint64_t id = (*it)->m_id;
+		if ( (id >= units[first].m_id) && (id <= units[last].m_id) && (id != m_deliveringId) && !(keepConfig && ((*it)->m_flags & Frame::CONFIG)) )
+		{
+			delete *it;
+			it = m_captureQueue.erase(it);
+			m_metrics.dropped();
+			dropped = true;
+		}
+		else
+		{
+			++it;
+		}
+	}
+	return dropped;
+}
+
 // split packet in frames					
 std::list< std::pair<unsigned char*,size_t> > V4L2DeviceSource::splitFrames(unsigned char* frame, unsigned frameSize) 
 {				
@@ -0,0 +1,194 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FileCache.cpp
+**
+** Cache of the static files served by the HTTP server
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+
+#include <sstream>
+#include <fstream>
+
+#include "logger.h"
+#include "FileCache.h"
+
+// true if the encoding is in the Accept-Encoding list and not refused with q=0
+static bool accepts(const char* acceptEncoding, const char* encoding)
+{
+	std::istringstream is(acceptEncoding);
+	std::string token;
+	while (std::getline(is, token, ',')) {
+		size_t start = token.find_first_not_of(" \t");
+		if (start == std::string::npos) {
+			continue;
+		}
+		size_t end = token.find_first_of("; \t", start);
+		std::string name(token.substr(start, (end == std::string::npos) ? std::string::npos : end - start));
+		if (strcasecmp(name.c_str(), encoding) == 0) {
+			size_t q = token.find("q=");
+			return (q == std::string::npos) || (atof(token.c_str() + q + 2) > 0);
+		}
+	}
+	return false;
+}
+
+const FileCache::Variant & FileCache::Entry::select(const char* acceptEncoding) const
+{
+	if (acceptEncoding != NULL) {
+		for (size_t i = 0; i+1 < m_variants.size(); ++i) {
+			if (accepts(acceptEncoding, m_variants[i].m_encoding.c_str())) {
+				return m_variants[i];
+			}
+		}
+	}
+	return m_variants.back();
+}
+
+FileCache::FileCache(size_t maxFileSize, size_t maxBytes) : m_maxFileSize(maxFileSize), m_maxBytes(maxBytes), m_bytes(0)
+{
+}
+
+// the precompressed variants not older than the file, the preferred first, then the file itself
+void FileCache::variants(const std::string & path, const struct stat & st, std::vector<Variant> & variants)
+{
+	const char* encodings[][2] = { {"br", ".br"}, {"gzip", ".gz"} };
+	for (size_t i = 0; i < sizeof(encodings)/sizeof(encodings[0]); ++i) {
+		struct stat compressed;
+		Variant variant;
+		variant.m_path = path + encodings[i][1];
+		if ( (stat(variant.m_path.c_str(), &compressed) == 0) && S_ISREG(compressed.st_mode) && (compressed.st_mtime >= st.st_mtime) ) {
+			variant.m_encoding = encodings[i][0];
+			variant.m_mtime = compressed.st_mtime;
+			variant.m_size = compressed.st_size;
+			variants.push_back(variant);
+		}
+	}
+	Variant identity;
+	identity.m_path = path;
+	identity.m_mtime = st.st_mtime;
+	identity.m_size = st.st_size;
+	variants.push_back(identity);
+}
+
+FileCache::Handle FileCache::get(const std::string & path)
+{
+	struct stat st;
+	if ( (stat(path.c_str(), &st) != 0) || !S_ISREG(st.st_mode) ) {
+		return Handle();
+	}
+	std::vector<Variant> found;
+	variants(path, st, found);
+
+	std::map<std::string, Handle>::iterator it = m_entries.find(path);
+	if (it != m_entries.end()) {
+		const std::vector<Variant> & cached = it->second->m_variants;
+		bool unchanged = (cached.size() == found.size());
+		for (size_t i = 0; unchanged && (i < found.size()); ++i) {
+			unchanged = (cached[i].m_encoding == found[i].m_encoding) && (cached[i].m_mtime == found[i].m_mtime) && (cached[i].m_size == found[i].m_size);
+		}
+		if (unchanged) {
+			return it->second;
+		}
+		// the file or a variant changed, the connections sending the old content keep it
+		for (size_t i = 0; i < cached.size(); ++i) {
+			if (cached[i].m_content) {
+				m_bytes -= cached[i].m_content->size();
+			}
+		}
+		m_entries.erase(it);
+	}
+
+	std::shared_ptr<Entry> entry(new Entry());
+	entry->m_variants.swap(found);
+	for (size_t i = 0; i < entry->m_variants.size(); ++i) {
+		Variant & variant = entry->m_variants[i];
+		std::ostringstream etag;
+		etag << "\"" << std::hex << variant.m_mtime << "-" << variant.m_size;
+		if (!variant.m_encoding.empty()) {
+			etag << "-" << variant.m_encoding;
+		}
+		etag << "\"";
+		variant.m_etag = etag.str();
+
+		std::ostringstream headers;
+		headers << "Content-Type: " << mimeType(path) << "\r\n"
+			<< "Content-Length: " << variant.m_size << "\r\n"
+			<< "ETag: " << variant.m_etag << "\r\n"
+			<< "Cache-Control: no-cache\r\n";
+		if (!variant.m_encoding.empty()) {
+			headers << "Content-Encoding: " << variant.m_encoding << "\r\n";
+		}
+		if (entry->m_variants.size() > 1) {
+			headers << "Vary: Accept-Encoding\r\n";
+		}
+		variant.m_headers = headers.str();
+
+		this->load(variant);
+	}
+
+	LOG(INFO) << "cache file:" << path << " size:" << st.st_size << " variants:" << entry->m_variants.size() << " cached bytes:" << m_bytes;
+	m_entries[path] = entry;
+	return entry;
+}
+
+// read the content if it fits in the cache
+bool FileCache::load(Variant & variant)
+{
+	if ( ((size_t)variant.m_size > m_maxFileSize) || (m_bytes + variant.m_size > m_maxBytes) ) {
+		return false;
+	}
+	std::ifstream file(variant.m_path.c_str(), std::ios::binary);
+	std::string* content = new std::string(variant.m_size, '\0');
+	if ( !file.read(&(*content)[0], variant.m_size) ) {
+		LOG(NOTICE) << "cannot read file:" << variant.m_path;
+		delete content;
+		return false;
+	}
+	variant.m_content.reset(content);
+	m_bytes += content->size();
+	return true;
+}
+
+const char* FileCache::mimeType(const std::string & path)
+{
+	static const char* types[][2] = {
+		{ "html", "text/html; charset=utf-8" },
+		{ "htm",  "text/html; charset=utf-8" },
+		{ "js",   "application/javascript" },
+		{ "mjs",  "application/javascript" },
+		{ "css",  "text/css" },
+		{ "json", "application/json" },
+		{ "map",  "application/json" },
+		{ "txt",  "text/plain; charset=utf-8" },
+		{ "xml",  "application/xml" },
+		{ "svg",  "image/svg+xml" },
+		{ "png",  "image/png" },
+		{ "jpg",  "image/jpeg" },
+		{ "jpeg", "image/jpeg" },
+		{ "gif",  "image/gif" },
+		{ "ico",  "image/x-icon" },
+		{ "wasm", "application/wasm" },
+		{ "m3u8", "application/vnd.apple.mpegurl" },
+		{ "mpd",  "application/dash+xml" },
+		{ "mp4",  "video/mp4" },
+		{ "ts",   "video/mp2t" },
+	};
+	size_t pos = path.find_last_of("./");
+	if ( (pos != std::string::npos) && (path[pos] == '.') ) {
+		const char* ext = path.c_str() + pos + 1;
+		for (size_t i = 0; i < sizeof(types)/sizeof(types[0]); ++i) {
+			if (strcasecmp(ext, types[i][0]) == 0) {
+				return types[i][1];
+			}
+		}
+	}
+	return "application/octet-stream";
+}
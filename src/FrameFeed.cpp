@@ -0,0 +1,196 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameFeed.cpp
+**
+** Implement a live555 Sink that share the last frame with the HTTP viewers
+**
+** -------------------------------------------------------------------------*/
+
+#include <algorithm>
+
+#include "logger.h"
+#include "FrameFeed.h"
+#include "ServerMediaSubsession.h"
+#include "Metrics.h"
+#include "DepthCodec.h"
+
+// room kept before the scan data of an MJPEG device for its header
+#define JPEG_HEADROOM 4096
+
+FrameFeed::FrameFeed(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format)
+	: MediaSink(env), m_replicator(replicator), m_jpegSource(dynamic_cast<MJPEG_V4L2DeviceSource*>(replicator->inputSource())), m_replica(NULL), m_format(format), m_frameId(0), m_stopTask(NULL), m_deltaId(0)
+{
+}
+
+FrameFeed::~FrameFeed()
+{
+	envir().taskScheduler().unscheduleDelayedTask(m_stopTask);
+	this->stop();
+}
+
+void FrameFeed::addListener(AfterFrameFunc* func, void* clientData)
+{
+	m_listeners.push_back(std::make_pair(func, clientData));
+	envir().taskScheduler().unscheduleDelayedTask(m_stopTask);
+	if (m_replica == NULL)
+	{
+		this->start();
+	}
+}
+
+void FrameFeed::removeListener(void* clientData)
+{
+	for (std::list<std::pair<AfterFrameFunc*,void*> >::iterator it = m_listeners.begin(); it != m_listeners.end(); )
+	{
+		if (it->second == clientData)
+		{
+			it = m_listeners.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	if (m_listeners.empty() && (m_stopTask == NULL))
+	{
+		// the replica can't be closed while it delivers a frame
+		m_stopTask = envir().taskScheduler().scheduleDelayedTask(0, stopStub, this);
+	}
+}
+
+void FrameFeed::start()
+{
+	LOG(NOTICE) << "Start HTTP feed format:" << m_format;
+	m_replica = m_replicator->createStreamReplica();
+	this->startPlaying(*m_replica, NULL, NULL);
+}
+
+// the replicator stops the capture source when its last replica is closed
+void FrameFeed::stop()
+{
+	if (m_replica != NULL)
+	{
+		LOG(NOTICE) << "Stop HTTP feed format:" << m_format;
+		this->stopPlaying();
+		Medium::close(m_replica);
+		m_replica = NULL;
+		m_latest.reset();
+		m_delta.reset();
+	}
+}
+
+std::shared_ptr<const std::string> FrameFeed::delta(const Handle & frame)
+{
+	if ( (m_delta == NULL) || (m_deltaId != frame->m_id) )
+	{
+		std::string* content = new std::string();
+		DepthCodec::encodeDelta(frame->data(), frame->m_size, *content);
+		m_delta.reset(content);
+		m_deltaId = frame->m_id;
+	}
+	return m_delta;
+}
+
+// read in a frame that no viewer holds anymore
+Boolean FrameFeed::continuePlaying()
+{
+	if (fSource == NULL)
+	{
+		return False;
+	}
+	m_reading.reset();
+	for (size_t i = 0; i < m_frames.size(); ++i)
+	{
+		if (m_frames[i].use_count() == 1)
+		{
+			m_reading = m_frames[i];
+			break;
+		}
+	}
+	unsigned int headroom = m_jpegSource ? JPEG_HEADROOM : 0;
+	if (!m_reading)
+	{
+		m_reading.reset(new Frame());
+		m_reading->m_buffer.resize(headroom + OutPacketBuffer::maxSize);
+		CopyMetrics::allocated(CopyMetrics::FEED, m_reading->m_buffer.size());
+		m_frames.push_back(m_reading);
+	}
+	fSource->getNextFrame((unsigned char*)&m_reading->m_buffer[headroom], m_reading->m_buffer.size() - headroom,
+			afterGettingFrame, this,
+			onSourceClosure, this);
+	return True;
+}
+
+void FrameFeed::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime)
+{
+	if (numTruncatedBytes > 0)
+	{
+		LOG(NOTICE) << "HTTP feed drop frame size:" << frameSize << " truncated:" << numTruncatedBytes;
+	}
+	else if ( (m_jpegSource != NULL) && !this->addJPEGHeader(frameSize, presentationTime) )
+	{
+		LOG(NOTICE) << "HTTP feed drop frame without JPEG header size:" << frameSize;
+	}
+	else
+	{
+		if (m_jpegSource == NULL)
+		{
+			m_reading->m_offset = 0;
+			m_reading->m_size = frameSize;
+		}
+		m_reading->m_timestamp = presentationTime;
+		m_reading->m_id = ++m_frameId;
+		m_reading->m_width = 0;
+		m_reading->m_height = 0;
+		std::string auxLine;
+		BaseServerMediaSubsession::getSourceInfo(m_replicator->inputSource(), m_reading->m_width, m_reading->m_height, auxLine);
+		CopyMetrics::copied(CopyMetrics::FEED, frameSize);
+		m_latest = m_reading;
+		m_reading.reset();
+
+		// listeners remove themselves when their connection is closed, skip the ones removed meanwhile
+		std::list<std::pair<AfterFrameFunc*,void*> > listeners(m_listeners);
+		for (std::list<std::pair<AfterFrameFunc*,void*> >::iterator it = listeners.begin(); it != listeners.end(); ++it)
+		{
+			if (std::find(m_listeners.begin(), m_listeners.end(), *it) != m_listeners.end())
+			{
+				it->first(it->second);
+			}
+		}
+	}
+	continuePlaying();
+}
+
+// put the header of the scan data just read in front of it
+bool FrameFeed::addJPEGHeader(unsigned frameSize, const timeval & presentationTime)
+{
+	MJPEG_V4L2DeviceSource::Header header;
+	if (!m_jpegSource->getHeader(presentationTime, header))
+	{
+		return false;
+	}
+	const std::string & bytes = *header.m_bytes;
+	std::vector<char> & buffer = m_reading->m_buffer;
+	if (bytes.size() > JPEG_HEADROOM)
+	{
+		// bigger than the room kept, the scan data is moved
+		if (buffer.size() < bytes.size() + frameSize)
+		{
+			buffer.resize(bytes.size() + frameSize);
+		}
+		memmove(&buffer[bytes.size()], &buffer[JPEG_HEADROOM], frameSize);
+		CopyMetrics::copied(CopyMetrics::JPEG, frameSize);
+		m_reading->m_offset = 0;
+	}
+	else
+	{
+		m_reading->m_offset = JPEG_HEADROOM - bytes.size();
+	}
+	memcpy(&buffer[m_reading->m_offset], bytes.c_str(), bytes.size());
+	CopyMetrics::copied(CopyMetrics::JPEG, bytes.size());
+	m_reading->m_size = bytes.size() + frameSize;
+	return true;
+}
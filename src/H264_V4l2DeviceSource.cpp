@@ -17,6 +17,7 @@
 // project
 #include "logger.h"
 #include "H264_V4l2DeviceSource.h"
+#include "AnnexBScanner.h"
 
 // ---------------------------------
 // H264 V4L2 FramedSource
@@ -27,18 +28,16 @@
 std::list< std::pair<unsigned char*,size_t> > H264_V4L2DeviceSource::splitFrames(unsigned char* frame, unsigned frameSize) 
 {				
 	std::list< std::pair<unsigned char*,size_t> > frameList;
+	bool configChanged = false;
 	
-	size_t bufSize = frameSize;
-	size_t size = 0;
-	int frameType = 0;
-	unsigned char* buffer = this->extractFrame(frame, bufSize, size, frameType);
-	while (buffer != NULL)				
+	std::list<AnnexBScanner::Nal> nalList = AnnexBScanner::scan(frame, frameSize, m_keepMarker);
+	for (std::list<AnnexBScanner::Nal>::iterator it = nalList.begin(); it != nalList.end(); ++it)
 	{	
-		switch (frameType&0x1F)					
+		switch (it->m_header&0x1F)					
 		{
-			case 7: LOG(INFO) << "SPS size:" << size << " bufSize:" << bufSize; m_sps.assign((char*)buffer,size); break;
-			case 8: LOG(INFO) << "PPS size:" << size << " bufSize:" << bufSize; m_pps.assign((char*)buffer,size); break;
-			case 5: LOG(INFO) << "IDR size:" << size << " bufSize:" << bufSize; 
+			case 7: configChanged |= this->updateConfig(m_sps, *it, "SPS"); break;
+			case 8: configChanged |= this->updateConfig(m_pps, *it, "PPS"); break;
+			case 5: LOG(DEBUG) << "IDR size:" << it->m_size; 
 				if (m_repeatConfig && !m_sps.empty() && !m_pps.empty())
 				{
 					frameList.push_back(std::pair<unsigned char*,size_t>((unsigned char*)m_sps.c_str(), m_sps.size()));
@@ -48,26 +47,27 @@ std::list< std::pair<unsigned char*,size_t> > H264_V4L2DeviceSource::splitFrames
 			default: 
 				break;
 		}
+		frameList.push_back(std::pair<unsigned char*,size_t>(it->m_buffer, it->m_size));
+	}
 		
-		if (!m_sps.empty() && !m_pps.empty())
-		{
-			u_int32_t profile_level_id = 0;					
-			if (m_sps.size() >= 4) profile_level_id = (((unsigned char)m_sps[1])<<16)|(((unsigned char)m_sps[2])<<8)|((unsigned char)m_sps[3]); 
-		
-			char* sps_base64 = base64Encode(m_sps.c_str(), m_sps.size());
-			char* pps_base64 = base64Encode(m_pps.c_str(), m_pps.size());		
-
-			std::ostringstream os; 
-			os << "profile-level-id=" << std::hex << std::setw(6) << std::setfill('0') << profile_level_id;
-			os << ";sprop-parameter-sets=" << sps_base64 <<"," << pps_base64;
-			m_auxLine.assign(os.str());
-			
-			delete [] sps_base64;
-			delete [] pps_base64;
-		}
-		frameList.push_back(std::pair<unsigned char*,size_t>(buffer, size));
+	if (configChanged && !m_sps.empty() && !m_pps.empty())
+	{
+		std::string sps(this->withoutMarker(m_sps));
+		std::string pps(this->withoutMarker(m_pps));
+		u_int32_t profile_level_id = 0;					
+		if (sps.size() >= 4) profile_level_id = (((unsigned char)sps[1])<<16)|(((unsigned char)sps[2])<<8)|((unsigned char)sps[3]); 
+	
+		char* sps_base64 = base64Encode(sps.c_str(), sps.size());
+		char* pps_base64 = base64Encode(pps.c_str(), pps.size());		
+
+		std::ostringstream os; 
+		os << "profile-level-id=" << std::hex << std::setw(6) << std::setfill('0') << profile_level_id;
+		os << ";sprop-parameter-sets=" << sps_base64 <<"," << pps_base64;
+		m_auxLine.assign(os.str());
+		LOG(NOTICE) << "H264 parameter sets changed " << m_auxLine;
 		
-		buffer = this->extractFrame(&buffer[size], bufSize, size, frameType);
+		delete [] sps_base64;
+		delete [] pps_base64;
 	}
 	return frameList;
 }
@@ -76,20 +76,18 @@ std::list< std::pair<unsigned char*,size_t> > H264_V4L2DeviceSource::splitFrames
 std::list< std::pair<unsigned char*,size_t> > H265_V4L2DeviceSource::splitFrames(unsigned char* frame, unsigned frameSize) 
 {				
 	std::list< std::pair<unsigned char*,size_t> > frameList;
+	bool configChanged = false;
 	
-	size_t bufSize = frameSize;
-	size_t size = 0;
-	int frameType = 0;
-	unsigned char* buffer = this->extractFrame(frame, bufSize, size, frameType);
-	while (buffer != NULL)				
+	std::list<AnnexBScanner::Nal> nalList = AnnexBScanner::scan(frame, frameSize, m_keepMarker);
+	for (std::list<AnnexBScanner::Nal>::iterator it = nalList.begin(); it != nalList.end(); ++it)
 	{
-		switch ((frameType&0x7E)>>1)					
+		switch ((it->m_header&0x7E)>>1)					
 		{
-			case 32: LOG(INFO) << "VPS size:" << size << " bufSize:" << bufSize; m_vps.assign((char*)buffer,size); break;
-			case 33: LOG(INFO) << "SPS size:" << size << " bufSize:" << bufSize; m_sps.assign((char*)buffer,size); break;
-			case 34: LOG(INFO) << "PPS size:" << size << " bufSize:" << bufSize; m_pps.assign((char*)buffer,size); break;
+			case 32: configChanged |= this->updateConfig(m_vps, *it, "VPS"); break;
+			case 33: configChanged |= this->updateConfig(m_sps, *it, "SPS"); break;
+			case 34: configChanged |= this->updateConfig(m_pps, *it, "PPS"); break;
 			case 19: 
-			case 20: LOG(INFO) << "IDR size:" << size << " bufSize:" << bufSize; 
+			case 20: LOG(DEBUG) << "IDR size:" << it->m_size; 
 				if (m_repeatConfig && !m_vps.empty() && !m_sps.empty() && !m_pps.empty())
 				{
 					frameList.push_back(std::pair<unsigned char*,size_t>((unsigned char*)m_vps.c_str(), m_vps.size()));
@@ -99,66 +97,131 @@ std::list< std::pair<unsigned char*,size_t> > H265_V4L2DeviceSource::splitFrames
 			break;
 			default: break;
 		}
+		frameList.push_back(std::pair<unsigned char*,size_t>(it->m_buffer, it->m_size));
+	}
 		
-		if (!m_vps.empty() && !m_sps.empty() && !m_pps.empty())
-		{		
-			char* vps_base64 = base64Encode(m_vps.c_str(), m_vps.size());
-			char* sps_base64 = base64Encode(m_sps.c_str(), m_sps.size());
-			char* pps_base64 = base64Encode(m_pps.c_str(), m_pps.size());		
-
-			std::ostringstream os; 
-			os << "sprop-vps=" << vps_base64;
-			os << ";sprop-sps=" << sps_base64;
-			os << ";sprop-pps=" << pps_base64;
-			m_auxLine.assign(os.str());
-			
-			delete [] vps_base64;
-			delete [] sps_base64;
-			delete [] pps_base64;
-		}
-		frameList.push_back(std::pair<unsigned char*,size_t>(buffer, size));
+	if (configChanged && !m_vps.empty() && !m_sps.empty() && !m_pps.empty())
+	{		
+		std::string vps(this->withoutMarker(m_vps));
+		std::string sps(this->withoutMarker(m_sps));
+		std::string pps(this->withoutMarker(m_pps));
+		char* vps_base64 = base64Encode(vps.c_str(), vps.size());
+		char* sps_base64 = base64Encode(sps.c_str(), sps.size());
+		char* pps_base64 = base64Encode(pps.c_str(), pps.size());		
+
+		std::ostringstream os; 
+		os << "sprop-vps=" << vps_base64;
+		os << ";sprop-sps=" << sps_base64;
+		os << ";sprop-pps=" << pps_base64;
+		m_auxLine.assign(os.str());
+		LOG(NOTICE) << "H265 parameter sets changed " << m_auxLine;
 		
-		buffer = this->extractFrame(&buffer[size], bufSize, size, frameType);
+		delete [] vps_base64;
+		delete [] sps_base64;
+		delete [] pps_base64;
 	}
 	return frameList;
 }
 
+// flags used by the fifo to drop whole access units
+int H264_V4L2DeviceSource::getFrameFlags(unsigned char* frame, size_t frameSize)
+{
+	int flags = 0;
+	int header = this->nalHeader(frame, frameSize);
+	switch (header&0x1F)
+	{
+		case 5: flags = Frame::KEYFRAME; break;
+		case 7: 
+		case 8: flags = Frame::CONFIG; break;
+		default: 
+			// nal_ref_idc
+			if ((header&0x60) == 0) flags = Frame::NON_REFERENCE;
+		break;
+	}
+	return flags;
+}
+
+int H265_V4L2DeviceSource::getFrameFlags(unsigned char* frame, size_t frameSize)
+{
+	int flags = 0;
+	int type = (this->nalHeader(frame, frameSize)&0x7E)>>1;
+	if ( (type >= 16) && (type <= 23) ) {
+		// IRAP
+		flags = Frame::KEYFRAME;
+	} else if ( (type >= 32) && (type <= 34) ) {
+		flags = Frame::CONFIG;
+	} else if ( (type <= 14) && ((type%2) == 0) ) {
+		// sub-layer non-reference picture
+		flags = Frame::NON_REFERENCE;
+	}
+	return flags;
+}
+
+// first byte of the NAL header
+int H26X_V4L2DeviceSource::nalHeader(unsigned char* frame, size_t frameSize)
+{
+	int header = -1;
+	if (m_keepMarker) 
+	{
+		const unsigned char* startCode = AnnexBScanner::findStartCode(frame, frame+frameSize);
+		if ( (startCode != NULL) && (startCode+3 < frame+frameSize) )
+		{
+			header = startCode[3];
+		}
+	}
+	else if (frameSize > 0)
+	{
+		header = frame[0];
+	}
+	return header;
+}
+
+// store a parameter set, return true if it changed
+bool H26X_V4L2DeviceSource::updateConfig(std::string & config, const AnnexBScanner::Nal & nal, const char* name)
+{
+	bool changed = false;
+	if ( (config.size() != nal.m_size) || (memcmp(config.c_str(), nal.m_buffer, nal.m_size) != 0) )
+	{
+		LOG(INFO) << name << " size:" << nal.m_size;
+		config.assign((char*)nal.m_buffer, nal.m_size);
+		changed = true;
+	}
+	return changed;
+}
+
+// parameter set without its Annex-B marker
+std::string H26X_V4L2DeviceSource::withoutMarker(const std::string & config)
+{
+	const unsigned char* buffer = (const unsigned char*)config.c_str();
+	const unsigned char* startCode = m_keepMarker ? AnnexBScanner::findStartCode(buffer, buffer + config.size()) : NULL;
+	if (startCode != NULL)
+	{
+		return config.substr(startCode + 3 - buffer);
+	}
+	return config;
+}
+
 // extract a frame
 unsigned char*  H26X_V4L2DeviceSource::extractFrame(unsigned char* frame, size_t& size, size_t& outsize, int& frameType)
 {						
 	unsigned char * outFrame = NULL;
 	outsize = 0;
-	unsigned int markerlength = 0;
 	frameType = 0;
 	
-	unsigned char *startFrame = (unsigned char*)memmem(frame,size,H264marker,sizeof(H264marker));
-	if (startFrame != NULL) {
-		markerlength = sizeof(H264marker);
-	} else {
-		startFrame = (unsigned char*)memmem(frame,size,H264shortmarker,sizeof(H264shortmarker));
-		if (startFrame != NULL) {
-			markerlength = sizeof(H264shortmarker);
-		}
-	}
-	if (startFrame != NULL) {
-		frameType = startFrame[markerlength];
+	const unsigned char *startCode = AnnexBScanner::findStartCode(frame, frame+size);
+	if ( (startCode != NULL) && (startCode+3 < frame+size) ) {
+		unsigned char *startFrame = (unsigned char*)( ( (startCode > frame) && (startCode[-1] == 0) ) ? startCode-1 : startCode );
+		unsigned char *payload = (unsigned char*)startCode+3;
+		frameType = *payload;
 		
-		int remainingSize = size-(startFrame-frame+markerlength);		
-		unsigned char *endFrame = (unsigned char*)memmem(&startFrame[markerlength], remainingSize, H264marker, sizeof(H264marker));
-		if (endFrame == NULL) {
-			endFrame = (unsigned char*)memmem(&startFrame[markerlength], remainingSize, H264shortmarker, sizeof(H264shortmarker));
+		const unsigned char *nextStartCode = AnnexBScanner::findStartCode(payload, frame+size);
+		unsigned char *endFrame = NULL;
+		if (nextStartCode != NULL) {
+			endFrame = (unsigned char*)( ( (nextStartCode > payload) && (nextStartCode[-1] == 0) ) ? nextStartCode-1 : nextStartCode );
 		}
 		
-		if (m_keepMarker)
-		{
-			size -=  startFrame-frame;
-			outFrame = startFrame;
-		}
-		else
-		{
-			size -=  startFrame-frame+markerlength;
-			outFrame = &startFrame[markerlength];
-		}
+		outFrame = m_keepMarker ? startFrame : payload;
+		size -= outFrame-frame;
 		
 		if (endFrame != NULL)
 		{
@@ -175,4 +238,3 @@ unsigned char*  H26X_V4L2DeviceSource::extractFrame(unsigned char* frame, size_t
 
 	return outFrame;
 }
-
@@ -12,8 +12,13 @@
 ** -------------------------------------------------------------------------*/
 
 
+#include <errno.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/socket.h>
+
 #include <sstream>
-#include <fstream>
+#include <iomanip>
 #include <algorithm>
 
 #include "RTSPServer.hh"
@@ -23,8 +28,62 @@
 #include "TCPStreamSink.hh"
 
 #include "HTTPServer.h"
+#include "SegmentServerMediaSubsession.h"
+#include "UnicastServerMediaSubsession.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "WebSocket.h"
+
+// seconds an idle HTTP connection is kept open
+#define HTTP_KEEPALIVE_TIMEOUT 30
+// seconds a snapshot waits for a frame when the capture is not running
+#define SNAPSHOT_TIMEOUT 5
+// separator of the frames of the multipart live stream
+#define FEED_BOUNDARY "frame"
+// biggest message accepted from a WebSocket viewer
+#define WEBSOCKET_MAX_MESSAGE 65536
 
-u_int32_t HTTPServer::HTTPClientConnection::fClientSessionId = 0;
+// value of a request header, empty if it is not present
+static std::string getHeader(const char* request, const char* name)
+{
+	std::string value;
+	size_t length = strlen(name);
+	for (const char* line = strstr(request, "\r\n"); line != NULL; line = strstr(line, "\r\n"))
+	{
+		line += 2;
+		if (strncmp(line, "\r\n", 2) == 0)
+		{
+			// end of the headers, a pipelined request could follow
+			break;
+		}
+		if ( (strncasecmp(line, name, length) == 0) && (line[length] == ':') )
+		{
+			const char* start = line + length + 1;
+			while ( (*start == ' ') || (*start == '\t') )
+			{
+				start++;
+			}
+			const char* end = strstr(start, "\r\n");
+			value.assign(start, (end != NULL) ? end-start : strlen(start));
+			break;
+		}
+	}
+	return value;
+}
+
+// HTTP/1.1 keeps the connection unless the client closes it, HTTP/1.0 only when it is asked
+static bool keepAlive(const char* request)
+{
+	std::string connection(getHeader(request, "Connection"));
+	std::transform(connection.begin(), connection.end(), connection.begin(), ::tolower);
+	if (connection.find("close") != std::string::npos)
+	{
+		return false;
+	}
+	const char* end = strstr(request, "\r\n");
+	bool http11 = (end != NULL) && (end - request >= 8) && (strncmp(end - 8, "HTTP/1.1", 8) == 0);
+	return http11 || (connection.find("keep-alive") != std::string::npos);
+}
 
 void HTTPServer::HTTPClientConnection::sendHeader(const char* contentType, unsigned int contentLength)
 {
@@ -34,11 +93,13 @@ void HTTPServer::HTTPClientConnection::sendHeader(const char* contentType, unsig
 	   "%s"
 	   "Server: LIVE555 Streaming Media v%s\r\n"
            "Access-Control-Allow-Origin: *\r\n" 
+	   "%s"
 	   "Content-Type: %s\r\n"
 	   "Content-Length: %d\r\n"
 	   "\r\n",
 	   dateHeader(),
 	   LIVEMEDIA_LIBRARY_VERSION_STRING,
+	   this->connectionHeader().c_str(),
 	   contentType,
 	   contentLength);
 
@@ -47,6 +108,60 @@ void HTTPServer::HTTPClientConnection::sendHeader(const char* contentType, unsig
 	  fResponseBuffer[0] = '\0'; // We've already sent the response.  This tells the calling code not to send it again.
 }
 		
+// status line and common headers before the prebuilt ones, the content is added to the sender
+void HTTPServer::HTTPClientConnection::startResponse(const std::string & headers)
+{
+	std::ostringstream os;
+	os << "HTTP/1.1 200 OK\r\n"
+	   << dateHeader()
+	   << "Server: LIVE555 Streaming Media v" << LIVEMEDIA_LIBRARY_VERSION_STRING << "\r\n"
+	   << "Access-Control-Allow-Origin: *\r\n"
+	   << this->connectionHeader()
+	   << headers
+	   << "\r\n";
+	std::shared_ptr<const std::string> header(new std::string(os.str()));
+	fResponseBuffer[0] = '\0';
+
+	// header and content in the same send
+	this->streamSource(NULL);
+	fSender = new BufferSender(envir(), fClientOutputSocket);
+	fSender->add(header, header->c_str(), header->size());
+}
+
+void HTTPServer::HTTPClientConnection::sendNotModified(const std::string & etag)
+{
+	snprintf((char*)fResponseBuffer, sizeof fResponseBuffer,
+	   "HTTP/1.1 304 Not Modified\r\n"
+	   "%s"
+	   "Server: LIVE555 Streaming Media v%s\r\n"
+	   "Access-Control-Allow-Origin: *\r\n"
+	   "%s"
+	   "ETag: %s\r\n"
+	   "\r\n",
+	   dateHeader(),
+	   LIVEMEDIA_LIBRARY_VERSION_STRING,
+	   this->connectionHeader().c_str(),
+	   etag.c_str());
+	send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+	fResponseBuffer[0] = '\0';
+	afterStreaming(this);
+}
+
+std::string HTTPServer::HTTPClientConnection::connectionHeader()
+{
+	std::ostringstream os;
+	if (fKeepAlive)
+	{
+		os << "Connection: keep-alive\r\n"
+		   << "Keep-Alive: timeout=" << HTTP_KEEPALIVE_TIMEOUT << "\r\n";
+	}
+	else
+	{
+		os << "Connection: close\r\n";
+	}
+	return os.str();
+}
+
 void HTTPServer::HTTPClientConnection::streamSource(const std::string & content)
 {
 	u_int8_t* buffer = new u_int8_t[content.size()];
@@ -67,6 +182,11 @@ void HTTPServer::HTTPClientConnection::streamSource(FramedSource* source)
 		Medium::close(fSource);
 		fSource = NULL;
       }
+      if (fSender != NULL) 
+      {
+		delete fSender;
+		fSender = NULL;
+      }
       if (source != NULL) 
       {
 		fTCPSink = TCPStreamSink::createNew(envir(), fClientOutputSocket);
@@ -75,6 +195,20 @@ void HTTPServer::HTTPClientConnection::streamSource(FramedSource* source)
       }
 }
 		
+void HTTPServer::HTTPClientConnection::streamSegment(const SegmentStore::Handle & segment, size_t offset, size_t size)
+{
+	this->streamSource(NULL);
+
+	// send the chunks written when the request arrived, they stay allocated while the segment handle is kept
+	std::vector<SegmentStore::Segment::Piece> pieces;
+	segment->pieces(pieces, offset, size);
+	fSender = new BufferSender(envir(), fClientOutputSocket);
+	for (std::vector<SegmentStore::Segment::Piece>::iterator it = pieces.begin(); it != pieces.end(); ++it) {
+		fSender->add(segment, it->m_data, it->m_size);
+	}
+	fSender->start(afterStreaming, this);
+}
+
 ServerMediaSubsession* HTTPServer::HTTPClientConnection::getSubsesion(const char* urlSuffix)
 {
 	ServerMediaSubsession* subsession = NULL;
@@ -87,97 +221,364 @@ ServerMediaSubsession* HTTPServer::HTTPClientConnection::getSubsesion(const char
 	return subsession;
 }
 		
-bool HTTPServer::HTTPClientConnection::sendM3u8PlayList(char const* urlSuffix)
+static double elapsed(const timeval & start, const timeval & end)
+{
+	return (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec)/1000000.0;
+}
+
+std::shared_ptr<const std::string> HTTPServer::HTTPClientConnection::buildM3u8PlayList(SegmentServerMediaSubsession* subsession, char const* urlSuffix)
 {
-	ServerMediaSubsession* subsession = this->getSubsesion(urlSuffix);
+	MemoryBufferSink* sink = subsession->getSink();
+	std::vector<SegmentStore::Handle> segments;
+	sink->getSegments(segments);
+	if (segments.size() < 2) 
+	{
+		return std::shared_ptr<const std::string>();
+	}
+	
+	// target duration is the longest segment, it could be longer than the slice when the GOP is long
+	unsigned targetDuration = sink->getSliceDuration();
+	bool independent = true;
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		if (segments[i]->complete())
+		{
+			targetDuration = std::max(targetDuration, (unsigned int)(segments[i]->duration() + 0.5));
+		}
+		independent &= !segments[i]->keyFrames().empty();
+	}
+	unsigned partDuration = sink->getPartDuration();
+	std::shared_ptr<const std::string> init = subsession->getInitSegment();
+	std::ostringstream os;
+	os  	<< "#EXTM3U\r\n";
+	if (init || (partDuration > 0))
+	{
+		// fragmented MP4 segments need EXT-X-MAP
+		os	<< "#EXT-X-VERSION:" << (init ? 7 : 6) << "\r\n";
+	}
+	if (partDuration > 0)
+	{
+		// LL-HLS
+		double partTarget = sink->getPartTarget()/1000.0;
+		os	<< "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" << 3*partTarget << "\r\n"
+			<< "#EXT-X-PART-INF:PART-TARGET=" << partTarget << "\r\n";
+	}
+	else
+	{
+		os	<< "#EXT-X-ALLOW-CACHE:NO\r\n";
+	}
+	if (independent)
+	{
+		// each segment starts with a keyframe
+		os	<< "#EXT-X-INDEPENDENT-SEGMENTS\r\n";
+	}
+	os	<< "#EXT-X-MEDIA-SEQUENCE:" << segments.front()->id() <<  "\r\n"
+		<< "#EXT-X-TARGETDURATION:" << targetDuration << "\r\n";
+	if (init)
+	{
+		os	<< "#EXT-X-MAP:URI=\"" << urlSuffix << "?init\"\r\n";
+	}
+
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const SegmentStore::Segment & segment = *segments[i];
+		if ( (partDuration > 0) && (i+3 >= segments.size()) )
+		{
+			// parts of the last segments
+			const std::vector<SegmentStore::Segment::Part> & parts = segment.parts();
+			for (size_t part = 0; part < parts.size(); ++part)
+			{
+				os << "#EXT-X-PART:DURATION=" << elapsed(parts[part].m_start, parts[part].m_end) << ",URI=\"" << urlSuffix << "?segment=" << segment.id() << "&part=" << part << "\"";
+				if (parts[part].m_independent)
+				{
+					os << ",INDEPENDENT=YES";
+				}
+				os << "\r\n";
+			}
+			if (!segment.complete())
+			{
+				os << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"" << urlSuffix << "?segment=" << segment.id() << "&part=" << parts.size() << "\"\r\n";
+			}
+		}
+		if (segment.complete())
+		{
+			os << "#EXTINF:" << segment.duration() << ",\r\n";
+			os << urlSuffix << "?segment=" << segment.id() << "\r\n";
+		}
+	}
+	
+	envir() << "build M3u8 playlist:" << urlSuffix <<"\n";
+	return std::shared_ptr<const std::string>(new std::string(os.str()));
+}
+
+// -----------------------------------------
+//    LL-HLS blocking requests
+// -----------------------------------------
+bool HTTPServer::HTTPClientConnection::waitPlayList(const std::string & streamName, int msn, int part)
+{
+	SegmentServerMediaSubsession* subsession = dynamic_cast<SegmentServerMediaSubsession*>(this->getSubsesion(streamName.c_str()));
 	if (subsession == NULL) 
 	{
 		return false;			  
 	}
+	fWaitSubsession = subsession;
+	fWaitSink = subsession->getSink();
+	fWaitStream = streamName;
+	fWaitPlayList = true;
+	fWaitMsn = msn;
+	fWaitPart = part;
+	this->startWait();
+	return true;
+}
+
+bool HTTPServer::HTTPClientConnection::waitPart(SegmentServerMediaSubsession* subsession, unsigned int id, int part)
+{
+	fWaitSubsession = subsession;
+	fWaitSink = subsession->getSink();
+	fWaitPlayList = false;
+	fWaitMsn = id;
+	fWaitPart = part;
+	this->startWait();
+	return true;
+}
 
-	float duration = subsession->duration();
-	if (duration <= 0.0) 
+// 1 if the waited playlist or part is available, 0 if it could be later, -1 if it never will
+int HTTPServer::HTTPClientConnection::waitStatus()
+{
+	SegmentStore::Handle segment = fWaitSink->getSegment(fWaitMsn);
+	std::vector<SegmentStore::Handle> segments;
+	fWaitSink->getSegments(segments);
+	if (segments.empty())
 	{
-		return false;			  
+		return 0;
 	}
-	
-	unsigned int startTime = subsession->getCurrentNPT(NULL);
-	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
-	unsigned sliceDuration = httpServer->m_hlsSegment;		  
-	std::ostringstream os;
-	os  	<< "#EXTM3U\r\n"
-		<< "#EXT-X-ALLOW-CACHE:NO\r\n"
-		<< "#EXT-X-MEDIA-SEQUENCE:" << startTime <<  "\r\n"
-		<< "#EXT-X-TARGETDURATION:" << sliceDuration << "\r\n";
+	unsigned int lastId = segments.back()->id();
+	if (fWaitPlayList)
+	{
+		if ( (unsigned int)fWaitMsn > lastId + 2 )
+		{
+			return -1;
+		}
+		if ( ((unsigned int)fWaitMsn < lastId) || (segments.front()->id() > (unsigned int)fWaitMsn) )
+		{
+			return 1;
+		}
+		if ( (segment != NULL) && ( segment->complete() || ((fWaitPart >= 0) && (segment->parts().size() > (size_t)fWaitPart)) ) )
+		{
+			return 1;
+		}
+		return 0;
+	}
+	if (segment == NULL)
+	{
+		// first part of the next segment
+		return ( ((unsigned int)fWaitMsn == lastId + 1) && (fWaitPart == 0) ) ? 0 : -1;
+	}
+	if (segment->parts().size() > (size_t)fWaitPart)
+	{
+		return 1;
+	}
+	return segment->complete() ? -1 : 0;
+}
 
-	for (unsigned int slice=0; slice*sliceDuration<duration; slice++)
+void HTTPServer::HTTPClientConnection::startWait()
+{
+	// the response is sent later
+	fResponseBuffer[0] = '\0';
+	if (this->waitStatus() != 0)
 	{
-		os << "#EXTINF:" << sliceDuration << ",\r\n";
-		os << urlSuffix << "?segment=" << (startTime+slice*sliceDuration) << "\r\n";
+		this->endWait();
 	}
-	
-	envir() << "send M3u8 playlist:" << urlSuffix <<"\n";
-	const std::string& playList(os.str());
+	else
+	{
+		fWaitSink->addPartListener(partCompleted, this);
+		int64_t timeout = 3*fWaitSink->getSliceDuration()*1000000LL;
+		fWaitTask = envir().taskScheduler().scheduleDelayedTask(timeout, waitTimeout, this);
+	}
+}
 
-	// send response header
-	this->sendHeader("application/vnd.apple.mpegurl", playList.size());
-	
-	// stream body
-	this->streamSource(playList);
+void HTTPServer::HTTPClientConnection::partCompleted(void* clientData)
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	if (clientConnection->waitStatus() != 0)
+	{
+		clientConnection->endWait();
+	}
+}
 
-	return true;			  
+void HTTPServer::HTTPClientConnection::waitTimeout(void* clientData)
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	clientConnection->fWaitTask = NULL;
+	clientConnection->endWait();
 }
-		
-bool HTTPServer::HTTPClientConnection::sendMpdPlayList(char const* urlSuffix)
+
+void HTTPServer::HTTPClientConnection::cancelWait()
 {
-	ServerMediaSubsession* subsession = this->getSubsesion(urlSuffix);
-	if (subsession == NULL) 
+	if (fWaitSink != NULL)
 	{
-		return false;			  
+		fWaitSink->removePartListener(this);
+		envir().taskScheduler().unscheduleDelayedTask(fWaitTask);
+		fWaitSink = NULL;
 	}
+}
 
-	float duration = subsession->duration();
-	if (duration <= 0.0) 
+// send the waited response, this can delete the connection
+void HTTPServer::HTTPClientConnection::endWait()
+{
+	MemoryBufferSink* sink = fWaitSink;
+	int status = this->waitStatus();
+	this->cancelWait();
+
+	bool ok = false;
+	if (fWaitPlayList)
 	{
-		return false;
+		// on timeout the current playlist is sent
+		ok = (status >= 0) && this->sendPlayList(fWaitStream, "m3u8", NULL);
+	}
+	else if (status > 0)
+	{
+		SegmentStore::Handle segment = sink->getSegment(fWaitMsn);
+		const SegmentStore::Segment::Part & part = segment->parts()[fWaitPart];
+		this->sendHeader(fWaitSubsession->getContentType(), part.m_size);
+		fSegment = true;
+		Metrics::instance().httpStreamStarted();
+		this->streamSegment(segment, part.m_offset, part.m_size);
+		ok = true;
+	}
+	if (!ok)
+	{
+		this->sendNotSupported();
+	}
+}
+
+// error response of a request answered later, this can delete the connection
+void HTTPServer::HTTPClientConnection::sendNotSupported()
+{
+	// the error response has no length, the connection is closed after it
+	fKeepAlive = false;
+	handleHTTPCmd_notSupported();
+	send(fClientOutputSocket, (char const*)fResponseBuffer, strlen((char*)fResponseBuffer), 0);
+	fResponseBuffer[0] = '\0';
+	afterStreaming(this);
+}
+
+std::shared_ptr<const std::string> HTTPServer::HTTPClientConnection::buildMpdPlayList(SegmentServerMediaSubsession* subsession, char const* urlSuffix)
+{
+	MemoryBufferSink* sink = subsession->getSink();
+	std::vector<SegmentStore::Handle> segments;
+	sink->getSegments(segments);
+	if (segments.size() < 2) 
+	{
+		return std::shared_ptr<const std::string>();
 	}
 	
-	unsigned int startTime = subsession->getCurrentNPT(NULL);
-	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
-	unsigned sliceDuration = httpServer->m_hlsSegment;		  
+	unsigned sliceDuration = sink->getSliceDuration();
+	const timeval & refTime = sink->getRefTime();
+	char availabilityStartTime[64];
+	struct tm tm;
+	time_t refSeconds = refTime.tv_sec;
+	strftime(availabilityStartTime, sizeof(availabilityStartTime), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&refSeconds, &tm));
+
+	// timeline of the complete segments in ms since the reference time
+	std::ostringstream timeline;
+	size_t bytes = 0;
+	double duration = 0;
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+		const SegmentStore::Segment & segment = *segments[i];
+		if (segment.complete())
+		{
+			timeline << "<S t='" << (unsigned long long)(elapsed(refTime, segment.start())*1000) << "' d='" << (unsigned long long)(segment.duration()*1000) << "'/>";
+			bytes += segment.size();
+			duration += segment.duration();
+		}
+	}
+	unsigned long long bandwidth = (duration > 0) ? bytes*8/duration : 0;
+	std::shared_ptr<const std::string> init = subsession->getInitSegment();
+
 	std::ostringstream os;
-	
 	os  << "<?xml version='1.0' encoding='UTF-8'?>\r\n"
-		<< "<MPD type='dynamic' xmlns='urn:mpeg:DASH:schema:MPD:2011' profiles='urn:mpeg:dash:profile:full:2011' minimumUpdatePeriod='PT"<< sliceDuration <<"S' minBufferTime='" << sliceDuration << "'>\r\n"
-		<< "<Period start='PT0S'><AdaptationSet segmentAlignment='true'><Representation mimeType='video/mp2t' codecs='' >\r\n";
+		<< "<MPD type='dynamic' xmlns='urn:mpeg:DASH:schema:MPD:2011' profiles='urn:mpeg:dash:profile:full:2011' availabilityStartTime='" << availabilityStartTime << "' minimumUpdatePeriod='PT"<< sliceDuration <<"S' minBufferTime='PT" << sliceDuration << "S'>\r\n"
+		<< "<Period id='0' start='PT0S'><AdaptationSet segmentAlignment='true' startWithSAP='1'><Representation id='0' mimeType='" << subsession->getContentType() << "' codecs='" << subsession->getCodecs() << "' bandwidth='" << bandwidth << "'>\r\n";
 
-	os << "<SegmentTemplate duration='" << sliceDuration << "' media='" << urlSuffix << "?segment=$Number$' startNumber='" << startTime << "' />\r\n";
+	os << "<SegmentTemplate timescale='1000' media='" << urlSuffix << "?segment=$Number$' startNumber='" << segments.front()->id() << "'";
+	if (init)
+	{
+		os << " initialization='" << urlSuffix << "?init'";
+	}
+	os << ">\r\n";
+	os << "<SegmentTimeline>" << timeline.str() << "</SegmentTimeline>\r\n";
+	os << "</SegmentTemplate>\r\n";
 	os << "</Representation></AdaptationSet></Period>\r\n";
 	os << "</MPD>\r\n";
 
-	envir() << "send MPEG-DASH playlist:" << urlSuffix <<"\n";
-	const std::string& playList(os.str());
+	envir() << "build MPEG-DASH playlist:" << urlSuffix <<"\n";
+	return std::shared_ptr<const std::string>(new std::string(os.str()));
+}
 
-	// send response header
-	this->sendHeader("application/dash+xml", playList.size());
-	
-	// stream body
-	this->streamSource(playList);
+// playlist built again only when the segments changed since the previous request
+bool HTTPServer::HTTPClientConnection::sendPlayList(const std::string & streamName, const std::string & ext, const char* fullRequestStr)
+{
+	SegmentServerMediaSubsession* subsession = dynamic_cast<SegmentServerMediaSubsession*>(this->getSubsesion(streamName.c_str()));
+	if (subsession == NULL) 
+	{
+		return false;			  
+	}
+	MemoryBufferSink* sink = subsession->getSink();
 
+	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+	HTTPServer::PlayList & playList = httpServer->m_playLists[streamName + "." + ext];
+	if ( (playList.m_sink != sink) || (playList.m_generation != sink->getGeneration()) || !playList.m_content )
+	{
+		const char* contentType = "application/vnd.apple.mpegurl";
+		if (ext == "mpd")
+		{
+			playList.m_content = this->buildMpdPlayList(subsession, streamName.c_str());
+			contentType = "application/dash+xml";
+		}
+		else
+		{
+			playList.m_content = this->buildM3u8PlayList(subsession, streamName.c_str());
+		}
+		if (!playList.m_content)
+		{
+			return false;
+		}
+		playList.m_sink = sink;
+		playList.m_generation = sink->getGeneration();
+
+		std::ostringstream etag;
+		etag << "\"" << std::hex << sink->getRefTime().tv_sec << "-" << playList.m_generation << "\"";
+		playList.m_etag = etag.str();
+		std::ostringstream headers;
+		headers << "Content-Type: " << contentType << "\r\n"
+			<< "Content-Length: " << playList.m_content->size() << "\r\n"
+			<< "ETag: " << playList.m_etag << "\r\n"
+			<< "Cache-Control: no-cache\r\n";
+		playList.m_headers = headers.str();
+	}
+
+	if ( (fullRequestStr != NULL) && (getHeader(fullRequestStr, "If-None-Match").find(playList.m_etag) != std::string::npos) )
+	{
+		this->sendNotModified(playList.m_etag);
+		return true;
+	}
+	this->startResponse(playList.m_headers);
+	fSender->add(playList.m_content, playList.m_content->c_str(), playList.m_content->size());
+	fSender->start(afterStreaming, this);
 	return true;
 }
 
-bool HTTPServer::HTTPClientConnection::sendFile(char const* urlSuffix)
+bool HTTPServer::HTTPClientConnection::sendFile(char const* fullRequestStr)
 {
-	bool ok = false;
-	
-	std::string url(urlSuffix);
+	std::string url(fullRequestStr);
 	size_t pos = url.find_first_of(" ");
 	if (pos != std::string::npos)
 	{
 		url.erase(0,pos+1);
 	}
-	pos = url.find_first_of(" ");
+	pos = url.find_first_of(" ?");
 	if (pos != std::string::npos)
 	{
 		url.erase(pos);
@@ -192,39 +593,86 @@ bool HTTPServer::HTTPClientConnection::sendFile(char const* urlSuffix)
 		url.erase(pos, pattern.length());
 	}			
 	
-	std::string ext;
-	pos = url.find_last_of(".");
-	if (pos != std::string::npos)
-	{
-		ext.assign(url.substr(pos+1));
-	}
-	
 	if (url.empty())
 	{
 		url = "index.html"; 
-		ext = "html";
 	}
-	if (ext=="js") ext ="javascript";
 	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
 	if (!httpServer->m_webroot.empty()) {
 		url.insert(0, httpServer->m_webroot);
 	}
-	std::ifstream file(url.c_str());
-	if (file.is_open())
+	FileCache::Handle file = httpServer->m_fileCache.get(url);
+	if (file == NULL)
 	{
-		envir() << "send file:" << url.c_str() <<"\n";
-		std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-		std::string mime("text/");
-		mime.append(ext);
-		this->sendHeader(mime.c_str(), content.size());
-		this->streamSource(content);
-		ok = true;
+		return false;
+	}
+	const FileCache::Variant & variant = file->select(getHeader(fullRequestStr, "Accept-Encoding").c_str());
+
+	// the client has the same content
+	std::string ifNoneMatch(getHeader(fullRequestStr, "If-None-Match"));
+	if ( (ifNoneMatch == "*") || (ifNoneMatch.find(variant.m_etag) != std::string::npos) )
+	{
+		this->sendNotModified(variant.m_etag);
+		return true;
+	}
+
+	// the files that are not cached are sent by the kernel
+	int fd = -1;
+	if (!variant.m_content)
+	{
+		fd = open(variant.m_path.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			return false;
+		}
+	}
+
+	envir() << "send file:" << variant.m_path.c_str() <<"\n";
+	this->startResponse(variant.m_headers);
+	if (fd < 0)
+	{
+		fSender->add(variant.m_content, variant.m_content->c_str(), variant.m_content->size());
 	}
-	return ok;
+	else
+	{
+		fSender->addFile(fd, 0, variant.m_size);
+	}
+	fSender->start(afterStreaming, this);
+	return true;
 }			
 		
+// any request cancels the idle timeout
+void HTTPServer::HTTPClientConnection::handleRequestBytes(int newBytesRead)
+{
+	envir().taskScheduler().unscheduleDelayedTask(fIdleTask);
+	RTSPServer::RTSPClientConnection::handleRequestBytes(newBytesRead);
+}
+
 void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* urlSuffix, char const* fullRequestStr) 
 {
+	if (fBusy)
+	{
+		// pipelined request, it is answered when the current response is sent
+		const char* end = strstr(fullRequestStr, "\r\n\r\n");
+		size_t size = (end != NULL) ? end + 4 - fullRequestStr : strlen(fullRequestStr);
+		fPending.push_back(std::make_pair(std::string(urlSuffix), std::string(fullRequestStr, size)));
+		fResponseBuffer[0] = '\0';
+		return;
+	}
+
+	this->handleRequest(urlSuffix, fullRequestStr);
+	if (fResponseBuffer[0] != '\0')
+	{
+		// the error responses of live555 have no length, the connection is closed after them
+		fIsActive = False;
+	}
+}
+
+void HTTPServer::HTTPClientConnection::handleRequest(char const* urlSuffix, char const* fullRequestStr) 
+{
+	fKeepAlive = keepAlive(fullRequestStr);
+	fBusy = true;
+
 	char const* questionMarkPos = strrchr(urlSuffix, '?');
 	if (strcmp(urlSuffix, "getVersion") == 0) 
 	{
@@ -234,6 +682,32 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 		this->sendHeader("text/plain", content.size());
 		this->streamSource(content);
 	}
+	else if (strcmp(urlSuffix, "metrics") == 0) 
+	{
+		std::ostringstream os;
+		Metrics::instance().write(os, fOurServer.numClientSessions());
+		std::string content(os.str());
+		this->sendHeader("text/plain; version=0.0.4", content.size());
+		this->streamSource(content);
+	}
+	else if ( (strncmp(urlSuffix, "trace", strlen("trace")) == 0) && ( (urlSuffix[strlen("trace")] == '\0') || (urlSuffix[strlen("trace")] == '?') ) )
+	{
+		std::ostringstream os;
+		const char* contentType = "text/plain";
+		if ( (questionMarkPos != NULL) && (strcmp(questionMarkPos+1, "start") == 0) ) {
+			Tracer::enable(true);
+			os << "tracing started\n";
+		} else if ( (questionMarkPos != NULL) && (strcmp(questionMarkPos+1, "stop") == 0) ) {
+			Tracer::enable(false);
+			os << "tracing stopped\n";
+		} else {
+			Tracer::dump(os);
+			contentType = "application/json";
+		}
+		std::string content(os.str());
+		this->sendHeader(contentType, content.size());
+		this->streamSource(content);
+	}
 	else if (strncmp(urlSuffix, "getStreamList", strlen("getStreamList")) == 0) 
 	{
 		std::ostringstream os;
@@ -266,12 +740,12 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 		this->sendHeader("text/plain", content.size());
 		this->streamSource(content);
 	}
-	else if (questionMarkPos == NULL) 
+	else if ( (questionMarkPos == NULL) || (strncmp(questionMarkPos, "?_HLS_", strlen("?_HLS_")) == 0) )
 	{
-		std::string streamName(urlSuffix);
+		std::string url(urlSuffix, (questionMarkPos != NULL) ? questionMarkPos-urlSuffix : strlen(urlSuffix));
+		std::string streamName(url);
 		std::string ext;
 
-		std::string url(urlSuffix);
 		size_t pos = url.find_last_of(".");
 		if (pos != std::string::npos)
 		{
@@ -282,12 +756,19 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 		if (ext == "mpd")
 		{
 			// MPEG-DASH Playlist
-			ok = this->sendMpdPlayList(streamName.c_str());				
+			ok = this->sendPlayList(streamName, ext, fullRequestStr);
+		}
+		else if (questionMarkPos != NULL)
+		{
+			// LL-HLS Playlist blocking until the requested segment/part
+			const char* msn = strstr(questionMarkPos, "_HLS_msn=");
+			const char* part = strstr(questionMarkPos, "_HLS_part=");
+			ok = (msn != NULL) && this->waitPlayList(streamName, atoi(msn+strlen("_HLS_msn=")), part ? atoi(part+strlen("_HLS_part=")) : -1);
 		}
 		else
 		{
 			// HLS Playlist
-			ok = this->sendM3u8PlayList(streamName.c_str());
+			ok = this->sendPlayList(streamName, "m3u8", fullRequestStr);
 		}
 
 		if (!ok)
@@ -302,17 +783,93 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 			fIsActive = False;
 		}
 	}
+	else if ( (strcmp(questionMarkPos, "?live") == 0) || (strncmp(questionMarkPos, "?live=", strlen("?live=")) == 0) )
+	{
+		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
+		std::string option(questionMarkPos + strlen("?live"));
+		std::string webSocketKey(getHeader(fullRequestStr, "Sec-WebSocket-Key"));
+		bool webSocket = (strcasecmp(getHeader(fullRequestStr, "Upgrade").c_str(), "websocket") == 0) && !webSocketKey.empty();
+		HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+		FrameFeed* feed = httpServer->getFeed(streamName);
+		bool ok = (feed != NULL);
+		FeedMode mode = FEED_MULTIPART;
+		if (option.empty())
+		{
+			mode = webSocket ? FEED_WEBSOCKET : FEED_MULTIPART;
+		}
+		else if (option == "=raw")
+		{
+			mode = webSocket ? FEED_WEBSOCKET : FEED_CHUNKED;
+		}
+		else if ( (option == "=delta") && webSocket && ok && (feed->getFormat() == "video/RAW") )
+		{
+			// the delta coding is for the 16 bits samples
+			mode = FEED_WEBSOCKET_DELTA;
+		}
+		else
+		{
+			ok = false;
+		}
+		if (!ok)
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+			return;
+		}
+		this->startFeed(feed, mode, webSocketKey);
+	}
+	else if ( (strcmp(questionMarkPos, "?snapshot") == 0) || (strcmp(questionMarkPos, "?snapshot=png") == 0) || (strcmp(questionMarkPos, "?snapshot=raw") == 0) )
+	{
+		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
+		bool raw = (strcmp(questionMarkPos, "?snapshot=raw") == 0);
+		HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
+		FrameFeed* feed = httpServer->getFeed(streamName);
+		// the PNG is for the 16 bits samples
+		if ( (feed == NULL) || ( !raw && (feed->getFormat() != "video/RAW") ) )
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+			return;
+		}
+		this->startSnapshot(feed, raw ? NULL : httpServer->getSnapshotEncoder(streamName));
+	}
+	else if (strcmp(questionMarkPos, "?init") == 0)
+	{
+		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
+		SegmentServerMediaSubsession* subsession = dynamic_cast<SegmentServerMediaSubsession*>(this->getSubsesion(streamName.c_str()));
+		std::shared_ptr<const std::string> init;
+		if (subsession != NULL)
+		{
+			init = subsession->getInitSegment();
+		}
+		if (!init)
+		{
+			// not a CMAF stream or the parameter sets are not yet received
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+			return;
+		}
+		this->sendHeader(subsession->getContentType(), init->size());
+
+		// the init segment is shared, it is replaced and not modified when the parameter sets change
+		this->streamSource(NULL);
+		fSender = new BufferSender(envir(), fClientOutputSocket);
+		fSender->add(init, init->c_str(), init->size());
+		fSender->start(afterStreaming, this);
+	}
 	else
 	{
-		unsigned offsetInSeconds;
-		if (sscanf(questionMarkPos, "?segment=%u", &offsetInSeconds) != 1)
+		unsigned id;
+		unsigned part;
+		int nb = sscanf(questionMarkPos, "?segment=%u&part=%u", &id, &part);
+		if (nb < 1)
 		{
 			handleHTTPCmd_notSupported();
 			return;			  
 		}
 		
 		std::string streamName(urlSuffix, questionMarkPos-urlSuffix);
-		ServerMediaSubsession* subsession = this->getSubsesion(streamName.c_str());
+		SegmentServerMediaSubsession* subsession = dynamic_cast<SegmentServerMediaSubsession*>(this->getSubsesion(streamName.c_str()));
 		if (subsession == NULL) 
 		{
 			handleHTTPCmd_notSupported();
@@ -320,40 +877,367 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const* ur
 			return;			  
 		}
 
-		// Call "getStreamParameters()" to create the stream's source.  (Because we're not actually streaming via RTP/RTCP, most
-		// of the parameters to the call are dummy.)
-		++fClientSessionId;
-		Port clientRTPPort(0), clientRTCPPort(0), serverRTPPort(0), serverRTCPPort(0);
-		netAddressBits destinationAddress = 0;
-		u_int8_t destinationTTL = 0;
-		Boolean isMulticast = False;
-		subsession->getStreamParameters(fClientSessionId, 0, clientRTPPort,clientRTCPPort, -1,0,0, destinationAddress,destinationTTL, isMulticast, serverRTPPort,serverRTCPPort, fStreamToken);
-
-		// Seek the stream source to the desired place, with the desired duration, and (as a side effect) get the number of bytes:
-		double dOffsetInSeconds = (double)offsetInSeconds;
-		u_int64_t numBytes = 0;
-		subsession->seekStream(fClientSessionId, fStreamToken, dOffsetInSeconds, 0.0, numBytes);
+		if (nb == 2)
+		{
+			// LL-HLS part, the preload hint waits for it
+			this->waitPart(subsession, id, part);
+			return;
+		}
 
-		if (numBytes == 0) 
+		SegmentStore::Handle segment = subsession->getSegment(id);
+		if ( (segment == NULL) || (segment->size() == 0) )
 		{
-			// For some reason, we do not know the size of the requested range.  We can't handle this request:
+			// the segment is not in the store anymore or not yet
 			handleHTTPCmd_notSupported();
 			fIsActive = False;
 		}
 		else
 		{
 			// send response header
-			this->sendHeader("video/mp2t", numBytes);
+			this->sendHeader(subsession->getContentType(), segment->size());
 
-			// stream body
-			this->streamSource(subsession->getStreamSource(fStreamToken));
-			
-			// pointer to subsession to close it
-			fSubsession = subsession;
+			// stream body from the segment chunks
+			fSegment = true;
+			Metrics::instance().httpStreamStarted();
+			this->streamSegment(segment, 0, segment->size());
 		}
 	} 
 }
 
+// -----------------------------------------
+//    live frames
+// -----------------------------------------
+void HTTPServer::HTTPClientConnection::startFeed(FrameFeed* feed, FeedMode mode, const std::string & webSocketKey)
+{
+	// the connection is dedicated to the stream until the viewer closes it
+	fKeepAlive = false;
+	fFeed = feed;
+	fFeedMode = mode;
+	fFeedId = 0;
+	fSegment = true;
+	Metrics::instance().httpStreamStarted();
+	static const char* modes[] = { "multipart", "chunked", "websocket", "websocket delta" };
+	envir() << "send live frames:" << feed->getFormat().c_str() << " " << modes[mode] << "\n";
+
+	if (mode >= FEED_WEBSOCKET)
+	{
+		// the connection doesn't speak HTTP anymore, the messages of the viewer are read by receiveWebSocket for the whole session
+		std::ostringstream os;
+		os << "HTTP/1.1 101 Switching Protocols\r\n"
+		   << dateHeader()
+		   << "Server: LIVE555 Streaming Media v" << LIVEMEDIA_LIBRARY_VERSION_STRING << "\r\n"
+		   << "Upgrade: websocket\r\n"
+		   << "Connection: Upgrade\r\n"
+		   << "Sec-WebSocket-Accept: " << WebSocket::acceptKey(webSocketKey) << "\r\n"
+		   << "\r\n";
+		std::shared_ptr<const std::string> header(new std::string(os.str()));
+		fResponseBuffer[0] = '\0';
+		this->streamSource(NULL);
+		envir().taskScheduler().setBackgroundHandling(fClientInputSocket, SOCKET_READABLE|SOCKET_EXCEPTION, webSocketHandler, this);
+		fSender = new BufferSender(envir(), fClientOutputSocket);
+		fSender->setReadHandler(webSocketHandler, this);
+		fSender->add(header, header->c_str(), header->size());
+	}
+	else
+	{
+		std::ostringstream os;
+		os << "Cache-Control: no-cache, no-store\r\n"
+		   << "X-Format: " << feed->getFormat() << "\r\n";
+		if (mode == FEED_CHUNKED)
+		{
+			os << "Content-Type: application/octet-stream\r\n"
+			   << "Transfer-Encoding: chunked\r\n";
+		}
+		else
+		{
+			os << "Content-Type: multipart/x-mixed-replace; boundary=" << FEED_BOUNDARY << "\r\n";
+		}
+		this->startResponse(os.str());
+	}
+	fFeedSending = true;
+	fFeed->addListener(feedFrame, this);
+	fSender->start(feedSent, this);
+}
+
+// size, width, height and timestamp in microseconds, in network order
+static void feedHeader(const FrameFeed::Frame & frame, unsigned char header[16])
+{
+	uint64_t timestamp = (uint64_t)frame.m_timestamp.tv_sec*1000000 + frame.m_timestamp.tv_usec;
+	for (int i = 0; i < 4; ++i) {
+		header[i] = frame.m_size >> (24 - 8*i);
+	}
+	header[4] = frame.m_width >> 8;
+	header[5] = frame.m_width;
+	header[6] = frame.m_height >> 8;
+	header[7] = frame.m_height;
+	for (int i = 0; i < 8; ++i) {
+		header[8+i] = timestamp >> (56 - 8*i);
+	}
+}
+
+// send the latest frame, the frames received meanwhile are dropped
+void HTTPServer::HTTPClientConnection::sendFeedFrame()
+{
+	FrameFeed::Handle frame = fFeed->latest();
+	if ( (frame != NULL) && (frame->m_id == fFeedId) )
+	{
+		frame.reset();
+	}
+	if ( (frame == NULL) && fWebSocketControl.empty() )
+	{
+		return;
+	}
+
+	// the pong replies go before the frame
+	std::ostringstream os;
+	os << fWebSocketControl;
+	fWebSocketControl.clear();
+
+	std::shared_ptr<const void> owner;
+	const char* payload = NULL;
+	size_t size = 0;
+	if (frame != NULL)
+	{
+		fFeedId = frame->m_id;
+		owner = frame;
+		payload = frame->data();
+		size = frame->m_size;
+		if (fFeedMode == FEED_MULTIPART)
+		{
+			const std::string & format = fFeed->getFormat();
+			const char* contentType = "application/octet-stream";
+			if (format == "video/JPEG") {
+				contentType = "image/jpeg";
+			} else if (format == "video/H264") {
+				contentType = "video/h264";
+			} else if (format == "video/H265") {
+				contentType = "video/h265";
+			}
+			os << "--" << FEED_BOUNDARY << "\r\n"
+			   << "Content-Type: " << contentType << "\r\n"
+			   << "Content-Length: " << frame->m_size << "\r\n"
+			   << "X-Timestamp: " << frame->m_timestamp.tv_sec << "." << std::setfill('0') << std::setw(6) << frame->m_timestamp.tv_usec << "\r\n";
+			if ( (frame->m_width > 0) && (frame->m_height > 0) ) {
+				os << "X-Width: " << frame->m_width << "\r\n"
+				   << "X-Height: " << frame->m_height << "\r\n";
+			}
+			os << "\r\n";
+		}
+		else
+		{
+			// the size of the header is the size of the frame, before the delta coding
+			unsigned char header[16];
+			feedHeader(*frame, header);
+			if (fFeedMode == FEED_CHUNKED)
+			{
+				os << std::hex << sizeof(header) + size << "\r\n";
+			}
+			else
+			{
+				if (fFeedMode == FEED_WEBSOCKET_DELTA)
+				{
+					std::shared_ptr<const std::string> delta(fFeed->delta(frame));
+					owner = delta;
+					payload = delta->c_str();
+					size = delta->size();
+				}
+				os << WebSocket::frameHeader(WebSocket::BINARY, sizeof(header) + size);
+			}
+			os.write((const char*)header, sizeof(header));
+		}
+	}
+	std::shared_ptr<const std::string> header(new std::string(os.str()));
+
+	// the frame is shared with the other viewers, it stays allocated until it is sent
+	this->streamSource(NULL);
+	fSender = new BufferSender(envir(), fClientOutputSocket);
+	if (fFeedMode >= FEED_WEBSOCKET)
+	{
+		fSender->setReadHandler(webSocketHandler, this);
+	}
+	fSender->add(header, header->c_str(), header->size());
+	fSender->add(owner, payload, size);
+	if ( (frame != NULL) && (fFeedMode < FEED_WEBSOCKET) )
+	{
+		fSender->add(std::shared_ptr<const void>(), "\r\n", 2);
+	}
+	fFeedSending = true;
+	fSender->start(feedSent, this);
+}
+
+void HTTPServer::HTTPClientConnection::feedFrame(void* clientData)
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	if (!clientConnection->fFeedSending)
+	{
+		clientConnection->sendFeedFrame();
+	}
+}
+
+void HTTPServer::HTTPClientConnection::feedSent(void* clientData)
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	clientConnection->fFeedSending = false;
+	if (clientConnection->fSender->failed())
+	{
+		// the viewer is gone
+		afterStreaming(clientConnection);
+	}
+	else
+	{
+		clientConnection->sendFeedFrame();
+	}
+}
+
+// the pings are answered, the close ends the stream, the other messages are ignored
+void HTTPServer::HTTPClientConnection::receiveWebSocket()
+{
+	char buffer[4096];
+	ssize_t size = recv(fClientInputSocket, buffer, sizeof(buffer), 0);
+	if (size <= 0)
+	{
+		if ( (size < 0) && ( (errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR) ) )
+		{
+			return;
+		}
+		// the viewer is gone
+		afterStreaming(this);
+		return;
+	}
+	fWebSocketInput.append(buffer, size);
+
+	WebSocket::Frame frame;
+	ssize_t used;
+	while ( (used = WebSocket::parse(fWebSocketInput.c_str(), fWebSocketInput.size(), WEBSOCKET_MAX_MESSAGE, frame)) > 0 )
+	{
+		fWebSocketInput.erase(0, used);
+		if (frame.m_opcode == WebSocket::CLOSE)
+		{
+			// echo the status code
+			std::string status(frame.m_payload.substr(0, 2));
+			std::string reply(WebSocket::frameHeader(WebSocket::CLOSE, status.size()) + status);
+			send(fClientOutputSocket, reply.c_str(), reply.size(), MSG_NOSIGNAL);
+			afterStreaming(this);
+			return;
+		}
+		else if (frame.m_opcode == WebSocket::PING)
+		{
+			fWebSocketControl += WebSocket::frameHeader(WebSocket::PONG, frame.m_payload.size()) + frame.m_payload;
+		}
+	}
+	if (used < 0)
+	{
+		envir() << "invalid websocket frame\n";
+		afterStreaming(this);
+		return;
+	}
+	if (!fWebSocketControl.empty() && !fFeedSending)
+	{
+		this->sendFeedFrame();
+	}
+}
+
+// -----------------------------------------
+//    snapshots
+// -----------------------------------------
+void HTTPServer::HTTPClientConnection::startSnapshot(FrameFeed* feed, SnapshotEncoder* encoder)
+{
+	// the response is sent when the frame is available
+	fResponseBuffer[0] = '\0';
+	fSnapshotEncoder = encoder;
+	FrameFeed::Handle frame = feed->latest();
+	if (frame != NULL)
+	{
+		this->sendSnapshot(frame, feed->getFormat());
+	}
+	else
+	{
+		// the feed is started for the next frame and stopped after it if there is no live viewer
+		fSnapshotFeed = feed;
+		fSnapshotFeed->addListener(snapshotFrame, this);
+		fSnapshotTask = envir().taskScheduler().scheduleDelayedTask(SNAPSHOT_TIMEOUT*1000000LL, snapshotTimeout, this);
+	}
+}
+
+static std::string snapshotHeaders(const char* contentType, size_t size, int width, int height, const timeval & timestamp)
+{
+	std::ostringstream os;
+	os << "Content-Type: " << contentType << "\r\n"
+	   << "Content-Length: " << size << "\r\n"
+	   << "Cache-Control: no-cache, no-store\r\n"
+	   << "X-Timestamp: " << timestamp.tv_sec << "." << std::setfill('0') << std::setw(6) << timestamp.tv_usec << "\r\n";
+	if ( (width > 0) && (height > 0) ) {
+		os << "X-Width: " << width << "\r\n"
+		   << "X-Height: " << height << "\r\n";
+	}
+	return os.str();
+}
+
+void HTTPServer::HTTPClientConnection::sendSnapshot(const FrameFeed::Handle & frame, const std::string & format)
+{
+	if (fSnapshotEncoder != NULL)
+	{
+		fSnapshotEncoder->encode(frame, snapshotEncoded, this);
+		return;
+	}
+
+	// the raw frame is shared with the live viewers
+	std::ostringstream os;
+	os << snapshotHeaders("application/octet-stream", frame->m_size, frame->m_width, frame->m_height, frame->m_timestamp)
+	   << "X-Format: " << format << "\r\n";
+	this->startResponse(os.str());
+	fSender->add(frame, frame->data(), frame->m_size);
+	fSender->start(afterStreaming, this);
+}
+
+void HTTPServer::HTTPClientConnection::cancelSnapshot()
+{
+	if (fSnapshotFeed != NULL)
+	{
+		fSnapshotFeed->removeListener(this);
+		envir().taskScheduler().unscheduleDelayedTask(fSnapshotTask);
+		fSnapshotFeed = NULL;
+	}
+	if (fSnapshotEncoder != NULL)
+	{
+		fSnapshotEncoder->cancel(this);
+		fSnapshotEncoder = NULL;
+	}
+}
+
+void HTTPServer::HTTPClientConnection::snapshotFrame(void* clientData)
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	FrameFeed* feed = clientConnection->fSnapshotFeed;
+	FrameFeed::Handle frame = feed->latest();
+	feed->removeListener(clientConnection);
+	clientConnection->envir().taskScheduler().unscheduleDelayedTask(clientConnection->fSnapshotTask);
+	clientConnection->fSnapshotFeed = NULL;
+	clientConnection->sendSnapshot(frame, feed->getFormat());
+}
+
+void HTTPServer::HTTPClientConnection::snapshotTimeout(void* clientData)
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	clientConnection->fSnapshotTask = NULL;
+	clientConnection->cancelSnapshot();
+	clientConnection->sendNotSupported();
+}
+
+void HTTPServer::HTTPClientConnection::snapshotEncoded(void* clientData, const SnapshotEncoder::Snapshot & snapshot)
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	clientConnection->fSnapshotEncoder = NULL;
+	if (snapshot.m_png == NULL)
+	{
+		clientConnection->sendNotSupported();
+		return;
+	}
+	clientConnection->startResponse(snapshotHeaders("image/png", snapshot.m_png->size(), snapshot.m_width, snapshot.m_height, snapshot.m_timestamp));
+	clientConnection->fSender->add(snapshot.m_png, snapshot.m_png->c_str(), snapshot.m_png->size());
+	clientConnection->fSender->start(afterStreaming, clientConnection);
+}
+
 void HTTPServer::HTTPClientConnection::handleCmd_notFound() {
 	std::ostringstream os;
 	HTTPServer* httpServer = (HTTPServer*)(&fOurServer);
@@ -369,6 +1253,12 @@ void HTTPServer::HTTPClientConnection::handleCmd_notFound() {
 void HTTPServer::HTTPClientConnection::afterStreaming(void* clientData) 
 {	
 	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+
+	if (clientConnection->fKeepAlive && clientConnection->fIsActive) {
+		// the sink or the sender that calls us is released from the event loop
+		clientConnection->fDoneTask = clientConnection->envir().taskScheduler().scheduleDelayedTask(0, responseDone, clientConnection);
+		return;
+	}
 	
 	// Arrange to delete the 'client connection' object:
 	if (clientConnection->fRecursionCount > 0) {
@@ -381,11 +1271,105 @@ void HTTPServer::HTTPClientConnection::afterStreaming(void* clientData)
 	}
 }
 
+// the response is sent, answer the pipelined requests or wait for the next one
+void HTTPServer::HTTPClientConnection::responseDone(void* clientData) 
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	clientConnection->fDoneTask = NULL;
+	clientConnection->streamSource(NULL);
+	if (clientConnection->fSegment) {
+		clientConnection->fSegment = false;
+		Metrics::instance().httpStreamStopped();
+	}
+	clientConnection->fBusy = false;
+
+	if (!clientConnection->fPending.empty()) {
+		std::pair<std::string,std::string> request(clientConnection->fPending.front());
+		clientConnection->fPending.pop_front();
+
+		// handled like live555 does, the connection is deleted at the end if it is closed
+		clientConnection->fRecursionCount++;
+		clientConnection->handleHTTPCmd_StreamingGET(request.first.c_str(), request.second.c_str());
+		if (clientConnection->fResponseBuffer[0] != '\0') {
+			send(clientConnection->fClientOutputSocket, (char const*)clientConnection->fResponseBuffer, strlen((char*)clientConnection->fResponseBuffer), 0);
+			clientConnection->fResponseBuffer[0] = '\0';
+		}
+		clientConnection->fRecursionCount--;
+		if (!clientConnection->fIsActive) {
+			delete clientConnection;
+		}
+	} else {
+		// the senders disable the socket handler when they are done
+		clientConnection->envir().taskScheduler().setBackgroundHandling(clientConnection->fClientInputSocket, SOCKET_READABLE|SOCKET_EXCEPTION, incomingRequestHandler, clientConnection);
+		clientConnection->fIdleTask = clientConnection->envir().taskScheduler().scheduleDelayedTask(HTTP_KEEPALIVE_TIMEOUT*1000000LL, idleTimeout, clientConnection);
+	}
+}
+
+void HTTPServer::HTTPClientConnection::idleTimeout(void* clientData) 
+{
+	HTTPServer::HTTPClientConnection* clientConnection = (HTTPServer::HTTPClientConnection*)clientData;
+	clientConnection->fIdleTask = NULL;
+	delete clientConnection;
+}
+
 HTTPServer::HTTPClientConnection::~HTTPClientConnection() 
 {
+	envir().taskScheduler().unscheduleDelayedTask(fDoneTask);
+	envir().taskScheduler().unscheduleDelayedTask(fIdleTask);
+	if (fFeed != NULL) {
+		fFeed->removeListener(this);
+	}
+	this->cancelSnapshot();
+	this->cancelWait();
 	this->streamSource(NULL);
 	
-	if (fSubsession) {
-		fSubsession->deleteStream(fClientSessionId,  fStreamToken);
+	if (fSegment) {
+		Metrics::instance().httpStreamStopped();
+	}
+}
+
+// -----------------------------------------
+//    HTTPServer
+// -----------------------------------------
+HTTPServer::~HTTPServer()
+{
+	// the connections use the feeds
+	cleanup();
+	for (std::map<std::string, SnapshotEncoder*>::iterator it = m_snapshotEncoders.begin(); it != m_snapshotEncoders.end(); ++it) {
+		delete it->second;
+	}
+	for (std::map<std::string, FrameFeed*>::iterator it = m_feeds.begin(); it != m_feeds.end(); ++it) {
+		Medium::close(it->second);
+	}
+}
+
+SnapshotEncoder* HTTPServer::getSnapshotEncoder(const std::string & streamName)
+{
+	std::map<std::string, SnapshotEncoder*>::iterator it = m_snapshotEncoders.find(streamName);
+	if (it != m_snapshotEncoders.end()) {
+		return it->second;
+	}
+	SnapshotEncoder* encoder = SnapshotEncoder::createNew(envir());
+	m_snapshotEncoders[streamName] = encoder;
+	return encoder;
+}
+
+FrameFeed* HTTPServer::getFeed(const std::string & streamName)
+{
+	std::map<std::string, FrameFeed*>::iterator it = m_feeds.find(streamName);
+	if (it != m_feeds.end()) {
+		return it->second;
+	}
+	FrameFeed* feed = NULL;
+	ServerMediaSession* session = this->lookupServerMediaSession(streamName.c_str());
+	if (session != NULL) {
+		ServerMediaSubsessionIterator iter(*session);
+		UnicastServerMediaSubsession* subsession = dynamic_cast<UnicastServerMediaSubsession*>(iter.next());
+		// the segment sessions share the replicator of the RTSP session
+		if ( (subsession != NULL) && (dynamic_cast<SegmentServerMediaSubsession*>(subsession) == NULL) ) {
+			feed = FrameFeed::createNew(envir(), subsession->getReplicator(), subsession->getStreamFormat());
+			m_feeds[streamName] = feed;
+		}
 	}
+	return feed;
 }
@@ -0,0 +1,143 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** JPEGHeaderParser.cpp
+**
+** Parse the JPEG header fields needed by RTP/JPEG (RFC 2435)
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "logger.h"
+#include "JPEGHeaderParser.h"
+
+JPEGHeaderParser::JPEGHeaderParser()
+	: m_changed(false), m_width(0), m_height(0), m_type(0), m_restartInterval(0), m_qTableSize(0), m_precision(0)
+{
+	memset(&m_qTable, 0, sizeof(m_qTable));
+}
+
+unsigned int JPEGHeaderParser::parse(const unsigned char* frame, unsigned int size)
+{
+	unsigned int headerSize = this->walk(frame, size, false);
+	if (headerSize == 0) {
+		m_changed = false;
+	} else if ( (headerSize == m_header.size()) && (memcmp(m_header.c_str(), frame, headerSize) == 0) ) {
+		// same header as the previous frame
+		m_changed = false;
+	} else {
+		m_type = 0;
+		m_restartInterval = 0;
+		m_qTableSize = 0;
+		m_precision = 0;
+		this->walk(frame, size, true);
+		m_header.assign((const char*)frame, headerSize);
+		m_changed = true;
+		LOG(INFO) << "width:" << m_width << " height:" << m_height << " type:"<< (int)m_type << " restartInterval:" << m_restartInterval << " qTableSize:" << m_qTableSize;
+	}
+	return headerSize;
+}
+
+// jump from segment to segment until the start of scan
+unsigned int JPEGHeaderParser::walk(const unsigned char* frame, unsigned int size, bool parseSegments)
+{
+	unsigned int i = 0;
+	while (i+1 < size) {
+		const unsigned char* marker = (const unsigned char*)memchr(frame+i, 0xFF, size-i-1);
+		if (marker == NULL) {
+			break;
+		}
+		i = marker - frame;
+		unsigned char code = frame[i+1];
+		if (code == 0xFF) {
+			// fill byte
+			i++;
+		} else if ( (code == 0xD8) || (code == 0x01) || (code == 0x00) || ((code >= 0xD0) && (code <= 0xD7)) ) {
+			// marker without segment
+			i+=2;
+		} else if (i+4 <= size) {
+			unsigned int length = (frame[i+2]<<8)|(frame[i+3]);
+			if ( (length < 2) || (i+2+length > size) ) {
+				break;
+			}
+			if (parseSegments) {
+				this->parseSegment(code, frame+i+4, length-2);
+			}
+			if (code == 0xDA) {
+				// SOS
+				return i+2+length;
+			}
+			i+=2+length;
+		} else {
+			break;
+		}
+	}
+	return 0;
+}
+
+void JPEGHeaderParser::parseSegment(unsigned char marker, const unsigned char* segment, unsigned int length)
+{
+	switch (marker) {
+		// SOF
+		case 0xC0:
+			if (length >= 8) {
+				m_height = (segment[1]<<8)|(segment[2]);
+				m_width  = (segment[3]<<8)|(segment[4]);
+				int hv_subsampling = segment[7];
+				if (hv_subsampling == 0x21 ) {
+					m_type |= 0; // JPEG 4:2:2
+				} else if (hv_subsampling == 0x22 ) {
+					m_type |= 1; // JPEG 4:2:0
+				} else {
+					LOG(NOTICE) << "not managed sampling:0x" << std::hex << hv_subsampling << std::dec;
+					m_type = 255;
+				}
+			}
+		break;
+		// DQT, can contain several tables
+		case 0xDB: {
+			unsigned int pos = 0;
+			while (pos < length) {
+				unsigned int precision = segment[pos]>>4;
+				unsigned int quantIdx  = segment[pos]&0x0f;
+				unsigned int quantSize = 64*(precision+1);
+				if ( (pos+1+quantSize > length) || (quantSize*quantIdx+quantSize > sizeof(m_qTable)) ) {
+					break;
+				}
+				memcpy(m_qTable + quantSize*quantIdx, segment + pos + 1, quantSize);
+				if (precision) {
+					m_precision |= (1<<quantIdx);
+				}
+				if (quantSize*quantIdx+quantSize > m_qTableSize) {
+					m_qTableSize = quantSize*quantIdx+quantSize;
+				}
+				pos += 1+quantSize;
+			}
+		}
+		break;
+		// DRI
+		case 0xDD:
+			if (length >= 2) {
+				m_type |= 0x40;
+				m_restartInterval = (segment[0]<<8)|(segment[1]);
+			}
+		break;
+		default:
+		break;
+	}
+}
+
+u_int8_t const* JPEGHeaderParser::quantizationTables(u_int8_t& precision, u_int16_t& length) const
+{
+	length = 0;
+	precision = 0;
+	if (m_qTableSize > 0)
+	{
+		length = m_qTableSize;
+		precision = m_precision;
+	}
+	return m_qTable;
+}
@@ -0,0 +1,64 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** MJPEG_V4l2DeviceSource.cpp
+** 
+** MJPEG V4L2 live555 source 
+**
+** -------------------------------------------------------------------------*/
+
+// project
+#include "logger.h"
+#include "MJPEG_V4l2DeviceSource.h"
+
+// keep only the scan data, the header is kept for the frame being captured
+std::list< std::pair<unsigned char*,size_t> > MJPEG_V4L2DeviceSource::splitFrames(unsigned char* frame, unsigned frameSize) 
+{
+	std::list< std::pair<unsigned char*,size_t> > frameList;
+	if (frame != NULL)
+	{
+		unsigned int headerSize = m_parser.parse(frame, frameSize);
+		if (headerSize == 0) {
+			LOG(NOTICE) << "Bad header => dropping frame";
+		} else {
+			if (m_parser.changed() || (m_parsed.m_fields == NULL)) {
+				m_parsed.m_fields.reset(new JPEGHeaderParser(m_parser));
+				m_parsed.m_bytes.reset(new std::string(m_parser.header()));
+			}
+			{
+				std::lock_guard<std::mutex> lock(m_headerMutex);
+				m_headers[m_frameId] = m_parsed;
+			}
+			frameList.push_back(std::pair<unsigned char*,size_t>(frame + headerSize, frameSize - headerSize));
+		}
+	}
+	return frameList;
+}
+
+// publish the header of the frame, forget the ones of the frames dropped before it
+void MJPEG_V4L2DeviceSource::frameDelivered(const Frame & frame)
+{
+	std::lock_guard<std::mutex> lock(m_headerMutex);
+	std::map<uint64_t,Header>::iterator it = m_headers.lower_bound(frame.m_id);
+	if ( (it != m_headers.end()) && (it->first == frame.m_id) ) {
+		m_delivered = it->second;
+		m_deliveredTime = frame.m_timestamp;
+		++it;
+	} else {
+		m_delivered = Header();
+		timerclear(&m_deliveredTime);
+	}
+	m_headers.erase(m_headers.begin(), it);
+}
+
+bool MJPEG_V4L2DeviceSource::getHeader(const timeval & presentationTime, Header & header)
+{
+	std::lock_guard<std::mutex> lock(m_headerMutex);
+	if ( (m_delivered.m_fields == NULL) || timercmp(&presentationTime, &m_deliveredTime, !=) ) {
+		return false;
+	}
+	header = m_delivered;
+	return true;
+}
@@ -7,13 +7,25 @@
 ** 
 ** -------------------------------------------------------------------------*/
 
+#include <algorithm>
+
 #include "MemoryBufferSink.h"
 
+static unsigned int elapsedMs(const timeval & start, const timeval & end)
+{
+	return (end.tv_sec - start.tv_sec)*1000 + (end.tv_usec - start.tv_usec)/1000;
+}
+
 // -----------------------------------------
 //    MemoryBufferSink
 // -----------------------------------------
-MemoryBufferSink::MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration) : MediaSink(env), m_bufferSize(bufferSize), m_refTime(0), m_sliceDuration(sliceDuration)
+MemoryBufferSink::MemoryBufferSink(UsageEnvironment& env, unsigned bufferSize, unsigned int sliceDuration, unsigned int retention, size_t maxBytes, unsigned int partDuration, size_t chunkSize) 
+	: MediaSink(env), m_bufferSize(bufferSize), m_store(chunkSize, maxBytes, retention ? retention : 2*sliceDuration), m_sliceDuration(sliceDuration)
+	, m_nextId(0), m_keyFrameAligned(false), m_keyFramePending(false), m_pmtPid(0), m_partDuration(partDuration), m_partTarget(partDuration)
 {
+	timerclear(&m_refTime);
+	timerclear(&m_inputTime);
+	timerclear(&m_partStart);
 	m_buffer = new unsigned char[m_bufferSize];
 }
 
@@ -49,64 +61,172 @@ void MemoryBufferSink::afterGettingFrame(unsigned frameSize, unsigned numTruncat
 	}
 	else
 	{			
-		// append buffer to slice buffer
-		if (m_refTime == 0)
+		// the multiplexer doesn't set the presentation time, use the one of its input
+		timeval pts = timerisset(&m_inputTime) ? m_inputTime : presentationTime;
+		if (!timerisset(&m_refTime))
+		{
+			m_refTime = pts;
+		}
+		bool keyFrame = m_keyFramePending;
+		m_keyFramePending = false;
+		this->keepTables(m_buffer, frameSize);
+
+		SegmentStore::Handle current = m_store.back();
+		bool newSegment = false;
+		if (m_keyFrameAligned)
+		{
+			// first keyframe after the segment duration
+			newSegment = keyFrame && ( (current == NULL) || (elapsedMs(current->start(), pts) >= m_sliceDuration*1000) );
+		}
+		else
+		{
+			newSegment = (current == NULL) || ( (current->start().tv_sec - m_refTime.tv_sec)/m_sliceDuration != (pts.tv_sec - m_refTime.tv_sec)/m_sliceDuration );
+		}
+
+		bool completed = false;
+		if (newSegment)
+		{
+			// start a new segment, the store remove the old ones
+			m_store.begin(m_nextId++, pts);
+			m_partStart = pts;
+			completed = (current != NULL);
+			if (m_keyFrameAligned && !m_pat.empty() && !m_pmt.empty())
+			{
+				// the segment can be decoded alone
+				m_store.append(m_pat.c_str(), m_pat.size(), pts);
+				m_store.append(m_pmt.c_str(), m_pmt.size(), pts);
+			}
+		}
+		else if (current == NULL)
+		{
+			// wait the first keyframe
+			continuePlaying();
+			return;
+		}
+		else if (m_partDuration > 0)
 		{
-			m_refTime = presentationTime.tv_sec;
+			// close the part before a keyframe or before the data that would make it longer than the part duration
+			unsigned int elapsed = elapsedMs(m_partStart, pts);
+			if ( (keyFrame || (elapsed >= m_partDuration)) && m_store.closePart(pts) )
+			{
+				m_partTarget = std::max(m_partTarget, elapsed);
+				m_partStart = pts;
+				completed = true;
+			}
 		}
-		unsigned int slice = (presentationTime.tv_sec-m_refTime)/m_sliceDuration;
-		std::string& outputBuffer = m_outputBuffers[slice];
-		outputBuffer.append((const char*)m_buffer, frameSize);
-		
-		// remove old buffers
-		while (m_outputBuffers.size()>3)
+		if (keyFrame)
 		{
-			m_outputBuffers.erase(m_outputBuffers.begin());
+			m_store.keyFrame(pts);
+		}
+		m_store.append((const char*)m_buffer, frameSize, pts);
+
+		if (completed)
+		{
+			this->partCompleted();
 		}
 	}
 
 	continuePlaying();
 }
 
-unsigned int MemoryBufferSink::getBufferSize(unsigned int slice)
+// keep the last PAT and PMT packets of the transport stream
+void MemoryBufferSink::keepTables(const unsigned char* buffer, unsigned int size)
 {
-	unsigned int size = 0;
-	std::map<unsigned int,std::string>::iterator it = m_outputBuffers.find(slice);
-	if (it != m_outputBuffers.end())
+	for (unsigned int i = 0; i+188 <= size; i+=188)
 	{
-		size = it->second.size();
+		const unsigned char* packet = buffer + i;
+		if (packet[0] != 0x47)
+		{
+			break;
+		}
+		unsigned int pid = ((packet[1]&0x1F)<<8) | packet[2];
+		if (pid == 0)
+		{
+			m_pat.assign((const char*)packet, 188);
+			// first program of the PAT section after the pointer field
+			unsigned int section = 5 + packet[4];
+			if (section + 12 <= 188)
+			{
+				m_pmtPid = ((packet[section+10]&0x1F)<<8) | packet[section+11];
+			}
+		}
+		else if ( (m_pmtPid != 0) && (pid == m_pmtPid) )
+		{
+			m_pmt.assign((const char*)packet, 188);
+		}
 	}
-	return size;
 }
 
-std::string MemoryBufferSink::getBuffer(unsigned int slice)
+void MemoryBufferSink::inputFrame(const timeval & pts, bool keyFrame)
 {
-	std::string content;
-	std::map<unsigned int,std::string>::iterator it = m_outputBuffers.find(slice);
-	if (it != m_outputBuffers.end())
-	{
-		content = it->second;
+	m_keyFrameAligned = true;
+	m_keyFramePending |= keyFrame;
+	m_inputTime = pts;
+}
 
+unsigned int MemoryBufferSink::getBufferSize(unsigned int id)
+{
+	unsigned int size = 0;
+	SegmentStore::Handle segment = m_store.get(id);
+	if (segment != NULL)
+	{
+		size = segment->size();
 	}
-	return content;
+	return size;
 }
 
 unsigned int MemoryBufferSink::firstTime()
 {
 	unsigned int firstTime = 0;
-	if (m_outputBuffers.size() != 0)				
+	SegmentStore::Handle segment = m_store.front();
+	if (segment != NULL)
 	{
-		firstTime = m_outputBuffers.begin()->first;
+		firstTime = segment->start().tv_sec - m_refTime.tv_sec;
 	}
-	return firstTime*m_sliceDuration;
+	return firstTime;
 }
 
 unsigned int MemoryBufferSink::duration()
 {
 	unsigned int duration = 0;
-	if (m_outputBuffers.size() != 0)				
+	SegmentStore::Handle first = m_store.front();
+	if (first != NULL)
+	{
+		duration = m_store.back()->start().tv_sec - first->start().tv_sec;
+	}
+	return duration;
+}
+
+void MemoryBufferSink::addPartListener(AfterPartFunc* func, void* clientData)
+{
+	m_listeners.push_back(std::pair<AfterPartFunc*,void*>(func, clientData));
+}
+
+void MemoryBufferSink::removePartListener(void* clientData)
+{
+	std::list<std::pair<AfterPartFunc*,void*> >::iterator it = m_listeners.begin();
+	while (it != m_listeners.end())
 	{
-		duration = m_outputBuffers.rbegin()->first - m_outputBuffers.begin()->first;
+		if (it->second == clientData)
+		{
+			it = m_listeners.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void MemoryBufferSink::partCompleted()
+{
+	// listeners remove themselves when they are notified, skip the ones removed meanwhile
+	std::list<std::pair<AfterPartFunc*,void*> > listeners(m_listeners);
+	for (std::list<std::pair<AfterPartFunc*,void*> >::iterator it = listeners.begin(); it != listeners.end(); ++it)
+	{
+		if (std::find(m_listeners.begin(), m_listeners.end(), *it) != m_listeners.end())
+		{
+			it->first(it->second);
+		}
 	}
-	return (duration)*m_sliceDuration;
 }
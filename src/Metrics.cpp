@@ -0,0 +1,271 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** Metrics.cpp
+**
+** Lock-free counters exported in Prometheus text format
+**
+** -------------------------------------------------------------------------*/
+
+#include <sys/resource.h>
+
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+
+#include "Metrics.h"
+
+static double elapsed(const timeval & from, const timeval & to)
+{
+	return (to.tv_sec - from.tv_sec) + (to.tv_usec - from.tv_usec)/1000000.0;
+}
+
+static void family(std::ostream & os, const char* name, const char* type, const char* help)
+{
+	os << "# HELP rtspserver_" << name << " " << help << "\n";
+	os << "# TYPE rtspserver_" << name << " " << type << "\n";
+}
+
+// ---------------------------------
+// Counters of a capture source
+// ---------------------------------
+SourceMetrics::SourceMetrics(const std::string & name)
+	: m_name(name), m_framesIn(0), m_bytesIn(0), m_framesOut(0), m_bytesOut(0), m_drops(0), m_queueDepth(0), m_starvations(0), m_driverDrops(0), m_buffersInFlight(0), m_stalls(0), m_recoveries(0), m_recoveryUs(0), m_lastRecoveryUs(0), m_lastFramesIn(0)
+{
+	gettimeofday(&m_lastScrape, NULL);
+	Metrics::instance().add(this);
+}
+
+SourceMetrics::~SourceMetrics()
+{
+	Metrics::instance().remove(this);
+}
+
+const char* SourceMetrics::stageName(Stage stage)
+{
+	switch (stage)
+	{
+		case CAPTURE_WAIT: return "capture_wait";
+		case QUEUE:        return "queue";
+		case DELIVERY:     return "delivery";
+		case SEND:         return "send";
+		default:           return "unknown";
+	}
+}
+
+// ---------------------------------
+// Copies and allocations of the pipeline
+// ---------------------------------
+std::atomic<uint64_t> CopyMetrics::s_copies[CopyMetrics::NB_STAGES];
+std::atomic<uint64_t> CopyMetrics::s_copiedBytes[CopyMetrics::NB_STAGES];
+std::atomic<uint64_t> CopyMetrics::s_allocations[CopyMetrics::NB_STAGES];
+std::atomic<uint64_t> CopyMetrics::s_allocatedBytes[CopyMetrics::NB_STAGES];
+
+const char* CopyMetrics::stageName(Stage stage)
+{
+	switch (stage)
+	{
+		case CAPTURE:  return "capture";
+		case SPLIT:    return "split";
+		case DELIVERY: return "delivery";
+		case REPLICA:  return "replica";
+		case MARKER:   return "marker";
+		case JPEG:     return "jpeg";
+		case SEGMENT:  return "segment";
+		case FEED:     return "feed";
+		default:       return "unknown";
+	}
+}
+
+// ---------------------------------
+// Counters of an RTSP client
+// ---------------------------------
+ClientMetrics::ClientMetrics(unsigned int clientSessionId)
+	: m_clientSessionId(clientSessionId), m_frames(0), m_bytes(0), m_lastBytes(0)
+{
+	gettimeofday(&m_lastScrape, NULL);
+	Metrics::instance().add(this);
+}
+
+ClientMetrics::~ClientMetrics()
+{
+	Metrics::instance().remove(this);
+}
+
+// ---------------------------------
+// Registry of the counters
+// ---------------------------------
+Metrics& Metrics::instance()
+{
+	static Metrics metrics;
+	return metrics;
+}
+
+void Metrics::add(SourceMetrics* source)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_sources.push_back(source);
+}
+
+void Metrics::remove(SourceMetrics* source)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_sources.remove(source);
+}
+
+void Metrics::add(ClientMetrics* client)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_clients.push_back(client);
+}
+
+void Metrics::remove(ClientMetrics* client)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_clients.remove(client);
+}
+
+void Metrics::write(std::ostream & os, unsigned int rtspSessions)
+{
+	timeval now;
+	gettimeofday(&now, NULL);
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::list<SourceMetrics*>::iterator it;
+	std::list<ClientMetrics*>::iterator clientIt;
+
+	family(os, "capture_frames_total", "counter", "Frames captured from the device");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_capture_frames_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_framesIn.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "capture_bytes_total", "counter", "Bytes captured from the device");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_capture_bytes_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_bytesIn.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "capture_fps", "gauge", "Capture frame rate since the previous scrape");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		uint64_t frames = (*it)->m_framesIn.load(std::memory_order_relaxed);
+		double interval = elapsed((*it)->m_lastScrape, now);
+		double fps = (interval > 0) ? (frames - (*it)->m_lastFramesIn)/interval : 0;
+		os << "rtspserver_capture_fps{source=\"" << (*it)->m_name << "\"} " << std::fixed << std::setprecision(2) << fps << "\n";
+		(*it)->m_lastFramesIn = frames;
+		(*it)->m_lastScrape = now;
+	}
+	family(os, "delivered_frames_total", "counter", "Frames delivered to the consumers");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_delivered_frames_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_framesOut.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "delivered_bytes_total", "counter", "Bytes delivered to the consumers");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_delivered_bytes_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_bytesOut.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "dropped_frames_total", "counter", "Frames dropped because the queue was full");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_dropped_frames_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_drops.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "queue_depth", "gauge", "Frames waiting in the capture queue");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_queue_depth{source=\"" << (*it)->m_name << "\"} " << (*it)->m_queueDepth.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "buffer_starvation_total", "counter", "Captures done while all the driver buffers were held by frames in flight");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_buffer_starvation_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_starvations.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "driver_dropped_frames_total", "counter", "Frames lost by the driver (gaps in the V4L2 sequence)");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_driver_dropped_frames_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_driverDrops.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "buffers_in_flight", "gauge", "Driver buffers dequeued and not yet given back");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_buffers_in_flight{source=\"" << (*it)->m_name << "\"} " << (*it)->m_buffersInFlight.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "capture_stalls_total", "counter", "Capture stalls detected by the watchdog");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_capture_stalls_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_stalls.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "capture_recoveries_total", "counter", "Capture stalls recovered by restarting the pipeline or resetting the device");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_capture_recoveries_total{source=\"" << (*it)->m_name << "\"} " << (*it)->m_recoveries.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "capture_recovery_seconds_total", "counter", "Time from the last frame before a stall to the first frame after it");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_capture_recovery_seconds_total{source=\"" << (*it)->m_name << "\"} " << std::fixed << std::setprecision(3) << (*it)->m_recoveryUs.load(std::memory_order_relaxed)/1e6 << "\n";
+	}
+	family(os, "capture_last_recovery_seconds", "gauge", "Duration of the last stall recovery");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		os << "rtspserver_capture_last_recovery_seconds{source=\"" << (*it)->m_name << "\"} " << std::fixed << std::setprecision(3) << (*it)->m_lastRecoveryUs.load(std::memory_order_relaxed)/1e6 << "\n";
+	}
+
+	family(os, "stage_latency_seconds", "summary", "Latency of each stage of the frame pipeline");
+	const double quantiles[] = { 0.5, 0.99, 0.999 };
+	LatencyHistogram::Snapshot* snap = new LatencyHistogram::Snapshot();
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		for (int stage = 0; stage < SourceMetrics::NB_STAGES; ++stage) {
+			(*it)->snapshot((SourceMetrics::Stage)stage, *snap);
+			std::ostringstream labels;
+			labels << "source=\"" << (*it)->m_name << "\",stage=\"" << SourceMetrics::stageName((SourceMetrics::Stage)stage) << "\"";
+			os << std::fixed << std::setprecision(6);
+			for (unsigned int q = 0; q < sizeof(quantiles)/sizeof(quantiles[0]); ++q) {
+				os << "rtspserver_stage_latency_seconds{" << labels.str() << ",quantile=\"" << std::setprecision(3) << quantiles[q] << "\"} "
+				   << std::setprecision(6) << snap->percentile(quantiles[q])/1000000.0 << "\n";
+			}
+			os << "rtspserver_stage_latency_seconds_sum{" << labels.str() << "} " << snap->m_sum/1000000.0 << "\n";
+			os << "rtspserver_stage_latency_seconds_count{" << labels.str() << "} " << snap->m_count << "\n";
+		}
+	}
+	family(os, "stage_latency_max_seconds", "gauge", "Maximum latency of each stage of the frame pipeline");
+	for (it = m_sources.begin(); it != m_sources.end(); ++it) {
+		for (int stage = 0; stage < SourceMetrics::NB_STAGES; ++stage) {
+			(*it)->snapshot((SourceMetrics::Stage)stage, *snap);
+			os << "rtspserver_stage_latency_max_seconds{source=\"" << (*it)->m_name << "\",stage=\"" << SourceMetrics::stageName((SourceMetrics::Stage)stage) << "\"} "
+			   << std::fixed << std::setprecision(6) << snap->m_max/1000000.0 << "\n";
+		}
+	}
+	delete snap;
+
+	family(os, "copies_total", "counter", "memcpy of frame data done by a stage of the pipeline");
+	for (int stage = 0; stage < CopyMetrics::NB_STAGES; ++stage) {
+		os << "rtspserver_copies_total{stage=\"" << CopyMetrics::stageName((CopyMetrics::Stage)stage) << "\"} " << CopyMetrics::copies((CopyMetrics::Stage)stage) << "\n";
+	}
+	family(os, "copied_bytes_total", "counter", "Bytes of frame data copied by a stage of the pipeline");
+	for (int stage = 0; stage < CopyMetrics::NB_STAGES; ++stage) {
+		os << "rtspserver_copied_bytes_total{stage=\"" << CopyMetrics::stageName((CopyMetrics::Stage)stage) << "\"} " << CopyMetrics::copiedBytes((CopyMetrics::Stage)stage) << "\n";
+	}
+	family(os, "allocations_total", "counter", "Heap allocations done by a stage of the pipeline");
+	for (int stage = 0; stage < CopyMetrics::NB_STAGES; ++stage) {
+		os << "rtspserver_allocations_total{stage=\"" << CopyMetrics::stageName((CopyMetrics::Stage)stage) << "\"} " << CopyMetrics::allocations((CopyMetrics::Stage)stage) << "\n";
+	}
+	family(os, "allocated_bytes_total", "counter", "Bytes allocated on the heap by a stage of the pipeline");
+	for (int stage = 0; stage < CopyMetrics::NB_STAGES; ++stage) {
+		os << "rtspserver_allocated_bytes_total{stage=\"" << CopyMetrics::stageName((CopyMetrics::Stage)stage) << "\"} " << CopyMetrics::allocatedBytes((CopyMetrics::Stage)stage) << "\n";
+	}
+
+	family(os, "rtsp_sessions", "gauge", "Active RTSP sessions");
+	os << "rtspserver_rtsp_sessions " << rtspSessions << "\n";
+	family(os, "http_streams", "gauge", "Active HTTP (HLS/MPEG-DASH) streams");
+	os << "rtspserver_http_streams " << std::max(m_httpStreams.load(std::memory_order_relaxed), 0) << "\n";
+
+	family(os, "client_bytes_total", "counter", "Bytes sent to an RTSP client");
+	for (clientIt = m_clients.begin(); clientIt != m_clients.end(); ++clientIt) {
+		os << "rtspserver_client_bytes_total{client=\"" << std::hex << std::setw(8) << std::setfill('0') << (*clientIt)->m_clientSessionId << std::dec << "\"} " << (*clientIt)->m_bytes.load(std::memory_order_relaxed) << "\n";
+	}
+	family(os, "client_bitrate_bps", "gauge", "Bitrate sent to an RTSP client since the previous scrape");
+	for (clientIt = m_clients.begin(); clientIt != m_clients.end(); ++clientIt) {
+		uint64_t bytes = (*clientIt)->m_bytes.load(std::memory_order_relaxed);
+		double interval = elapsed((*clientIt)->m_lastScrape, now);
+		double bitrate = (interval > 0) ? (bytes - (*clientIt)->m_lastBytes)*8/interval : 0;
+		os << "rtspserver_client_bitrate_bps{client=\"" << std::hex << std::setw(8) << std::setfill('0') << (*clientIt)->m_clientSessionId << std::dec << "\"} " << std::fixed << std::setprecision(0) << bitrate << "\n";
+		(*clientIt)->m_lastBytes = bytes;
+		(*clientIt)->m_lastScrape = now;
+	}
+
+	// scrape is served by the live555 thread, its cpu time is the event loop busy time
+	struct rusage usage;
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		family(os, "eventloop_busy_seconds_total", "counter", "CPU time consumed by the live555 event loop");
+		os << "rtspserver_eventloop_busy_seconds_total " << std::fixed << std::setprecision(6)
+		   << (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec)/1000000.0) << "\n";
+	}
+}
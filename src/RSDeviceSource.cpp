@@ -25,47 +25,56 @@
 
 // project
 #include "logger.h"
+#include "AsyncLogger.h"
 #include "RSDeviceSource.h"
 
-// ---------------------------------
-// RealSense FramedSource Stats
-// ---------------------------------
-int  RSDeviceSource::Stats::notify(int tv_sec, int framesize)
-{
-	m_fps++;
-	m_size += framesize;
-	if (tv_sec != m_fps_sec)
-	{
-		LOG(INFO) << m_msg  << "tv_sec:" <<   tv_sec << " fps:" << m_fps << " bandwidth:"<< (m_size/128) << "kbps" << std::endl;		
-		m_fps_sec = tv_sec;
-		m_fps = 0;
-		m_size = 0;
-	}
-	return m_fps;
-}
-
 // ---------------------------------
 // RealSense FramedSource
 // ---------------------------------
-RSDeviceSource* RSDeviceSource::createNew(UsageEnvironment& env, pipeline pipe, unsigned int queueSize) 
+RSDeviceSource* RSDeviceSource::createNew(UsageEnvironment& env, pipeline pipe, const config & cfg, unsigned int queueSize, bool useCallback, unsigned int sdkQueueSize, bool keepWarm, unsigned int idleTimeout, unsigned int stallTimeout) 
 { 	
-	return (new RSDeviceSource(env, pipe, queueSize));
+	RSDeviceSource* source = new RSDeviceSource(env, pipe, cfg, queueSize, useCallback, sdkQueueSize, keepWarm, idleTimeout, stallTimeout);
+	if (keepWarm && !source->run(true)) {
+		Medium::close(source);
+		source = NULL;
+	}
+	return source;
 }
 
 // Constructor
-RSDeviceSource::RSDeviceSource(UsageEnvironment& env, pipeline pipe, unsigned int queueSize) 
+RSDeviceSource::RSDeviceSource(UsageEnvironment& env, pipeline pipe, const config & cfg, unsigned int queueSize, bool useCallback, unsigned int sdkQueueSize, bool keepWarm, unsigned int idleTimeout, unsigned int stallTimeout) 
 	: FramedSource(env), 
-	m_in("in"), 
-	m_out("out") , 
+	m_metrics("depth"),
+	m_frameId(0),
 	m_pipe(pipe),
-	m_queueSize(queueSize)
+	m_config(cfg),
+	m_queueSize(queueSize),
+	m_useCallback(useCallback),
+	m_sdkQueueSize(sdkQueueSize),
+	m_keepWarm(keepWarm),
+	m_idleTimeout(idleTimeout),
+	m_idleTask(NULL),
+	m_stallTimeout(stallTimeout),
+	m_watchdogTask(NULL),
+	m_lastFrame(0),
+	m_recoveryStart(0),
+	m_recoveryAttempts(0),
+	m_running(false),
+	m_started(false),
+	m_stop(false),
+	m_workerRunning(false),
+	m_workerStop(false),
+	m_workerReset(false),
+	m_workerRecover(false),
+	m_workerResult(false)
 {
 	m_eventTriggerId = envir().taskScheduler().createEventTrigger(RSDeviceSource::deliverFrameStub);
+	m_workerTriggerId = envir().taskScheduler().createEventTrigger(RSDeviceSource::workerDoneStub);
 	memset(&m_thid, 0, sizeof(m_thid));
+	memset(&m_workerThid, 0, sizeof(m_workerThid));
 	memset(&m_mutex, 0, sizeof(m_mutex));
 
 	pthread_mutex_init(&m_mutex, NULL);
-	pthread_create(&m_thid, NULL, threadStub, this);	
 
 	m_fd = open("/tmp/stream.raw", O_WRONLY | O_CREAT);
 	if (m_fd == -1) {
@@ -77,8 +86,10 @@ RSDeviceSource::RSDeviceSource(UsageEnvironment& env, pipeline pipe, unsigned in
 // Destructor
 RSDeviceSource::~RSDeviceSource()
 {	
+	envir().taskScheduler().unscheduleDelayedTask(m_idleTask);
+	this->halt();
 	envir().taskScheduler().deleteEventTrigger(m_eventTriggerId);
-	pthread_join(m_thid, NULL);	
+	envir().taskScheduler().deleteEventTrigger(m_workerTriggerId);
 	pthread_mutex_destroy(&m_mutex);
 
 	if (m_fd > 0) {
@@ -86,50 +97,354 @@ RSDeviceSource::~RSDeviceSource()
 	}
 }
 
+// start the capture for the consumers, in the calling thread or in a worker thread
+bool RSDeviceSource::run(bool wait)
+{
+	if (!m_running) {
+		if (!wait) {
+			this->startWorker(false, false);
+		} else if (!this->start()) {
+			return false;
+		}
+		m_running = true;
+		m_recoveryAttempts = 0;
+		if (m_stallTimeout > 0) {
+			m_watchdogTask = envir().taskScheduler().scheduleDelayedTask(m_stallTimeout*250LL, watchdogStub, this);
+		}
+	}
+	return true;
+}
+
+// stop the capture, no more consumer
+void RSDeviceSource::halt()
+{
+	m_running = false;
+	envir().taskScheduler().unscheduleDelayedTask(m_watchdogTask);
+	this->joinWorker();
+	this->stop();
+	this->flush();
+}
+
+// start the pipeline, frames are delivered by the SDK callback or read by the capture thread
+bool RSDeviceSource::start()
+{
+	if (m_started) {
+		return true;
+	}
+	// frames captured before the previous stop are too old to be sent
+	this->flush();
+	if (!this->openPipeline()) {
+		return false;
+	}
+	this->started();
+	return true;
+}
+
+// start the SDK pipeline, blocks until the device streams and may be called from any thread
+bool RSDeviceSource::openPipeline()
+{
+	uint64_t startTime = LatencyHistogram::now();
+	try {
+		// the queue size of the sensors is only used by the streams opened after it is set
+		if (m_sdkQueueSize > 0) {
+			std::vector<sensor> sensors = m_config.resolve(m_pipe).get_device().query_sensors();
+			for (std::vector<sensor>::iterator it = sensors.begin(); it != sensors.end(); ++it) {
+				if (it->supports(RS2_OPTION_FRAMES_QUEUE_SIZE)) {
+					it->set_option(RS2_OPTION_FRAMES_QUEUE_SIZE, m_sdkQueueSize);
+				}
+			}
+		}
+		pipeline_profile profile;
+		if (m_useCallback) {
+			profile = m_pipe.start(m_config, [this](const frame & f) { this->callback(f); });
+		} else {
+			profile = m_pipe.start(m_config);
+		}
+		m_device = profile.get_device();
+	} catch (const error & e) {
+		LOG(ERROR) << "Cannot start RS pipeline: " << e.what() << std::endl;
+		return false;
+	}
+	LOG(NOTICE) << "RS pipeline started " << (m_useCallback ? "callback" : "thread") << " sdkQueueSize:" << m_sdkQueueSize << " in " << (LatencyHistogram::now() - startTime)/1000 << "ms" << std::endl;
+	return true;
+}
+
+// the pipeline streams, start reading it
+void RSDeviceSource::started()
+{
+	m_lastFrame = LatencyHistogram::now();
+	if (!m_useCallback) {
+		m_stop = false;
+		pthread_create(&m_thid, NULL, threadStub, this);	
+	}
+	m_started = true;
+}
+
+// start or restart the pipeline in a worker thread, so the live555 thread doesn't wait for the device
+void RSDeviceSource::startWorker(bool recover, bool reset)
+{
+	if ( m_workerRunning || (m_started && !recover) ) {
+		return;
+	}
+	this->flush();
+	// the worker owns the pipeline until it is done
+	m_workerStop = m_started;
+	m_workerReset = reset;
+	m_workerRecover = recover;
+	m_started = false;
+	m_workerRunning = true;
+	pthread_create(&m_workerThid, NULL, workerStub, this);
+}
+
+// worker thread
+void* RSDeviceSource::worker()
+{
+	Tracer::setThreadName("rs_control");
+	if (m_workerStop) {
+		this->closePipeline();
+	}
+	if (m_workerReset) {
+		try {
+			m_device.hardware_reset();
+		} catch (const error & e) {
+			LOG(ERROR) << "Cannot reset device: " << e.what() << std::endl;
+		}
+	}
+	m_workerResult = this->openPipeline();
+	envir().taskScheduler().triggerEvent(m_workerTriggerId, this);
+	return NULL;
+}
+
+// wait for the worker, true if it started the pipeline
+bool RSDeviceSource::joinWorker()
+{
+	if (!m_workerRunning) {
+		return false;
+	}
+	pthread_join(m_workerThid, NULL);
+	m_workerRunning = false;
+	if (m_workerResult) {
+		this->started();
+	}
+	return m_workerResult;
+}
+
+// worker done, in the live555 thread
+void RSDeviceSource::workerDone()
+{
+	if (!m_workerRunning) {
+		// already joined by halt
+		return;
+	}
+	if (this->joinWorker()) {
+		this->deliverFrame();
+	} else if (m_running && !m_workerRecover) {
+		// same as a synchronous start failure, the consumers are closed, the watchdog retries a failed restart
+		m_running = false;
+		envir().taskScheduler().unscheduleDelayedTask(m_watchdogTask);
+		if (isCurrentlyAwaitingData()) {
+			handleClosure();
+		}
+	}
+}
+
+// stop the capture, when it returns no more frame will be queued
+void RSDeviceSource::stop()
+{
+	if (!m_started) {
+		return;
+	}
+	this->closePipeline();
+	m_started = false;
+}
+
+// stop the capture thread and the SDK pipeline, may be called from any thread
+void RSDeviceSource::closePipeline()
+{
+	if (!m_useCallback) {
+		m_stop = true;
+		pthread_join(m_thid, NULL);	
+	}
+	try {
+		// wait for the running callback
+		m_pipe.stop();
+	} catch (const error & e) {
+		LOG(ERROR) << "Cannot stop RS pipeline: " << e.what() << std::endl;
+	}
+	LOG(NOTICE) << "RS pipeline stopped" << std::endl;
+}
+
+// drop the queued frames
+void RSDeviceSource::flush()
+{
+	pthread_mutex_lock (&m_mutex);
+	while (!m_captureQueue.empty()) {
+		delete m_captureQueue.front();
+		m_captureQueue.pop_front();
+	}
+	m_metrics.queueDepth(0);
+	pthread_mutex_unlock (&m_mutex);
+}
+
+// no consumer since the idle timeout
+void RSDeviceSource::idle()
+{
+	m_idleTask = NULL;
+	LOG(NOTICE) << "No client since " << m_idleTimeout << "s, stop capture" << std::endl;
+	this->halt();
+}
+
+// check that frames are still coming
+void RSDeviceSource::watchdog()
+{
+	m_watchdogTask = NULL;
+	if (m_workerRunning) {
+		// still starting or restarting
+		m_watchdogTask = envir().taskScheduler().scheduleDelayedTask(m_stallTimeout*250LL, watchdogStub, this);
+		return;
+	}
+	uint64_t silence = LatencyHistogram::now() - m_lastFrame.load(std::memory_order_relaxed);
+	if ( !m_started || (silence > m_stallTimeout*1000ULL) ) {
+		if (m_recoveryStart.load(std::memory_order_relaxed) == 0) {
+			LOG(WARN) << "No frame since " << silence/1000 << "ms, restart RS pipeline" << std::endl;
+			m_metrics.stalled();
+			m_recoveryStart = LatencyHistogram::now() - silence;
+		}
+		this->recover();
+	} else if (m_recoveryStart.load(std::memory_order_relaxed) == 0) {
+		m_recoveryAttempts = 0;
+	}
+	m_watchdogTask = envir().taskScheduler().scheduleDelayedTask(m_stallTimeout*250LL, watchdogStub, this);
+}
+
+// restart the pipeline in a worker thread, reset the device if restarting is not enough
+void RSDeviceSource::recover()
+{
+	bool reset = (m_recoveryAttempts >= 2) && ((m_recoveryAttempts-2) % 10 == 0);
+	if (reset) {
+		LOG(WARN) << "RS pipeline still stalled after " << m_recoveryAttempts << " restarts, reset device" << std::endl;
+	}
+	m_recoveryAttempts++;
+	this->startWorker(true, reset);
+}
+
+// pause a playback device, the watchdog should restart it
+void RSDeviceSource::simulateStall()
+{
+	if (m_started) {
+		try {
+			playback(m_device).pause();
+			LOG(NOTICE) << "Playback paused to simulate a stall" << std::endl;
+		} catch (const error & e) {
+			LOG(ERROR) << "Cannot simulate a stall: " << e.what() << std::endl;
+		}
+	}
+}
+
+// SDK callback
+void RSDeviceSource::callback(const frame & f)
+{
+	static thread_local bool named = false;
+	if (!named) {
+		Tracer::setThreadName("capture");
+		named = true;
+	}
+	depth_frame depth = f.is<frameset>() ? f.as<frameset>().get_depth_frame() : f.as<depth_frame>();
+	if (depth) {
+		this->queueFrame(depth, ++m_frameId);
+	}
+}
+
 // thread mainloop
 void* RSDeviceSource::thread()
 {
-	int stop = 0;
-	timeval tv;
-	
 	LOG(NOTICE) << "begin thread" << std::endl; 
-	while (!stop) {
-		unsigned int frameSize = getWidth() * getHeight() * (getBPP() / 8);
+	Tracer::setThreadName("capture");
+	while (!m_stop) {
+		uint64_t frameId = m_frameId + 1;
 		// Wait for next set of frames from the camera
-		frameset fs = m_pipe.wait_for_frames(); 
-
-		gettimeofday(&tv, NULL);												
-		m_in.notify(tv.tv_sec, frameSize);
-		char* buf = new char[frameSize];
-		const void * frameBuf = fs.get_depth_frame().get_data();
-		if (frameBuf) {
-			LOG(DEBUG) << "frame arrived\ttimestamp:" << tv.tv_sec << "." << tv.tv_usec << "\tsize:" << frameSize << std::endl;
-			memcpy(buf, frameBuf, frameSize);
-		} else {
-			LOG(DEBUG) << "frame arrived\ttimestamp:" << tv.tv_sec << "." << tv.tv_usec << "\tN/A" << std::endl;
+		TRACE_BEGIN("wait_for_frames", frameId);
+		uint64_t waitStart = LatencyHistogram::now();
+		frameset fs;
+		bool received = false;
+		try {
+			received = m_pipe.try_wait_for_frames(&fs, 100); 
+		} catch (const error & e) {
+			// the watchdog restarts the pipeline
+			LOG(ERROR) << "wait for frames: " << e.what() << std::endl;
+			usleep(100000);
 		}
-
-		pthread_mutex_lock (&m_mutex);
-		while (m_captureQueue.size() >= m_queueSize) {
-			LOG(DEBUG) << "Queue full size drop frame size:"  << (int)m_captureQueue.size() << std::endl;
-			delete m_captureQueue.front();
-			m_captureQueue.pop_front();
+		m_metrics.latency(SourceMetrics::CAPTURE_WAIT, LatencyHistogram::now() - waitStart);
+		TRACE_END("wait_for_frames", frameId);
+		if (received) {
+			m_frameId = frameId;
+			this->queueFrame(fs.get_depth_frame(), frameId);
 		}
-		m_captureQueue.push_back(new Frame(buf, frameSize, tv));	
-		pthread_mutex_unlock (&m_mutex);
-		
-		// post an event to ask to deliver the frame 
-		// AP: why do we need it if the sink is asking by itself?
-		envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
 	}
 	LOG(NOTICE) << "end thread" << std::endl; 
 	return NULL;
 }
 
+// copy the SDK frame and post it to the fifo
+void RSDeviceSource::queueFrame(const frame & f, uint64_t frameId)
+{
+	timeval tv;
+	unsigned int frameSize = getWidth() * getHeight() * (getBPP() / 8);
+
+	uint64_t now = LatencyHistogram::now();
+	m_lastFrame.store(now, std::memory_order_relaxed);
+	if (m_recoveryStart.load(std::memory_order_relaxed) != 0) {
+		uint64_t recoveryStart = m_recoveryStart.exchange(0);
+		if (recoveryStart != 0) {
+			m_metrics.recovered(now - recoveryStart);
+			LOG(NOTICE) << "RS pipeline recovered in " << (now - recoveryStart)/1000 << "ms" << std::endl;
+		}
+	}
+
+	gettimeofday(&tv, NULL);												
+	m_metrics.captured(frameSize);
+	TRACE_BEGIN("capture_copy", frameId);
+	char* buf = new char[frameSize];
+	CopyMetrics::allocated(CopyMetrics::CAPTURE, frameSize);
+	const void * frameBuf = f.get_data();
+	if (frameBuf) {
+		ALOG(DEBUG) << "frame arrived\ttimestamp:" << tv.tv_sec << "." << tv.tv_usec << "\tsize:" << frameSize << std::endl;
+		memcpy(buf, frameBuf, frameSize);
+		CopyMetrics::copied(CopyMetrics::CAPTURE, frameSize);
+	} else {
+		ALOG(DEBUG) << "frame arrived\ttimestamp:" << tv.tv_sec << "." << tv.tv_usec << "\tN/A" << std::endl;
+	}
+	TRACE_END("capture_copy", frameId);
+
+	TRACE_BEGIN("enqueue", frameId);
+	pthread_mutex_lock (&m_mutex);
+	while (m_captureQueue.size() >= m_queueSize) {
+		ALOG(DEBUG) << "Queue full size drop frame size:"  << (int)m_captureQueue.size() << std::endl;
+		delete m_captureQueue.front();
+		m_captureQueue.pop_front();
+		m_metrics.dropped();
+	}
+	m_captureQueue.push_back(new Frame(buf, frameSize, tv, frameId));	
+	CopyMetrics::allocated(CopyMetrics::CAPTURE, sizeof(Frame));
+	CopyMetrics::allocated(CopyMetrics::CAPTURE, sizeof(Frame*) + 2*sizeof(void*)); // list node
+	m_metrics.queueDepth(m_captureQueue.size());
+	pthread_mutex_unlock (&m_mutex);
+	TRACE_END("enqueue", frameId);
+	
+	// post an event to ask to deliver the frame 
+	envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+}
+
 // getting FrameSource callback
 void RSDeviceSource::doGetNextFrame()
 {
-	LOG(DEBUG) << "RSDeviceSource::doGetNextFrame" << std::endl;	
+	ALOG(DEBUG) << "RSDeviceSource::doGetNextFrame" << std::endl;	
+	// a consumer is back before the idle timeout
+	if (m_idleTask != NULL) {
+		envir().taskScheduler().unscheduleDelayedTask(m_idleTask);
+	}
+	// until the pipeline is started by the worker, the frames are waited for
+	this->run(false);
 	deliverFrame();
 }
 
@@ -138,27 +453,42 @@ void RSDeviceSource::doStopGettingFrames()
 {
 	LOG(DEBUG) << "RSDeviceSource::doStopGettingFrames" << std::endl;	
 	FramedSource::doStopGettingFrames();
+	// the replicator stops its input when the last consumer is gone
+	if (!m_keepWarm && m_running && (m_idleTask == NULL)) {
+		m_idleTask = envir().taskScheduler().scheduleDelayedTask(m_idleTimeout*1000000LL, idleStub, this);
+	}
 }
 
 // deliver frame to the sink
 void RSDeviceSource::deliverFrame()
 {			
-	LOG(DEBUG) << "RSDeviceSource::deliverFrame -> " << std::endl;	
+	ALOG(DEBUG) << "RSDeviceSource::deliverFrame -> " << std::endl;	
 	if (isCurrentlyAwaitingData()) {
-		LOG(DEBUG) << "sink is asking" << std::endl;	
+		ALOG(DEBUG) << "sink is asking" << std::endl;	
 		fDurationInMicroseconds = 0;
 		fFrameSize = 0;
+		uint64_t frameId = 0;
 		
+		// the span includes the wait for the mutex and is tagged with the frame it dequeues
+		bool tracing = Tracer::enabled();
+		uint64_t dequeueStart = tracing ? Tracer::now() : 0;
 		pthread_mutex_lock (&m_mutex);
+		if (!m_captureQueue.empty()) {
+			frameId = m_captureQueue.front()->m_id;
+		}
+		if (tracing) {
+			Tracer::begin("dequeue", frameId, dequeueStart);
+		}
 		if (m_captureQueue.empty()) {
-			LOG(DEBUG) << "Queue is empty" << std::endl;		
+			ALOG(DEBUG) << "Queue is empty" << std::endl;		
 		} else {				
 			timeval curTime;
 			gettimeofday(&curTime, NULL);			
 			Frame * frame = m_captureQueue.front();
 			m_captureQueue.pop_front();
+			frameId = frame->m_id;
 	
-			m_out.notify(curTime.tv_sec, frame->m_size);
+			m_metrics.queueDepth(m_captureQueue.size());
 			if (frame->m_size > fMaxSize) {
 				fFrameSize = fMaxSize;
 				fNumTruncatedBytes = frame->m_size - fMaxSize;
@@ -167,8 +497,11 @@ void RSDeviceSource::deliverFrame()
 			}
 			timeval diff;
 			timersub(&curTime, &(frame->m_timestamp),&diff);
+			if (diff.tv_sec >= 0) {
+				m_metrics.latency(SourceMetrics::QUEUE, diff.tv_sec*1000000ULL + diff.tv_usec);
+			}
 
-			LOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec  << "." << curTime.tv_usec << 
+			ALOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec  << "." << curTime.tv_usec << 
 			                          "\tsize:" << fFrameSize <<
 									  "\tdiff:" <<  (diff.tv_sec*1000+diff.tv_usec/1000) << "ms" << 
 									  "\tqueue:" << m_captureQueue.size() <<
@@ -177,19 +510,32 @@ void RSDeviceSource::deliverFrame()
 									  "\tfFrameSize: " << fFrameSize << std::endl;
 			
 			fPresentationTime = frame->m_timestamp;
+			TRACE_BEGIN("delivery_copy", frameId);
+			uint64_t copyStart = LatencyHistogram::now();
 			memcpy(fTo, frame->m_buffer, fFrameSize);
+			CopyMetrics::copied(CopyMetrics::DELIVERY, fFrameSize);
+			m_metrics.latency(SourceMetrics::DELIVERY, LatencyHistogram::now() - copyStart);
+			TRACE_END("delivery_copy", frameId);
+			m_metrics.delivered(fFrameSize);
 			delete frame;
 
 			write(m_fd, fTo, fFrameSize);
 		}
 		pthread_mutex_unlock (&m_mutex);
+		if (tracing) {
+			Tracer::end("dequeue", frameId);
+		}
 		
 		if (fFrameSize > 0)	{
 			// send Frame to the consumer
+			TraceScope trace("send", frameId);
+			Tracer::setCurrentFrame(frameId);
+			uint64_t sendStart = LatencyHistogram::now();
 			FramedSource::afterGetting(this);			
+			m_metrics.latency(SourceMetrics::SEND, LatencyHistogram::now() - sendStart);
 		}
 	} else {
-		LOG(DEBUG) << "sink wasn't asking" << std::endl;	
+		ALOG(DEBUG) << "sink wasn't asking" << std::endl;	
 	}
 }
 	
@@ -0,0 +1,74 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SegmentServerMediaSubsession.cpp
+** 
+** -------------------------------------------------------------------------*/
+
+#include "logger.h"
+#include "SegmentServerMediaSubsession.h"
+#include "AddH26xMarkerFilter.h"
+#include "KeyFrameFilter.h"
+#include "CMAFMuxer.h"
+
+SegmentServerMediaSubsession::SegmentServerMediaSubsession(UsageEnvironment& env, StreamReplicator* replicator, const std::string& format, const std::string& container, unsigned int sliceDuration, unsigned int retention, size_t maxBytes, unsigned int partDuration) 
+		: UnicastServerMediaSubsession(env, replicator, (container == "ts") ? "video/MP2T" : "video/MP4"), m_slice(NULL), m_cmaf(NULL)
+{
+	m_slice = MemoryBufferSink::createNew(env, OutPacketBuffer::maxSize, sliceDuration, retention, maxBytes, partDuration);
+
+	// Create a source
+	FramedSource* source = replicator->createStreamReplica();			
+	FramedSource* videoSource = createSource(env, source, format, replicator->inputSource());
+	
+	// Start Playing the Sink, the segments start with the keyframes
+	if ( (format != "video/H264") && (format != "video/H265") ) {
+		LOG(WARN) << "format not supported for HLS:" << format;
+	} else if (container == "ts") {
+		MPEG2TransportStreamFromESSource* muxer = MPEG2TransportStreamFromESSource::createNew(env);
+		muxer->addNewVideoSource(new AddH26xMarkerFilter(env, new KeyFrameFilter(env, videoSource, format, m_slice)), (format == "video/H264") ? 5 : 6);
+		m_slice->startPlaying(*muxer, NULL, NULL);
+	} else {
+		m_cmaf = CMAFMuxer::createNew(env, videoSource, format, m_slice);
+		m_slice->startPlaying(*m_cmaf, NULL, NULL);
+	}
+}
+
+SegmentServerMediaSubsession::~SegmentServerMediaSubsession()
+{
+	Medium::close(m_slice);
+}
+
+float SegmentServerMediaSubsession::getCurrentNPT(void* streamToken)
+{
+	return (m_slice->firstTime());
+}
+
+float SegmentServerMediaSubsession::duration() const
+{
+	return (m_slice->duration());
+}
+
+SegmentStore::Handle SegmentServerMediaSubsession::getSegment(unsigned int id)
+{
+	return m_slice->getSegment(id);
+}
+
+std::shared_ptr<const std::string> SegmentServerMediaSubsession::getInitSegment()
+{
+	std::shared_ptr<const std::string> init;
+	if (m_cmaf != NULL) {
+		init = m_cmaf->getInitSegment();
+	}
+	return init;
+}
+
+std::string SegmentServerMediaSubsession::getCodecs()
+{
+	std::string codecs;
+	if (m_cmaf != NULL) {
+		codecs = m_cmaf->getCodecs();
+	}
+	return codecs;
+}
@@ -0,0 +1,203 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SegmentStore.cpp
+**
+** Store of the HTTP streaming segments in fixed size chunks
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "SegmentStore.h"
+#include "Metrics.h"
+
+// -----------------------------------------
+//    ChunkPool
+// -----------------------------------------
+SegmentStore::ChunkPool::ChunkPool(size_t chunkSize, size_t nbChunks) : m_chunkSize(chunkSize), m_memory(chunkSize*nbChunks)
+{
+	for (size_t i = 0; i < nbChunks; ++i) {
+		m_free.push_back(&m_memory[i*chunkSize]);
+	}
+	CopyMetrics::allocated(CopyMetrics::SEGMENT, m_memory.size());
+}
+
+// oldest released chunk first, like a ring
+char* SegmentStore::ChunkPool::get()
+{
+	char* chunk = NULL;
+	if (!m_free.empty()) {
+		chunk = m_free.front();
+		m_free.pop_front();
+	}
+	return chunk;
+}
+
+// -----------------------------------------
+//    Segment
+// -----------------------------------------
+SegmentStore::Segment::Segment(const std::shared_ptr<ChunkPool> & pool, unsigned int id, const timeval & start)
+	: m_pool(pool), m_id(id), m_start(start), m_end(start), m_complete(false), m_size(0), m_partOffset(0), m_partStart(start)
+{
+}
+
+SegmentStore::Segment::~Segment()
+{
+	for (size_t i = 0; i < m_chunks.size(); ++i) {
+		m_pool->release(m_chunks[i]);
+	}
+}
+
+size_t SegmentStore::Segment::pieces(std::vector<Piece> & pieces, size_t offset, size_t size) const
+{
+	size_t chunkSize = m_pool->chunkSize();
+	if (offset > m_size) {
+		offset = m_size;
+	}
+	size = std::min(size, m_size - offset);
+	size_t remaining = size;
+	for (size_t i = offset/chunkSize; (i < m_chunks.size()) && (remaining > 0); ++i) {
+		size_t chunkOffset = (i == offset/chunkSize) ? offset%chunkSize : 0;
+		Piece piece;
+		piece.m_data = m_chunks[i] + chunkOffset;
+		piece.m_size = std::min(remaining, chunkSize - chunkOffset);
+		pieces.push_back(piece);
+		remaining -= piece.m_size;
+	}
+	return size;
+}
+
+// -----------------------------------------
+//    SegmentStore
+// -----------------------------------------
+SegmentStore::SegmentStore(size_t chunkSize, size_t maxBytes, unsigned int maxDuration)
+	: m_pool(new ChunkPool(chunkSize, std::max(maxBytes/chunkSize, (size_t)2))), m_maxDuration(maxDuration), m_droppedBytes(0), m_generation(0)
+{
+}
+
+void SegmentStore::begin(unsigned int id, const timeval & start)
+{
+	if (!m_segments.empty()) {
+		this->closePart(start);
+		m_segments.back()->m_end = start;
+		m_segments.back()->m_complete = true;
+	}
+	m_segments.push_back(std::shared_ptr<Segment>(new Segment(m_pool, id, start)));
+	m_generation++;
+
+	// retention
+	while ( (m_segments.size() > 1) && (start.tv_sec - m_segments.front()->m_start.tv_sec > (time_t)m_maxDuration) ) {
+		m_segments.pop_front();
+	}
+}
+
+// the data is appended whole or not at all, so the segment always ends on a frame boundary
+bool SegmentStore::append(const char* data, size_t size, const timeval & pts)
+{
+	if (m_segments.empty()) {
+		m_droppedBytes += size;
+		return false;
+	}
+	Segment & segment = *m_segments.back();
+	size_t chunkSize = m_pool->chunkSize();
+	size_t initialSize = segment.m_size;
+	size_t initialChunks = segment.m_chunks.size();
+	while (size > 0) {
+		size_t offset = segment.m_size % chunkSize;
+		if ( (offset == 0) && (segment.m_size == segment.m_chunks.size()*chunkSize) ) {
+			char* chunk = m_pool->get();
+			while ( (chunk == NULL) && this->evictOldest() ) {
+				chunk = m_pool->get();
+			}
+			if (chunk == NULL) {
+				// roll back to the end of the previous frame, a keyframe marked for this one is forgotten
+				LOG(DEBUG) << "Segment store full, drop " << size + segment.m_size - initialSize << " bytes of segment:" << segment.m_id;
+				m_droppedBytes += size + segment.m_size - initialSize;
+				while (segment.m_chunks.size() > initialChunks) {
+					m_pool->release(segment.m_chunks.back());
+					segment.m_chunks.pop_back();
+				}
+				segment.m_size = initialSize;
+				while ( !segment.m_keyFrames.empty() && (segment.m_keyFrames.back().m_offset >= segment.m_size) ) {
+					segment.m_keyFrames.pop_back();
+				}
+				return false;
+			}
+			segment.m_chunks.push_back(chunk);
+		}
+		size_t length = std::min(size, chunkSize - offset);
+		memcpy(segment.m_chunks.back() + offset, data, length);
+		CopyMetrics::copied(CopyMetrics::SEGMENT, length);
+		segment.m_size += length;
+		data += length;
+		size -= length;
+	}
+	segment.m_end = pts;
+	return true;
+}
+
+bool SegmentStore::closePart(const timeval & end)
+{
+	if (m_segments.empty()) {
+		return false;
+	}
+	Segment & segment = *m_segments.back();
+	if (segment.m_size == segment.m_partOffset) {
+		return false;
+	}
+	Segment::Part part;
+	part.m_offset = segment.m_partOffset;
+	part.m_size = segment.m_size - segment.m_partOffset;
+	part.m_start = segment.m_partStart;
+	part.m_end = end;
+	part.m_independent = false;
+	for (size_t i = 0; i < segment.m_keyFrames.size(); ++i) {
+		part.m_independent |= (segment.m_keyFrames[i].m_offset == part.m_offset);
+	}
+	segment.m_parts.push_back(part);
+	segment.m_partOffset = segment.m_size;
+	segment.m_partStart = end;
+	m_generation++;
+	return true;
+}
+
+void SegmentStore::keyFrame(const timeval & time)
+{
+	if (!m_segments.empty()) {
+		Segment & segment = *m_segments.back();
+		Segment::KeyFrame keyFrame;
+		keyFrame.m_offset = segment.m_size;
+		keyFrame.m_time = time;
+		segment.m_keyFrames.push_back(keyFrame);
+	}
+}
+
+// remove the oldest segment, its chunks come back when no connection use it
+bool SegmentStore::evictOldest()
+{
+	bool evicted = false;
+	if (m_segments.size() > 1) {
+		m_segments.pop_front();
+		m_generation++;
+		evicted = true;
+	}
+	return evicted;
+}
+
+SegmentStore::Handle SegmentStore::get(unsigned int id) const
+{
+	Handle segment;
+	for (std::deque<std::shared_ptr<Segment> >::const_iterator it = m_segments.begin(); it != m_segments.end(); ++it) {
+		if ((*it)->m_id == id) {
+			segment = *it;
+			break;
+		}
+	}
+	return segment;
+}
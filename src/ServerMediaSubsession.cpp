@@ -14,12 +14,57 @@
 #include "ServerMediaSubsession.h"
 #include "MJPEGVideoSource.h"
 #include "RSDeviceSource.h"
+#include "DeviceSource.h"
 
 // ---------------------------------
 //   BaseServerMediaSubsession
 // ---------------------------------
-FramedSource* BaseServerMediaSubsession::createSource(UsageEnvironment& env, FramedSource* videoES, const std::string& format) {
-	return videoES;
+bool BaseServerMediaSubsession::getSourceInfo(FramedSource* source, int& width, int& height, std::string& auxLine)
+{
+	bool found = true;
+	if (RSDeviceSource* rsSource = dynamic_cast<RSDeviceSource*>(source)) {
+		width = rsSource->getWidth();
+		height = rsSource->getHeight();
+		auxLine = rsSource->getAuxLine();
+	} else if (V4L2DeviceSource* v4l2Source = dynamic_cast<V4L2DeviceSource*>(source)) {
+		width = v4l2Source->getWidth();
+		height = v4l2Source->getHeight();
+		auxLine = v4l2Source->getAuxLine();
+	} else {
+		found = false;
+	}
+	return found;
+}
+
+std::string BaseServerMediaSubsession::getFormat(int captureFormat) 
+{
+	std::string rtpFormat;
+	switch (captureFormat) {
+		case V4L2_PIX_FMT_H264: rtpFormat = "video/H264"; break;
+#ifdef V4L2_PIX_FMT_HEVC
+		case V4L2_PIX_FMT_HEVC: rtpFormat = "video/H265"; break;
+#endif
+		case V4L2_PIX_FMT_MJPEG: 
+		case V4L2_PIX_FMT_JPEG: rtpFormat = "video/JPEG"; break;
+		case V4L2_PIX_FMT_YUYV: rtpFormat = "video/RAW"; break;
+		default: break;
+	}
+	return rtpFormat;
+}
+
+FramedSource* BaseServerMediaSubsession::createSource(UsageEnvironment& env, FramedSource* videoES, const std::string& format, FramedSource* captureSource) 
+{
+	FramedSource* source = NULL;
+	if (format == "video/H264") {
+		source = H264VideoStreamDiscreteFramer::createNew(env, videoES);
+	} else if (format == "video/H265") {
+		source = H265VideoStreamDiscreteFramer::createNew(env, videoES);
+	} else if (format == "video/JPEG") {
+		source = MJPEGVideoSource::createNew(env, videoES, dynamic_cast<MJPEG_V4L2DeviceSource*>(captureSource));
+	} else {
+		source = videoES;
+	}
+	return source;
 }
 
 RTPSink*  BaseServerMediaSubsession::createSink(
@@ -27,27 +72,41 @@ RTPSink*  BaseServerMediaSubsession::createSink(
 	Groupsock* 			rtpGroupsock, 
 	unsigned char 		rtpPayloadTypeIfDynamic, 
 	const std::string&	format, 
-	RSDeviceSource*	source)
+	FramedSource*		source)
 {
 	RTPSink* videoSink = NULL;
-	std::string sampling("YCbCr-4:2:2");
-	videoSink = RawVideoRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic, source->getHeight(), source->getWidth(), 8, sampling.c_str());
+	if (format == "video/H264") {
+		videoSink = H264VideoRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic);
+	} else if (format == "video/H265") {
+		videoSink = H265VideoRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic);
+	} else if (format == "video/JPEG") {
+		videoSink = JPEGVideoRTPSink::createNew(env, rtpGroupsock);
+	} else if (format == "video/RAW") {
+		int width = 0;
+		int height = 0;
+		std::string auxLine;
+		if (getSourceInfo(source, width, height, auxLine)) {
+			std::string sampling("YCbCr-4:2:2");
+			videoSink = RawVideoRTPSink::createNew(env, rtpGroupsock, rtpPayloadTypeIfDynamic, height, width, 8, sampling.c_str());
+		}
+	}
 	return videoSink;
 }
 
-char const* BaseServerMediaSubsession::getAuxLine(RSDeviceSource* source, RTPSink* rtpSink)
+char const* BaseServerMediaSubsession::getAuxLine(FramedSource* source, RTPSink* rtpSink)
 {
 	const char* auxLine = NULL;
 	if (rtpSink) {
 		std::ostringstream os; 
+		int width = 0;
+		int height = 0;
+		std::string sourceAuxLine;
 		if (rtpSink->auxSDPLine()) {
 			os << rtpSink->auxSDPLine();
 		}
-		else if (source) {
+		else if (getSourceInfo(source, width, height, sourceAuxLine)) {
 			unsigned char rtpPayloadType = rtpSink->rtpPayloadType();
-			os << "a=fmtp:" << int(rtpPayloadType) << " " << source->getAuxLine() << "\r\n";				
-			int width = source->getWidth();
-			int height = source->getHeight();
+			os << "a=fmtp:" << int(rtpPayloadType) << " " << sourceAuxLine << "\r\n";				
 			if ( (width > 0) && (height>0) ) {
 				os << "a=x-dimensions:" << width << "," <<  height  << "\r\n";				
 			}
@@ -56,4 +115,3 @@ char const* BaseServerMediaSubsession::getAuxLine(RSDeviceSource* source, RTPSin
 	}
 	return auxLine;
 }
-
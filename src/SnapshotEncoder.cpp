@@ -0,0 +1,153 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** SnapshotEncoder.cpp
+**
+** Encode the snapshots of a frame feed as PNG in a background thread
+**
+** -------------------------------------------------------------------------*/
+
+#include "logger.h"
+#include "SnapshotEncoder.h"
+#include "DepthCodec.h"
+#include "Tracer.h"
+
+SnapshotEncoder::SnapshotEncoder(UsageEnvironment& env)
+	: m_env(env), m_encodingId(0), m_stop(false)
+{
+	m_eventTriggerId = m_env.taskScheduler().createEventTrigger(SnapshotEncoder::encodedStub);
+	m_thread = std::thread(&SnapshotEncoder::run, this);
+}
+
+SnapshotEncoder::~SnapshotEncoder()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cond.notify_one();
+	m_thread.join();
+	m_env.taskScheduler().deleteEventTrigger(m_eventTriggerId);
+}
+
+void SnapshotEncoder::encode(const FrameFeed::Handle & frame, AfterEncodingFunc* afterFunc, void* clientData)
+{
+	if ( (m_last.m_id != 0) && (m_last.m_id >= frame->m_id) )
+	{
+		afterFunc(clientData, m_last);
+		return;
+	}
+
+	Waiter waiter = { afterFunc, clientData, frame->m_id };
+	m_waiters.push_back(waiter);
+	if (m_encodingId == 0)
+	{
+		this->start(frame);
+	}
+	else if ( (frame->m_id > m_encodingId) && ( (m_next == NULL) || (frame->m_id > m_next->m_id) ) )
+	{
+		// encoded when the thread is done
+		m_next = frame;
+	}
+}
+
+void SnapshotEncoder::cancel(void* clientData)
+{
+	for (std::list<Waiter>::iterator it = m_waiters.begin(); it != m_waiters.end(); )
+	{
+		if (it->m_clientData == clientData)
+		{
+			it = m_waiters.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+}
+
+void SnapshotEncoder::start(const FrameFeed::Handle & frame)
+{
+	m_encodingId = frame->m_id;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_job = frame;
+	}
+	m_cond.notify_one();
+}
+
+// the frame is held until it is encoded, the feed doesn't reuse it meanwhile
+void SnapshotEncoder::run()
+{
+	Tracer::setThreadName("snapshot");
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_stop)
+	{
+		if (m_job == NULL)
+		{
+			m_cond.wait(lock);
+			continue;
+		}
+		FrameFeed::Handle frame = m_job;
+		m_job.reset();
+		lock.unlock();
+
+		Snapshot snapshot;
+		snapshot.m_id = frame->m_id;
+		snapshot.m_width = frame->m_width;
+		snapshot.m_height = frame->m_height;
+		snapshot.m_timestamp = frame->m_timestamp;
+		std::string* png = new std::string();
+		if (DepthCodec::encodePNG(frame->data(), frame->m_size, frame->m_width, frame->m_height, *png))
+		{
+			snapshot.m_png.reset(png);
+		}
+		else
+		{
+			LOG(NOTICE) << "cannot encode snapshot size:" << frame->m_size << " width:" << frame->m_width << " height:" << frame->m_height;
+			delete png;
+		}
+		frame.reset();
+
+		lock.lock();
+		m_done = snapshot;
+		m_env.taskScheduler().triggerEvent(m_eventTriggerId, this);
+	}
+}
+
+// give the image to the requests waiting for it and encode the newest frame requested meanwhile
+void SnapshotEncoder::encoded()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_last = m_done;
+	}
+	m_encodingId = 0;
+
+	std::list<Waiter> waiters;
+	for (std::list<Waiter>::iterator it = m_waiters.begin(); it != m_waiters.end(); )
+	{
+		if (it->m_id <= m_last.m_id)
+		{
+			waiters.push_back(*it);
+			it = m_waiters.erase(it);
+		}
+		else
+		{
+			++it;
+		}
+	}
+	if (m_next != NULL)
+	{
+		FrameFeed::Handle next = m_next;
+		m_next.reset();
+		this->start(next);
+	}
+
+	for (std::list<Waiter>::iterator it = waiters.begin(); it != waiters.end(); ++it)
+	{
+		it->m_func(it->m_clientData, m_last);
+	}
+}
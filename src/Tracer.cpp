@@ -0,0 +1,153 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** Tracer.cpp
+**
+** Opt-in per-frame pipeline tracing exported in Chrome trace format
+**
+** -------------------------------------------------------------------------*/
+
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+
+#include <fstream>
+#include <vector>
+
+#include "Tracer.h"
+
+std::atomic<bool> Tracer::s_enabled(false);
+std::mutex        Tracer::s_mutex;
+std::list<Tracer::Ring*> Tracer::s_rings;
+
+uint64_t Tracer::now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+Tracer::Ring::Ring() : m_tid(syscall(SYS_gettid)), m_free(false), m_head(0)
+{
+}
+
+// the events of an exited thread are dumped until its ring is reused
+Tracer::RingOwner::~RingOwner()
+{
+	if (m_ring != NULL) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		m_ring->m_free = true;
+	}
+}
+
+// name given by setThreadName before the ring is allocated
+static thread_local std::string s_threadName;
+
+// ring of the calling thread, taken on the first event from the ones of the exited threads or allocated
+Tracer::Ring* Tracer::ring(bool create)
+{
+	static thread_local RingOwner owner;
+	if ( (owner.m_ring == NULL) && create ) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		for (std::list<Ring*>::iterator it = s_rings.begin(); it != s_rings.end(); ++it) {
+			if ((*it)->m_free) {
+				owner.m_ring = *it;
+				owner.m_ring->m_tid = syscall(SYS_gettid);
+				owner.m_ring->m_free = false;
+				owner.m_ring->m_head.store(0, std::memory_order_relaxed);
+				break;
+			}
+		}
+		if (owner.m_ring == NULL) {
+			owner.m_ring = new Ring();
+			s_rings.push_back(owner.m_ring);
+		}
+		owner.m_ring->m_threadName = s_threadName;
+	}
+	return owner.m_ring;
+}
+
+void Tracer::record(const char* name, char phase, uint64_t frameId, uint64_t ts)
+{
+	Ring* r = ring(true);
+	uint64_t head = r->m_head.load(std::memory_order_relaxed);
+	Event & event = r->m_events[head % RING_SIZE];
+	event.m_ts = ts;
+	event.m_frameId = frameId;
+	event.m_name = name;
+	event.m_phase = phase;
+	r->m_head.store(head + 1, std::memory_order_release);
+}
+
+static thread_local uint64_t s_currentFrame = 0;
+
+void Tracer::setCurrentFrame(uint64_t frameId)
+{
+	s_currentFrame = frameId;
+}
+
+uint64_t Tracer::currentFrame()
+{
+	return s_currentFrame;
+}
+
+void Tracer::setThreadName(const char* name)
+{
+	s_threadName = name;
+	Ring* r = ring(false);
+	if (r != NULL) {
+		std::lock_guard<std::mutex> lock(s_mutex);
+		r->m_threadName = name;
+	}
+}
+
+void Tracer::dump(std::ostream & os)
+{
+	int pid = getpid();
+	std::vector<Event> events;
+	events.reserve(RING_SIZE);
+
+	std::lock_guard<std::mutex> lock(s_mutex);
+	os << "{\"traceEvents\":[\n";
+	bool first = true;
+	for (std::list<Ring*>::iterator it = s_rings.begin(); it != s_rings.end(); ++it) {
+		Ring* r = *it;
+		if (!r->m_threadName.empty()) {
+			os << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << r->m_tid
+			   << ",\"args\":{\"name\":\"" << r->m_threadName << "\"}}";
+			first = false;
+		}
+
+		// copy the ring, then forget the slots the writer may have overwritten meanwhile
+		uint64_t head = r->m_head.load(std::memory_order_acquire);
+		uint64_t start = (head > RING_SIZE) ? head - RING_SIZE : 0;
+		events.clear();
+		for (uint64_t i = start; i < head; ++i) {
+			events.push_back(r->m_events[i % RING_SIZE]);
+		}
+		uint64_t after = r->m_head.load(std::memory_order_acquire);
+		uint64_t valid = (after > RING_SIZE) ? after - RING_SIZE : 0;
+		size_t skip = (valid > start) ? valid - start : 0;
+
+		for (size_t i = skip; i < events.size(); ++i) {
+			const Event & event = events[i];
+			os << (first ? "" : ",\n") << "{\"name\":\"" << event.m_name << "\",\"cat\":\"frame\",\"ph\":\"" << event.m_phase
+			   << "\",\"ts\":" << event.m_ts/1000 << "." << (char)('0' + (event.m_ts/100)%10) << (char)('0' + (event.m_ts/10)%10) << (char)('0' + event.m_ts%10)
+			   << ",\"pid\":" << pid << ",\"tid\":" << r->m_tid << ",\"args\":{\"frame\":" << event.m_frameId << "}}";
+			first = false;
+		}
+	}
+	os << "\n],\"displayTimeUnit\":\"ms\"}\n";
+}
+
+bool Tracer::dump(const std::string & path)
+{
+	std::ofstream os(path.c_str());
+	if (!os.is_open()) {
+		return false;
+	}
+	dump(os);
+	return os.good();
+}
@@ -9,7 +9,7 @@
 
 
 #include "UnicastServerMediaSubsession.h"
-#include "RSDeviceSource.h"
+#include "ClientMetricsFilter.h"
 
 // -----------------------------------------
 //    ServerMediaSubsession for Unicast
@@ -21,18 +21,17 @@ UnicastServerMediaSubsession* UnicastServerMediaSubsession::createNew(UsageEnvir
 					
 FramedSource* UnicastServerMediaSubsession::createNewStreamSource(unsigned clientSessionId, unsigned& estBitrate)
 {
-	FramedSource* source = m_replicator->createStreamReplica();
-	return createSource(envir(), source, m_format);
+	FramedSource* source = new ClientMetricsFilter(envir(), m_replicator, clientSessionId);
+	return createSource(envir(), source, m_format, m_replicator->inputSource());
 }
 		
 RTPSink* UnicastServerMediaSubsession::createNewRTPSink(Groupsock* rtpGroupsock,  unsigned char rtpPayloadTypeIfDynamic, FramedSource* inputSource)
 {
-	// return createSink(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, m_format, dynamic_cast<RSDeviceSource*>(m_replicator->inputSource()));
-	return createSink(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, m_format, dynamic_cast<RSDeviceSource*>(m_replicator->inputSource()));
+	return createSink(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, m_format, m_replicator->inputSource());
 }
 		
 char const* UnicastServerMediaSubsession::getAuxSDPLine(RTPSink* rtpSink,FramedSource* inputSource)
 {
-	return this->getAuxLine(dynamic_cast<RSDeviceSource*>(m_replicator->inputSource()), rtpSink);
+	return this->getAuxLine(m_replicator->inputSource(), rtpSink);
 }
 		
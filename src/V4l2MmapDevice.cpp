@@ -0,0 +1,237 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** V4l2MmapDevice.cpp
+**
+** V4L2 capture with memory mapped buffers that can stay dequeued while the
+** frames that point in them are in flight
+**
+** -------------------------------------------------------------------------*/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+
+#include <linux/videodev2.h>
+
+// project
+#include "logger.h"
+#include "V4l2MmapDevice.h"
+
+static int xioctl(int fd, unsigned long request, void* arg)
+{
+	int ret = -1;
+	do {
+		ret = ioctl(fd, request, arg);
+	} while ( (ret == -1) && (errno == EINTR) );
+	return ret;
+}
+
+V4l2MmapDevice* V4l2MmapDevice::createNew(const std::string & device, unsigned int format, int width, int height, int fps, unsigned int nbBuffers)
+{
+	V4l2MmapDevice* mmapDevice = NULL;
+	int fd = ::open(device.c_str(), O_RDWR | O_NONBLOCK);
+	if (fd < 0) {
+		LOG(ERROR) << "Cannot open device:" << device << " " << strerror(errno) << std::endl;
+	} else {
+		mmapDevice = new V4l2MmapDevice(fd);
+		if (!mmapDevice->init(format, width, height, fps, nbBuffers)) {
+			LOG(ERROR) << "Cannot initialize device:" << device << std::endl;
+			delete mmapDevice;
+			mmapDevice = NULL;
+		}
+	}
+	return mmapDevice;
+}
+
+V4l2MmapDevice::V4l2MmapDevice(int fd)
+	: m_fd(fd), m_format(0), m_width(0), m_height(0), m_bufferSize(0), m_inFlight(0), m_streaming(false)
+{
+}
+
+V4l2MmapDevice::~V4l2MmapDevice()
+{
+	if (m_streaming) {
+		int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		xioctl(m_fd, VIDIOC_STREAMOFF, &type);
+	}
+	for (size_t i = 0; i < m_buffers.size(); ++i) {
+		MmapBuffer* buffer = m_buffers[i];
+		if (buffer->m_dmabufFd != -1) {
+			::close(buffer->m_dmabufFd);
+		}
+		if (buffer->m_data != NULL) {
+			munmap(buffer->m_data, buffer->m_length);
+		}
+		delete buffer;
+	}
+	::close(m_fd);
+}
+
+bool V4l2MmapDevice::init(unsigned int format, int width, int height, int fps, unsigned int nbBuffers)
+{
+	struct v4l2_capability cap;
+	memset(&cap, 0, sizeof(cap));
+	if (xioctl(m_fd, VIDIOC_QUERYCAP, &cap) == -1) {
+		LOG(ERROR) << "VIDIOC_QUERYCAP " << strerror(errno) << std::endl;
+		return false;
+	}
+	if ( !(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) || !(cap.capabilities & V4L2_CAP_STREAMING) ) {
+		LOG(ERROR) << "Device " << cap.card << " doesn't support capture streaming" << std::endl;
+		return false;
+	}
+
+	// format, keep the current one for the values that are not set
+	struct v4l2_format fmt;
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl(m_fd, VIDIOC_G_FMT, &fmt) == -1) {
+		LOG(ERROR) << "VIDIOC_G_FMT " << strerror(errno) << std::endl;
+		return false;
+	}
+	if (format != 0) fmt.fmt.pix.pixelformat = format;
+	if (width != 0)  fmt.fmt.pix.width = width;
+	if (height != 0) fmt.fmt.pix.height = height;
+	if ( (format != 0) || (width != 0) || (height != 0) ) {
+		if (xioctl(m_fd, VIDIOC_S_FMT, &fmt) == -1) {
+			LOG(ERROR) << "VIDIOC_S_FMT " << strerror(errno) << std::endl;
+			return false;
+		}
+	}
+	m_format = fmt.fmt.pix.pixelformat;
+	m_width = fmt.fmt.pix.width;
+	m_height = fmt.fmt.pix.height;
+	m_bufferSize = fmt.fmt.pix.sizeimage;
+
+	if (fps != 0) {
+		struct v4l2_streamparm param;
+		memset(&param, 0, sizeof(param));
+		param.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		param.parm.capture.timeperframe.numerator = 1;
+		param.parm.capture.timeperframe.denominator = fps;
+		if (xioctl(m_fd, VIDIOC_S_PARM, &param) == -1) {
+			LOG(WARN) << "Cannot set fps:" << fps << " " << strerror(errno) << std::endl;
+		}
+	}
+
+	// buffers
+	struct v4l2_requestbuffers req;
+	memset(&req, 0, sizeof(req));
+	req.count = nbBuffers;
+	req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	req.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(m_fd, VIDIOC_REQBUFS, &req) == -1) {
+		LOG(ERROR) << "VIDIOC_REQBUFS " << strerror(errno) << std::endl;
+		return false;
+	}
+	for (unsigned int i = 0; i < req.count; ++i) {
+		MmapBuffer* buffer = new MmapBuffer(this, i);
+		m_buffers.push_back(buffer);
+
+		struct v4l2_buffer buf;
+		memset(&buf, 0, sizeof(buf));
+		buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		buf.memory = V4L2_MEMORY_MMAP;
+		buf.index = i;
+		if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1) {
+			LOG(ERROR) << "VIDIOC_QUERYBUF " << strerror(errno) << std::endl;
+			return false;
+		}
+		void* data = mmap(NULL, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+		if (data == MAP_FAILED) {
+			LOG(ERROR) << "mmap " << strerror(errno) << std::endl;
+			return false;
+		}
+		buffer->m_data = (char*)data;
+		buffer->m_length = buf.length;
+
+		// export as DMABUF for consumers that can import it, optional
+		struct v4l2_exportbuffer expbuf;
+		memset(&expbuf, 0, sizeof(expbuf));
+		expbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		expbuf.index = i;
+		expbuf.flags = O_RDONLY | O_CLOEXEC;
+		if (xioctl(m_fd, VIDIOC_EXPBUF, &expbuf) == 0) {
+			buffer->m_dmabufFd = expbuf.fd;
+		}
+
+		if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
+			LOG(ERROR) << "VIDIOC_QBUF " << strerror(errno) << std::endl;
+			return false;
+		}
+	}
+
+	int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	if (xioctl(m_fd, VIDIOC_STREAMON, &type) == -1) {
+		LOG(ERROR) << "VIDIOC_STREAMON " << strerror(errno) << std::endl;
+		return false;
+	}
+	m_streaming = true;
+
+	LOG(NOTICE) << "Device " << cap.card << " " << m_width << "x" << m_height << " buffers:" << m_buffers.size() << " size:" << m_bufferSize << std::endl;
+	return true;
+}
+
+CaptureBuffer* V4l2MmapDevice::dequeue()
+{
+	MmapBuffer* buffer = NULL;
+	struct v4l2_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	if (xioctl(m_fd, VIDIOC_DQBUF, &buf) == -1) {
+		if (errno != EAGAIN) {
+			LOG(ERROR) << "VIDIOC_DQBUF " << strerror(errno) << std::endl;
+		}
+	} else if (buf.flags & V4L2_BUF_FLAG_ERROR) {
+		// corrupted data, give the buffer back to the driver
+		LOG(WARN) << "VIDIOC_DQBUF buffer:" << buf.index << " sequence:" << buf.sequence << " flagged in error" << std::endl;
+		if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
+			LOG(ERROR) << "VIDIOC_QBUF " << strerror(errno) << std::endl;
+		}
+		errno = EAGAIN;
+	} else if (buf.index < m_buffers.size()) {
+		buffer = m_buffers[buf.index];
+		buffer->m_size = buf.bytesused;
+		buffer->m_sequence = buf.sequence;
+		buffer->m_timestamp = buf.timestamp;
+		m_inFlight.fetch_add(1, std::memory_order_relaxed);
+		buffer->addRef();
+	}
+	return buffer;
+}
+
+void V4l2MmapDevice::requeue(MmapBuffer* buffer)
+{
+	struct v4l2_buffer buf;
+	memset(&buf, 0, sizeof(buf));
+	buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buf.memory = V4L2_MEMORY_MMAP;
+	buf.index = buffer->m_index;
+	if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
+		LOG(ERROR) << "VIDIOC_QBUF " << strerror(errno) << std::endl;
+	}
+	m_inFlight.fetch_sub(1, std::memory_order_relaxed);
+}
+
+// copy interface, for the sources that don't use dequeue
+size_t V4l2MmapDevice::read(char* buffer, size_t bufferSize)
+{
+	size_t size = 0;
+	CaptureBuffer* captureBuffer = this->dequeue();
+	if (captureBuffer != NULL) {
+		size = captureBuffer->m_size;
+		if (size > bufferSize) {
+			LOG(WARN) << "Device buffer truncated available:" << bufferSize << " needed:" << size << std::endl;
+			size = bufferSize;
+		}
+		memcpy(buffer, captureBuffer->m_data, size);
+		captureBuffer->release();
+	}
+	return size;
+}
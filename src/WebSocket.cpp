@@ -0,0 +1,155 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** WebSocket.cpp
+**
+** WebSocket (RFC 6455) handshake and framing
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "Base64.hh"
+
+#include "WebSocket.h"
+
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+static uint32_t rotl(uint32_t value, int bits)
+{
+	return (value << bits) | (value >> (32 - bits));
+}
+
+// SHA-1 (RFC 3174), only used for the handshake
+static void sha1(const std::string & message, unsigned char digest[20])
+{
+	uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+	// padding with the length in bits
+	std::string data(message);
+	uint64_t bits = (uint64_t)message.size() * 8;
+	data += (char)0x80;
+	while (data.size() % 64 != 56) {
+		data += (char)0;
+	}
+	for (int i = 7; i >= 0; --i) {
+		data += (char)(bits >> (8*i));
+	}
+
+	for (size_t block = 0; block < data.size(); block += 64) {
+		const unsigned char* p = (const unsigned char*)data.c_str() + block;
+		uint32_t w[80];
+		for (int i = 0; i < 16; ++i) {
+			w[i] = (p[4*i] << 24) | (p[4*i+1] << 16) | (p[4*i+2] << 8) | p[4*i+3];
+		}
+		for (int i = 16; i < 80; ++i) {
+			w[i] = rotl(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+		}
+		uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+		for (int i = 0; i < 80; ++i) {
+			uint32_t f, k;
+			if (i < 20) {
+				f = (b & c) | (~b & d);
+				k = 0x5A827999;
+			} else if (i < 40) {
+				f = b ^ c ^ d;
+				k = 0x6ED9EBA1;
+			} else if (i < 60) {
+				f = (b & c) | (b & d) | (c & d);
+				k = 0x8F1BBCDC;
+			} else {
+				f = b ^ c ^ d;
+				k = 0xCA62C1D6;
+			}
+			uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+			e = d;
+			d = c;
+			c = rotl(b, 30);
+			b = a;
+			a = temp;
+		}
+		h[0] += a;
+		h[1] += b;
+		h[2] += c;
+		h[3] += d;
+		h[4] += e;
+	}
+
+	for (int i = 0; i < 20; ++i) {
+		digest[i] = h[i/4] >> (24 - 8*(i%4));
+	}
+}
+
+std::string WebSocket::acceptKey(const std::string & key)
+{
+	unsigned char digest[20];
+	sha1(key + WEBSOCKET_GUID, digest);
+	char* encoded = base64Encode((const char*)digest, sizeof(digest));
+	std::string accept(encoded);
+	delete [] encoded;
+	return accept;
+}
+
+std::string WebSocket::frameHeader(int opcode, uint64_t size)
+{
+	std::string header;
+	header += (char)(0x80 | opcode);
+	if (size < 126) {
+		header += (char)size;
+	} else if (size < 0x10000) {
+		header += (char)126;
+		header += (char)(size >> 8);
+		header += (char)size;
+	} else {
+		header += (char)127;
+		for (int i = 7; i >= 0; --i) {
+			header += (char)(size >> (8*i));
+		}
+	}
+	return header;
+}
+
+ssize_t WebSocket::parse(const char* data, size_t size, size_t maxSize, Frame & frame)
+{
+	const unsigned char* p = (const unsigned char*)data;
+	if (size < 2) {
+		return 0;
+	}
+	frame.m_final = (p[0] & 0x80) != 0;
+	frame.m_opcode = p[0] & 0x0F;
+	bool masked = (p[1] & 0x80) != 0;
+	uint64_t length = p[1] & 0x7F;
+	size_t pos = 2;
+	if (length == 126) {
+		if (size < pos + 2) {
+			return 0;
+		}
+		length = (p[2] << 8) | p[3];
+		pos += 2;
+	} else if (length == 127) {
+		if (size < pos + 8) {
+			return 0;
+		}
+		length = 0;
+		for (int i = 0; i < 8; ++i) {
+			length = (length << 8) | p[pos+i];
+		}
+		pos += 8;
+	}
+	// the client frames are masked, the control frames are small and not fragmented
+	if ( !masked || (length > maxSize) || ( (frame.m_opcode & 0x8) && ( (length > 125) || !frame.m_final ) ) ) {
+		return -1;
+	}
+	if (size < pos + 4 + length) {
+		return 0;
+	}
+	const unsigned char* mask = p + pos;
+	pos += 4;
+	frame.m_payload.assign(data + pos, length);
+	for (size_t i = 0; i < length; ++i) {
+		frame.m_payload[i] ^= mask[i % 4];
+	}
+	return pos + length;
+}
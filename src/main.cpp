@@ -20,6 +20,7 @@
 #include <sys/ioctl.h>
 #include <dirent.h>
 #include <fcntl.h>
+#include <unistd.h>
 
 #include <sstream>
 
@@ -34,9 +35,15 @@
 #include "logger.h"
 
 #include "RSDeviceSource.h"
+#include "H264_V4l2DeviceSource.h"
+#include "MJPEG_V4l2DeviceSource.h"
+#include "V4l2MmapDevice.h"
 #include "ServerMediaSubsession.h"
 #include "UnicastServerMediaSubsession.h"
+#include "SegmentServerMediaSubsession.h"
 #include "HTTPServer.h"
+#include "Tracer.h"
+#include "AsyncLogger.h"
 
 // Include RealSense Cross Platform API
 #include <librealsense2/rs.hpp> 
@@ -51,6 +58,54 @@ void sighandler(int n)
 	quit =1;
 }
 
+// -----------------------------------------
+//    SIGUSR1 start tracing, then dump the trace
+// -----------------------------------------
+volatile sig_atomic_t traceRequest = 0;
+void tracehandler(int n)
+{ 
+	traceRequest = 1;
+}
+
+void traceCheck(void* clientData)
+{
+	UsageEnvironment* env = (UsageEnvironment*)clientData;
+	if (traceRequest) {
+		traceRequest = 0;
+		if (!Tracer::enabled()) {
+			Tracer::enable(true);
+			LOG(NOTICE) << "Tracing started" << std::endl;
+		} else {
+			std::ostringstream path;
+			path << "/tmp/rs2rtspserver-" << getpid() << ".trace.json";
+			if (Tracer::dump(path.str())) {
+				LOG(NOTICE) << "Trace written to " << path.str() << std::endl;
+			} else {
+				LOG(ERROR) << "Cannot write trace to " << path.str() << std::endl;
+			}
+		}
+	}
+	env->taskScheduler().scheduleDelayedTask(200000, traceCheck, env);
+}
+
+// -----------------------------------------
+//    SIGUSR2 pause the RealSense playback to check the stall recovery
+// -----------------------------------------
+volatile sig_atomic_t stallRequest = 0;
+void stallhandler(int n)
+{ 
+	stallRequest = 1;
+}
+
+void stallCheck(void* clientData)
+{
+	RSDeviceSource* source = (RSDeviceSource*)clientData;
+	if (stallRequest) {
+		stallRequest = 0;
+		source->simulateStall();
+	}
+	source->envir().taskScheduler().scheduleDelayedTask(200000, stallCheck, source);
+}
 
 // -----------------------------------------
 //    create UserAuthenticationDatabase for RTSP server
@@ -101,15 +156,32 @@ RTSPServer* createRTSPServer(
 	return rtspServer;
 }
 
-/*
 // -----------------------------------------
 //    create FramedSource server
 // -----------------------------------------
-FramedSource* createFramedSource(UsageEnvironment* env, int format, RSDeviceInterface* videoCapture, int outfd, int queueSize, bool useThread, bool repeatConfig)
+FramedSource* createFramedSource(UsageEnvironment* env, int format, DeviceInterface* videoCapture, int outfd, int queueSize, bool useThread, bool repeatConfig)
 {
-	return RSDeviceSource::createNew(*env, videoCapture, outfd, queueSize, useThread);
+	FramedSource* source = NULL;
+	if (format == V4L2_PIX_FMT_H264)
+	{
+		source = H264_V4L2DeviceSource::createNew(*env, videoCapture, outfd, queueSize, useThread, repeatConfig, false);
+	}
+#ifdef V4L2_PIX_FMT_HEVC
+	else if (format == V4L2_PIX_FMT_HEVC)
+	{
+		source = H265_V4L2DeviceSource::createNew(*env, videoCapture, outfd, queueSize, useThread, repeatConfig, false);
+	}
+#endif
+	else if ( (format == V4L2_PIX_FMT_MJPEG) || (format == V4L2_PIX_FMT_JPEG) )
+	{
+		source = MJPEG_V4L2DeviceSource::createNew(*env, videoCapture, outfd, queueSize, useThread);
+	}
+	else 
+	{
+		source = V4L2DeviceSource::createNew(*env, videoCapture, outfd, queueSize, useThread);
+	}
+	return source;
 }
-*/
 
 // -----------------------------------------
 //    add an RTSP session
@@ -191,12 +263,27 @@ struct params {
 	unsigned int format;
 
 	unsigned int hlsSegment;
+	unsigned int hlsRetention;
+	unsigned int hlsMemory;
+	unsigned int hlsPart;
+	std::string hlsContainer;
 	const char* realm;
 
 	std::list<std::string> userPasswordList;
 	std::list<std::string> devList;
 	std::list<unsigned int> videoformatList;
 
+	bool trace;
+	bool zeroCopy;
+	unsigned int nbBuffers;
+
+	bool rsCallback;
+	unsigned int rsQueueSize;
+	bool rsKeepWarm;
+	unsigned int rsIdleTimeout;
+	unsigned int rsStallTimeout;
+	std::string rsPlayback;
+
 } gParams = {
 	8554,
 	0,
@@ -224,7 +311,26 @@ struct params {
 	0,
 
 	0,
-	NULL
+	0,
+	32,
+	0,
+	"ts",
+	NULL,
+
+	std::list<std::string>(),
+	std::list<std::string>(),
+	std::list<unsigned int>(),
+
+	false,
+	true,
+	8,
+
+	true,
+	0,
+	false,
+	10,
+	2000,
+	""
 };
 
 // -----------------------------------------
@@ -232,14 +338,15 @@ struct params {
 // -----------------------------------------
 
 void usage(std::string name) {
-	std::cout << name << " [-v[v]] [-Q queueSize] [-O file]"                                        << std::endl;
-	std::cout << "\t          [-I interface] [-P RTSP port] [-p RTSP/HTTP port] [-m multicast url] [-u unicast url] [-M multicast addr] [-c] [-t timeout] [-T] [-S[duration]]" << std::endl;
+	std::cout << name << " [-v[v]] [-Q queueSize] [-O file] [-x]"                                        << std::endl;
+	std::cout << "\t          [-I interface] [-P RTSP port] [-p RTSP/HTTP port] [-m multicast url] [-u unicast url] [-M multicast addr] [-c] [-t timeout] [-S[duration]] [-L secs] [-Z MB] [-l msecs]" << std::endl;
 	std::cout << "\t          [-r] [-w] [-s] [-f[format] [-W width] [-H height] [-F fps] [device] [device]"                        << std::endl;
 	std::cout << "\t -v               : verbose"                                                                                          << std::endl;
 	std::cout << "\t -vv              : very verbose"                                                                                     << std::endl;
 	std::cout << "\t -Q <length>      : Number of frame queue  (default " << gParams.queueSize << ")"                                              << std::endl;
 	std::cout << "\t -O <output>      : Copy captured frame to a file or a V4L2 device"                                                   << std::endl;
 	std::cout << "\t -b <webroot>     : path to webroot" << std::endl;
+	std::cout << "\t -x               : start frame pipeline tracing (SIGUSR1 or /trace to dump it)"                                    << std::endl;
 	
 	std::cout << "\t RTSP/RTP options"                                                                                           << std::endl;
 	std::cout << "\t -I <addr>        : RTSP interface (default autodetect)"                                                              << std::endl;
@@ -250,9 +357,22 @@ void usage(std::string name) {
 	std::cout << "\t -u <url>         : unicast url (default " << gParams.url << ")"                                                              << std::endl;
 	std::cout << "\t -c               : don't repeat config (default repeat config before IDR frame)"                                     << std::endl;
 	std::cout << "\t -t <timeout>     : RTCP expiration timeout in seconds (default " << gParams.timeout << ")"                                   << std::endl;
+	std::cout << "\t -S[duration]     : HTTP segment duration in seconds (enable HLS & MPEG-DASH, default " << gParams.defaultHlsSegment << ")"   << std::endl;
+	std::cout << "\t -L <secs>        : HTTP segments kept in seconds (default 2 segments behind the current one)"                       << std::endl;
+	std::cout << "\t -Z <MB>          : HTTP segments memory preallocated per stream (default " << gParams.hlsMemory << ")"                       << std::endl;
+	std::cout << "\t -l <msecs>       : LL-HLS part duration, 0 disable (default " << gParams.hlsPart << ")"                                      << std::endl;
+	std::cout << "\t -e <ts|mp4>      : HTTP segments container, mp4 for CMAF (default " << gParams.hlsContainer << ")"                           << std::endl;
 	
+	std::cout << "\t RealSense options"                                                                                          << std::endl;
+	std::cout << "\t -T               : RealSense capture using a thread waiting for frames (default queue from the SDK callback)"      << std::endl;
+	std::cout << "\t -q <count>       : RealSense SDK frames queue size (default SDK value)"                                              << std::endl;
+	std::cout << "\t -k               : RealSense capture always running (default start with the first client)"                         << std::endl;
+	std::cout << "\t -i <secs>        : RealSense capture stop delay after the last client (default "<< gParams.rsIdleTimeout << ")"    << std::endl;
+	std::cout << "\t -d <msecs>       : RealSense restart after this delay without frame, 0 disable (default "<< gParams.rsStallTimeout << ")" << std::endl;
+	std::cout << "\t -Y <file.bag>    : RealSense playback of a recording instead of the camera (SIGUSR2 pauses it to simulate a stall)"  << std::endl;
 	std::cout << "\t V4L2 options"                                                                                               << std::endl;
-	std::cout << "\t -r               : V4L2 capture using read interface (default use memory mapped buffers)"                            << std::endl;
+	std::cout << "\t -r               : V4L2 capture copying the memory mapped buffers, was the read interface (default deliver from the driver buffers)"<< std::endl;
+	std::cout << "\t -N <count>       : V4L2 number of memory mapped buffers (default "<< gParams.nbBuffers << ")"                                << std::endl;
 	std::cout << "\t -w               : V4L2 capture using write interface (default use memory mapped buffers)"                           << std::endl;
 	std::cout << "\t -B               : V4L2 capture using blocking mode (default use non-blocking mode)"                                 << std::endl;
 	std::cout << "\t -s               : V4L2 capture using live555 mainloop (default use a reader thread)"                                << std::endl;
@@ -269,12 +389,13 @@ void usage(std::string name) {
 void decode_parameters(int argc, char** argv) {
 	// decode parameters
 	int c = 0;     
-	while ((c = getopt (argc, argv, "v::Q:O:b:" "I:P:p:m:u:M:ct:S::" "R:U:" "rwBsf::F:W:H:G:" "A:C:a:" "Vh")) != -1) {
+	while ((c = getopt (argc, argv, "v::Q:O:b:x" "I:P:p:m:u:M:ct:S::L:Z:l:e:" "R:U:" "rwBsf::F:W:H:G:N:" "A:C:a:" "Tq:ki:d:Y:" "Vh")) != -1) {
 		switch (c) {
 		case 'v':	gParams.verbose    = 1; if (optarg && *optarg=='v') gParams.verbose++;  break;
 		case 'Q':	gParams.queueSize  = atoi(optarg); break;
 		case 'O':	gParams.outputFile = optarg; break;
 		case 'b':	gParams.webroot = optarg; break;
+		case 'x':	gParams.trace = true; break;
 		
 		// RTSP/RTP
 		case 'I':       ReceivingInterfaceAddr  = inet_addr(optarg); break;
@@ -283,15 +404,30 @@ void decode_parameters(int argc, char** argv) {
 		case 'u':	gParams.url                     = optarg; break;
 		case 'c':	gParams.repeatConfig            = false; break;
 		case 't':	gParams.timeout                 = atoi(optarg); break;
+		case 'S':	gParams.hlsSegment              = optarg ? atoi(optarg) : gParams.defaultHlsSegment; break;
+		case 'L':	gParams.hlsRetention            = atoi(optarg); break;
+		case 'Z':	gParams.hlsMemory               = atoi(optarg); break;
+		case 'l':	gParams.hlsPart                 = atoi(optarg); break;
+		case 'e':	gParams.hlsContainer            = optarg; if ( (gParams.hlsContainer != "ts") && (gParams.hlsContainer != "mp4") ) usage(argv[0]); break;
 		
 		// users
 		case 'R':   gParams.realm                   = optarg; break;
 		case 'U':   gParams.userPasswordList.push_back(optarg); break;
 		
+		// RealSense
+		case 'T':	gParams.rsCallback  = false; break;
+		case 'q':	gParams.rsQueueSize = atoi(optarg); break;
+		case 'k':	gParams.rsKeepWarm  = true; break;
+		case 'i':	gParams.rsIdleTimeout = atoi(optarg); break;
+		case 'd':	gParams.rsStallTimeout = atoi(optarg); break;
+		case 'Y':	gParams.rsPlayback = optarg; break;
+
 		// V4L2
+		case 'r':	gParams.zeroCopy  = false; break;
+		case 'N':	gParams.nbBuffers = atoi(optarg); break;
 		case 'B':	gParams.openflags = O_RDWR; break;	
 		case 's':	gParams.useThread =  false; break;
-		case 'f':	gParams.format    = 0; /* decodeVideoFormat(optarg); if (gParams.format) { gParams.videoformatList.push_back(gParams.format); }; */  break;
+		case 'f':	gParams.format    = (optarg && strlen(optarg) >= 4) ? v4l2_fourcc(optarg[0], optarg[1], optarg[2], optarg[3]) : 0; break;
 		case 'F':	gParams.fps       = atoi(optarg); break;
 		case 'W':	gParams.width     = atoi(optarg); break;
 		case 'H':	gParams.height    = atoi(optarg); break;
@@ -329,6 +465,9 @@ int main(int argc, char** argv) {
 	
 	// init logger
 	initLogger(gParams.verbose);
+	AsyncLogger::start();
+	Tracer::enable(gParams.trace);
+	Tracer::setThreadName("live555");
      
 	// create live555 environment
 	TaskScheduler* scheduler = BasicTaskScheduler::createNew();
@@ -341,32 +480,96 @@ int main(int argc, char** argv) {
 	if (rtspServer == NULL) {
 		LOG(ERROR) << "Failed to create RTSP server: " << env->getResultMsg() << std::endl;
 	} else {			
-		StreamReplicator* videoReplicator = NULL;
-		std::string rtpFormat("video/RAW");
-
-		LOG(NOTICE) << "Create RS pipeline..." << std::endl;
+		int nbSession = 0;
 		pipeline pipe;
-		config cfg;
-		cfg.enable_stream(rs2_stream::RS2_STREAM_DEPTH, 640, 480, RS2_FORMAT_Z16, 30); // AP: hardcode all constants, they never chage
-		pipe.start(cfg);
-
-		LOG(NOTICE) << "Create Source ..." << std::endl;
-		FramedSource* videoSource = RSDeviceSource::createNew(*env, pipe, 42); // AP: 42 can replace any integer value
-		if (videoSource == NULL) {
-			LOG(FATAL) << "Unable to create source for device " << std::endl;
-		} else {
-			videoReplicator = StreamReplicator::createNew(*env, videoSource, false);
+		if (gParams.devList.empty()) {
+			StreamReplicator* videoReplicator = NULL;
+			std::string rtpFormat("video/RAW");
+
+			LOG(NOTICE) << "Create RS pipeline..." << std::endl;
+			config cfg;
+			if (!gParams.rsPlayback.empty()) {
+				cfg.enable_device_from_file(gParams.rsPlayback, true);
+			}
+			cfg.enable_stream(rs2_stream::RS2_STREAM_DEPTH, 640, 480, RS2_FORMAT_Z16, 30); // AP: hardcode all constants, they never chage
+
+			LOG(NOTICE) << "Create Source ..." << std::endl;
+			RSDeviceSource* videoSource = RSDeviceSource::createNew(*env, pipe, cfg, 42, gParams.rsCallback, gParams.rsQueueSize, gParams.rsKeepWarm, gParams.rsIdleTimeout, gParams.rsStallTimeout); // AP: 42 can replace any integer value
+			if (videoSource == NULL) {
+				LOG(FATAL) << "Unable to create source for device " << std::endl;
+			} else {
+				videoReplicator = StreamReplicator::createNew(*env, videoSource, false);
+				if (!gParams.rsPlayback.empty()) {
+					signal(SIGUSR2,stallhandler);
+					stallCheck(videoSource);
+				}
+			}
+
+			// Create Unicast Session					
+			std::list<ServerMediaSubsession*> subSession;
+			if (videoReplicator) {
+				subSession.push_back(UnicastServerMediaSubsession::createNew(*env, videoReplicator, rtpFormat));				
+			}
+			nbSession += addSession(rtspServer, gParams.url, subSession);
 		}
 
-		// Create Unicast Session					
-		std::list<ServerMediaSubsession*> subSession;
-		if (videoReplicator) {
-			subSession.push_back(UnicastServerMediaSubsession::createNew(*env, videoReplicator, rtpFormat));				
+		// V4L2 devices
+		std::list<std::string>::iterator devIt;
+		for (devIt = gParams.devList.begin(); devIt != gParams.devList.end(); ++devIt) {
+			std::string deviceName(*devIt);
+			LOG(NOTICE) << "Create V4L2 Source..." << deviceName << std::endl;
+			V4l2MmapDevice* videoCapture = V4l2MmapDevice::createNew(deviceName, gParams.format, gParams.width, gParams.height, gParams.fps, gParams.nbBuffers);
+			if (videoCapture == NULL) {
+				LOG(FATAL) << "Cannot create V4L2 capture interface for device:" << deviceName << std::endl;
+				continue;
+			}
+			int format = videoCapture->getCaptureFormat();
+			std::string rtpFormat(BaseServerMediaSubsession::getFormat(format));
+			if (rtpFormat.empty()) {
+				LOG(FATAL) << "No streaming format supported for device:" << deviceName << std::endl;
+				delete videoCapture;
+				continue;
+			}
+
+			DeviceInterface* device = videoCapture;
+			if (!gParams.zeroCopy) {
+				device = new DeviceCaptureAccess<V4l2MmapDevice>(videoCapture);
+			}
+			StreamReplicator* videoReplicator = NULL;
+			FramedSource* videoSource = createFramedSource(env, format, device, -1, gParams.queueSize, gParams.useThread, gParams.repeatConfig);
+			if (videoSource == NULL) {
+				LOG(FATAL) << "Unable to create source for device " << deviceName << std::endl;
+				delete device;
+			} else {
+				videoReplicator = StreamReplicator::createNew(*env, videoSource, false);
+			}
+
+			// one session per device, named from the device when there are several
+			std::string url(gParams.url);
+			if (gParams.devList.size() > 1) {
+				url = deviceName.substr(deviceName.find_last_of('/') + 1);
+			}
+			std::list<ServerMediaSubsession*> subSession;
+			if (videoReplicator) {
+				subSession.push_back(UnicastServerMediaSubsession::createNew(*env, videoReplicator, rtpFormat));				
+			}
+			nbSession += addSession(rtspServer, url, subSession);
+
+			// HLS & MPEG-DASH session, the HTTP server use the first subsession of a session
+			if ( videoReplicator && (gParams.hlsSegment > 0) && ((rtpFormat == "video/H264") || (rtpFormat == "video/H265")) ) {
+				std::list<ServerMediaSubsession*> segmentSubSession;
+				segmentSubSession.push_back(SegmentServerMediaSubsession::createNew(*env, videoReplicator, rtpFormat, gParams.hlsContainer, gParams.hlsSegment, gParams.hlsRetention, (size_t)gParams.hlsMemory<<20, gParams.hlsPart));
+				nbSession += addSession(rtspServer, url + "-" + gParams.hlsContainer, segmentSubSession);
+			}
 		}
 
-		if (addSession(rtspServer, gParams.url, subSession)) {
+		if (nbSession) {
 			// main loop
 			signal(SIGINT,sighandler);
+			signal(SIGUSR1,tracehandler);
+			// sendfile() has no MSG_NOSIGNAL, a closed HTTP connection is reported by EPIPE
+			signal(SIGPIPE,SIG_IGN);
+			traceCheck(env);
 			env->taskScheduler().doEventLoop(&quit); 
 			LOG(NOTICE) << "Exiting..." << std::endl;			
 		}
@@ -376,6 +579,7 @@ int main(int argc, char** argv) {
 	
 	env->reclaim();
 	delete scheduler;	
+	AsyncLogger::stop();
 	
 	return 0;
 }
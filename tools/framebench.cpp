@@ -0,0 +1,369 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** framebench.cpp
+**
+** Micro benchmarks of the per-frame kernels
+**
+** Each benchmark push synthetic frames through the real live555 objects and
+** report time per frame and bytes/s for several frame sizes, and the copies
+** and allocations per frame counted by CopyMetrics.
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include <benchmark/benchmark.h>
+
+// live555
+#include <liveMedia.hh>
+#include <BasicUsageEnvironment.hh>
+
+// project
+#include "H264_V4l2DeviceSource.h"
+#include "MJPEGVideoSource.h"
+#include "AddH26xMarkerFilter.h"
+#include "MemoryBufferSink.h"
+#include "Metrics.h"
+
+// -----------------------------------------
+//    live555 environment shared by all the benchmarks
+// -----------------------------------------
+static UsageEnvironment& benchEnv() {
+	static TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+	static UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+	return *env;
+}
+
+// -----------------------------------------
+//    synthetic inputs
+// -----------------------------------------
+
+// random payload without start code emulation (no 0x00)
+static void fillPayload(std::string & buffer, size_t size) {
+	unsigned int seed = 42;
+	for (size_t i = 0; i < size; ++i) {
+		buffer.push_back((char)(1 + rand_r(&seed) % 255));
+	}
+}
+
+// Annex-B H264 access unit : SPS, PPS and an IDR slice of the requested size
+static std::string makeH264AccessUnit(size_t size) {
+	const char sps[] = {0,0,0,1, 0x67, 0x64, 0x00, 0x28, (char)0xac, (char)0xd9, 0x40, 0x78, 0x02, 0x27, (char)0xe5, (char)0x84};
+	const char pps[] = {0,0,0,1, 0x68, (char)0xeb, (char)0xe3, (char)0xcb, 0x22, (char)0xc0};
+	const char idr[] = {0,0,0,1, 0x65, (char)0x88, (char)0x84};
+	std::string au(sps, sizeof(sps));
+	au.append(pps, sizeof(pps));
+	au.append(idr, sizeof(idr));
+	if (size > au.size()) {
+		fillPayload(au, size - au.size());
+	}
+	return au;
+}
+
+// baseline JPEG : SOI, DQT x2, SOF0, DHT, DRI, SOS then scan data
+static std::string makeJPEG(size_t size, unsigned int width, unsigned int height) {
+	std::string jpeg("\xFF\xD8", 2);
+	for (int idx = 0; idx < 2; ++idx) {
+		jpeg.append("\xFF\xDB\x00\x43", 4);
+		jpeg.push_back((char)idx);
+		for (int i = 0; i < 64; ++i) {
+			jpeg.push_back((char)(1+i));
+		}
+	}
+	const char sof[] = { (char)0xFF, (char)0xC0, 0x00, 0x11, 0x08,
+	                     (char)(height>>8), (char)(height&0xff), (char)(width>>8), (char)(width&0xff),
+	                     0x03, 0x01, 0x21, 0x00, 0x02, 0x11, 0x01, 0x03, 0x11, 0x01 };
+	jpeg.append(sof, sizeof(sof));
+	// huffman table content is not parsed, only skipped
+	jpeg.append("\xFF\xC4\x01\xA2", 4);
+	jpeg.append(0x1A0, '\x01');
+	jpeg.append("\xFF\xDD\x00\x04\x00\x10", 6);
+	const char sos[] = { (char)0xFF, (char)0xDA, 0x00, 0x0C, 0x03, 0x01, 0x00, 0x02, 0x11, 0x03, 0x11, 0x00, 0x3F, 0x00 };
+	jpeg.append(sos, sizeof(sos));
+	if (size > jpeg.size() + 2) {
+		fillPayload(jpeg, size - jpeg.size() - 2);
+	}
+	jpeg.append("\xFF\xD9", 2);
+	return jpeg;
+}
+
+// -----------------------------------------
+//    FramedSource that deliver a synthetic frame on request
+// -----------------------------------------
+class FrameFeeder : public FramedSource
+{
+	public:
+		static FrameFeeder* createNew(UsageEnvironment& env, const std::string & frame, unsigned int frameDurationUs = 33333) {
+			return new FrameFeeder(env, frame, frameDurationUs);
+		}
+
+		// allow one frame to be delivered, immediately if a consumer is waiting
+		void push() {
+			m_credits++;
+			if (isCurrentlyAwaitingData()) {
+				deliver();
+			}
+		}
+
+	protected:
+		FrameFeeder(UsageEnvironment& env, const std::string & frame, unsigned int frameDurationUs)
+			: FramedSource(env), m_frame(frame), m_frameDurationUs(frameDurationUs), m_credits(0) {
+			gettimeofday(&m_time, NULL);
+		}
+
+		virtual void doGetNextFrame() {
+			if (m_credits > 0) {
+				deliver();
+			}
+		}
+
+		void deliver() {
+			m_credits--;
+			fFrameSize = m_frame.size();
+			if (fFrameSize > fMaxSize) {
+				fNumTruncatedBytes = fFrameSize - fMaxSize;
+				fFrameSize = fMaxSize;
+			} else {
+				fNumTruncatedBytes = 0;
+			}
+			memcpy(fTo, m_frame.c_str(), fFrameSize);
+			fPresentationTime = m_time;
+			fDurationInMicroseconds = m_frameDurationUs;
+			m_time.tv_usec += m_frameDurationUs;
+			m_time.tv_sec  += m_time.tv_usec / 1000000;
+			m_time.tv_usec %= 1000000;
+			FramedSource::afterGetting(this);
+		}
+
+	private:
+		std::string  m_frame;
+		unsigned int m_frameDurationUs;
+		int          m_credits;
+		timeval      m_time;
+};
+
+// read one frame from a source whose input is a FrameFeeder
+struct FrameReader
+{
+	FrameReader(size_t bufferSize) : m_buffer(bufferSize), m_frameSize(0) {}
+
+	unsigned int read(FrameFeeder* feeder, FramedSource* source) {
+		m_frameSize = 0;
+		source->getNextFrame(&m_buffer[0], m_buffer.size(), afterGettingFrame, this, NULL, NULL);
+		feeder->push();
+		return m_frameSize;
+	}
+
+	static void afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds) {
+		((FrameReader*)clientData)->m_frameSize = frameSize;
+	}
+
+	std::vector<unsigned char> m_buffer;
+	unsigned int               m_frameSize;
+};
+
+// expose the parsing of the H264 device source
+class BenchH264Source : public H264_V4L2DeviceSource
+{
+	public:
+		static BenchH264Source* createNew(UsageEnvironment& env, bool repeatConfig) {
+			return new BenchH264Source(env, repeatConfig);
+		}
+		using H26X_V4L2DeviceSource::extractFrame;
+		using H264_V4L2DeviceSource::splitFrames;
+		using V4L2DeviceSource::processFrame;
+
+	protected:
+		BenchH264Source(UsageEnvironment& env, bool repeatConfig)
+			: H264_V4L2DeviceSource(env, NULL, -1, 10, false, repeatConfig, false) {}
+};
+
+// -----------------------------------------
+//    benchmarks
+// -----------------------------------------
+static void setFrameRate(benchmark::State& state, size_t frameSize) {
+	state.SetItemsProcessed(state.iterations());
+	state.SetBytesProcessed(state.iterations() * frameSize);
+}
+
+// copies and allocations done by the pipeline during a benchmark
+class CopyCounter
+{
+	public:
+		CopyCounter() : m_copies(copies()), m_copiedBytes(copiedBytes()), m_allocations(allocations()) {}
+
+		void report(benchmark::State& state) {
+			double frames = state.iterations();
+			state.counters["copies/frame"] = (copies() - m_copies) / frames;
+			state.counters["copied_bytes/frame"] = (copiedBytes() - m_copiedBytes) / frames;
+			state.counters["allocs/frame"] = (allocations() - m_allocations) / frames;
+		}
+
+	private:
+		static uint64_t copies() {
+			uint64_t total = 0;
+			for (int stage = 0; stage < CopyMetrics::NB_STAGES; ++stage) total += CopyMetrics::copies((CopyMetrics::Stage)stage);
+			return total;
+		}
+		static uint64_t copiedBytes() {
+			uint64_t total = 0;
+			for (int stage = 0; stage < CopyMetrics::NB_STAGES; ++stage) total += CopyMetrics::copiedBytes((CopyMetrics::Stage)stage);
+			return total;
+		}
+		static uint64_t allocations() {
+			uint64_t total = 0;
+			for (int stage = 0; stage < CopyMetrics::NB_STAGES; ++stage) total += CopyMetrics::allocations((CopyMetrics::Stage)stage);
+			return total;
+		}
+
+		uint64_t m_copies;
+		uint64_t m_copiedBytes;
+		uint64_t m_allocations;
+};
+
+// memcpy done by the feeder, to substract from the filter benchmarks
+static void BM_FeederCopy(benchmark::State& state) {
+	std::string frame(state.range(0), '\x01');
+	FrameFeeder* feeder = FrameFeeder::createNew(benchEnv(), frame);
+	FrameReader reader(frame.size());
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(reader.read(feeder, feeder));
+	}
+	setFrameRate(state, frame.size());
+	Medium::close(feeder);
+}
+BENCHMARK(BM_FeederCopy)->Arg(16<<10)->Arg(256<<10)->Arg(1<<20)->Arg(4<<20);
+
+// RSDeviceSource::thread() : allocate a frame and copy the SDK buffer
+static void BM_RSCaptureCopy(benchmark::State& state) {
+	size_t frameSize = state.range(0) * state.range(1) * 2;
+	std::vector<char> sdkBuffer(frameSize, 1);
+	for (auto _ : state) {
+		char* buf = new char[frameSize];
+		memcpy(buf, &sdkBuffer[0], frameSize);
+		benchmark::DoNotOptimize(buf);
+		benchmark::ClobberMemory();
+		delete [] buf;
+	}
+	setFrameRate(state, frameSize);
+}
+BENCHMARK(BM_RSCaptureCopy)->Args({480,270})->Args({640,480})->Args({848,480})->Args({1280,720});
+
+// H26X_V4L2DeviceSource::extractFrame() over a full access unit
+static void BM_H264ExtractFrame(benchmark::State& state) {
+	std::string au = makeH264AccessUnit(state.range(0));
+	BenchH264Source* source = BenchH264Source::createNew(benchEnv(), false);
+	for (auto _ : state) {
+		size_t bufSize = au.size();
+		size_t size = 0;
+		int frameType = 0;
+		unsigned char* buffer = source->extractFrame((unsigned char*)au.c_str(), bufSize, size, frameType);
+		while (buffer != NULL) {
+			buffer = source->extractFrame(&buffer[size], bufSize, size, frameType);
+		}
+		benchmark::DoNotOptimize(frameType);
+	}
+	setFrameRate(state, au.size());
+}
+BENCHMARK(BM_H264ExtractFrame)->Arg(16<<10)->Arg(256<<10)->Arg(1<<20)->Arg(4<<20);
+
+// H264_V4L2DeviceSource::splitFrames() including SPS/PPS handling
+static void BM_H264SplitFrames(benchmark::State& state) {
+	std::string au = makeH264AccessUnit(state.range(0));
+	BenchH264Source* source = BenchH264Source::createNew(benchEnv(), true);
+	for (auto _ : state) {
+		std::list< std::pair<unsigned char*,size_t> > frameList = source->splitFrames((unsigned char*)au.c_str(), au.size());
+		benchmark::DoNotOptimize(frameList.size());
+	}
+	setFrameRate(state, au.size());
+}
+BENCHMARK(BM_H264SplitFrames)->Arg(16<<10)->Arg(256<<10)->Arg(1<<20)->Arg(4<<20);
+
+// V4L2DeviceSource::processFrame() : split, copy each NAL and queue it
+static void BM_H264ProcessFrame(benchmark::State& state) {
+	std::string au = makeH264AccessUnit(state.range(0));
+	BenchH264Source* source = BenchH264Source::createNew(benchEnv(), true);
+	timeval ref;
+	gettimeofday(&ref, NULL);
+	CopyCounter counter;
+	for (auto _ : state) {
+		source->processFrame((char*)au.c_str(), au.size(), ref);
+	}
+	setFrameRate(state, au.size());
+	counter.report(state);
+}
+BENCHMARK(BM_H264ProcessFrame)->Arg(16<<10)->Arg(256<<10)->Arg(1<<20)->Arg(4<<20);
+
+// MJPEGVideoSource::afterGettingFrame() : header parsing and removal
+static void BM_MJPEGAfterGettingFrame(benchmark::State& state) {
+	std::string jpeg = makeJPEG(state.range(0), 1920, 1080);
+	FrameFeeder* feeder = FrameFeeder::createNew(benchEnv(), jpeg);
+	MJPEGVideoSource* source = MJPEGVideoSource::createNew(benchEnv(), feeder);
+	FrameReader reader(jpeg.size());
+	CopyCounter counter;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(reader.read(feeder, source));
+	}
+	setFrameRate(state, jpeg.size());
+	counter.report(state);
+	Medium::close(source);
+}
+BENCHMARK(BM_MJPEGAfterGettingFrame)->Arg(64<<10)->Arg(256<<10)->Arg(1<<20);
+
+// JPEGHeaderParser::parse() : segment walk and cached header compare
+static void BM_JPEGHeaderParse(benchmark::State& state) {
+	std::string jpeg = makeJPEG(256<<10, state.range(0), state.range(0)*9/16);
+	JPEGHeaderParser parser;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(parser.parse((const unsigned char*)jpeg.c_str(), jpeg.size()));
+	}
+	setFrameRate(state, jpeg.size());
+}
+BENCHMARK(BM_JPEGHeaderParse)->Arg(1920)->Arg(4096);
+
+// AddH26xMarkerFilter : add the Annex-B start code to a NAL
+static void BM_AddH26xMarker(benchmark::State& state) {
+	std::string nal("\x65", 1);
+	fillPayload(nal, state.range(0) - 1);
+	FrameFeeder* feeder = FrameFeeder::createNew(benchEnv(), nal);
+	AddH26xMarkerFilter* filter = new AddH26xMarkerFilter(benchEnv(), feeder);
+	FrameReader reader(nal.size() + 4);
+	CopyCounter counter;
+	for (auto _ : state) {
+		benchmark::DoNotOptimize(reader.read(feeder, filter));
+	}
+	setFrameRate(state, nal.size());
+	counter.report(state);
+	Medium::close(filter);
+}
+BENCHMARK(BM_AddH26xMarker)->Arg(1<<10)->Arg(16<<10)->Arg(256<<10)->Arg(1<<20);
+
+// MemoryBufferSink::afterGettingFrame() : append to the HLS slice chunks
+static void BM_MemoryBufferSinkAppend(benchmark::State& state) {
+	std::string frame(state.range(0), '\x47');
+	FrameFeeder* feeder = FrameFeeder::createNew(benchEnv(), frame);
+	// store sized to keep the retained slices of 2s at 30fps without dropping
+	size_t maxBytes = std::max((size_t)(32<<20), frame.size()*30*2*4);
+	MemoryBufferSink* sink = MemoryBufferSink::createNew(benchEnv(), frame.size(), 2, 0, maxBytes);
+	sink->startPlaying(*feeder, NULL, NULL);
+	CopyCounter counter;
+	for (auto _ : state) {
+		feeder->push();
+	}
+	setFrameRate(state, frame.size());
+	counter.report(state);
+	Medium::close(sink);
+	Medium::close(feeder);
+}
+BENCHMARK(BM_MemoryBufferSinkAppend)->Arg(188*7)->Arg(16<<10)->Arg(256<<10)->Arg(1<<20);
+
+BENCHMARK_MAIN();
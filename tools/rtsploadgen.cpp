@@ -0,0 +1,541 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** rtsploadgen.cpp
+**
+** RTSP load generator
+**
+** Ramp from 1 to N RTSP clients (RTP/UDP and/or RTP/TCP interleaved) against
+** a running server and print a scaling curve : session setup time, per-client
+** throughput, frame rate, RTP loss, server RSS and server CPU at each step.
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <list>
+#include <algorithm>
+#include <iterator>
+
+// live555
+#include <liveMedia.hh>
+#include <BasicUsageEnvironment.hh>
+
+// -----------------------------------------
+//    helpers
+// -----------------------------------------
+static double elapsedMs(const timeval & from, const timeval & to) {
+	return (to.tv_sec - from.tv_sec)*1000.0 + (to.tv_usec - from.tv_usec)/1000.0;
+}
+
+// read VmRSS (kB) of a process
+static unsigned long readRss(int pid) {
+	unsigned long rss = 0;
+	std::ostringstream path;
+	path << "/proc/" << pid << "/status";
+	std::ifstream status(path.str().c_str());
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, 6, "VmRSS:") == 0) {
+			rss = strtoul(line.c_str()+6, NULL, 10);
+			break;
+		}
+	}
+	return rss;
+}
+
+// read utime+stime (clock ticks) of a process
+static unsigned long long readCpuTicks(int pid) {
+	unsigned long long ticks = 0;
+	std::ostringstream path;
+	path << "/proc/" << pid << "/stat";
+	std::ifstream stat(path.str().c_str());
+	std::string content((std::istreambuf_iterator<char>(stat)), std::istreambuf_iterator<char>());
+	// skip "pid (comm)" as comm could contains spaces
+	size_t pos = content.rfind(')');
+	if (pos != std::string::npos) {
+		std::istringstream is(content.substr(pos+2));
+		std::string field;
+		unsigned long long utime = 0, stime = 0;
+		// state is field 3, utime field 14, stime field 15
+		for (int i = 3; (i <= 15) && (is >> field); ++i) {
+			if (i == 14) utime = strtoull(field.c_str(), NULL, 10);
+			if (i == 15) stime = strtoull(field.c_str(), NULL, 10);
+		}
+		ticks = utime + stime;
+	}
+	return ticks;
+}
+
+// -----------------------------------------
+//    Sink that only count what it receives
+// -----------------------------------------
+class CountingSink : public MediaSink
+{
+	public:
+		static CountingSink* createNew(UsageEnvironment& env, unsigned int bufferSize) {
+			return new CountingSink(env, bufferSize);
+		}
+
+		u_int64_t m_bytes;
+		u_int64_t m_frames;
+
+	protected:
+		CountingSink(UsageEnvironment& env, unsigned int bufferSize) : MediaSink(env), m_bytes(0), m_frames(0), m_bufferSize(bufferSize) {
+			m_buffer = new unsigned char[m_bufferSize];
+		}
+		virtual ~CountingSink() {
+			delete [] m_buffer;
+		}
+
+		static void afterGettingFrame(void* clientData, unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime, unsigned durationInMicroseconds) {
+			CountingSink* sink = (CountingSink*)clientData;
+			sink->m_bytes += frameSize + numTruncatedBytes;
+			sink->m_frames++;
+			sink->continuePlaying();
+		}
+
+		virtual Boolean continuePlaying() {
+			Boolean ret = False;
+			if (fSource != NULL) {
+				fSource->getNextFrame(m_buffer, m_bufferSize, afterGettingFrame, this, onSourceClosure, this);
+				ret = True;
+			}
+			return ret;
+		}
+
+	private:
+		unsigned char* m_buffer;
+		unsigned int   m_bufferSize;
+};
+
+// -----------------------------------------
+//    Simulated RTSP client
+// -----------------------------------------
+class LoadClient : public RTSPClient
+{
+	public:
+		static LoadClient* createNew(UsageEnvironment& env, const char* url, bool useTCP, int verbose) {
+			return new LoadClient(env, url, useTCP, verbose);
+		}
+
+		void start() {
+			gettimeofday(&m_start, NULL);
+			this->sendDescribeCommand(continueAfterDESCRIBE);
+		}
+
+		bool isPlaying()  { return m_playing; }
+		bool hasFailed()  { return m_failed; }
+		bool useTCP()     { return m_useTCP; }
+		double describeMs() { return elapsedMs(m_start, m_described); }
+		double setupMs()    { return elapsedMs(m_described, m_setup); }
+		double playMs()     { return elapsedMs(m_setup, m_played); }
+		double totalMs()    { return elapsedMs(m_start, m_played); }
+
+		// counters accumulated over all the subsessions
+		void getCounters(u_int64_t & bytes, u_int64_t & frames, u_int64_t & expected, u_int64_t & received) {
+			bytes = frames = expected = received = 0;
+			if (m_session != NULL) {
+				MediaSubsessionIterator iter(*m_session);
+				MediaSubsession* subsession = NULL;
+				while ((subsession = iter.next()) != NULL) {
+					CountingSink* sink = (CountingSink*)subsession->sink;
+					if (sink != NULL) {
+						bytes  += sink->m_bytes;
+						frames += sink->m_frames;
+					}
+					RTPSource* rtpSource = subsession->rtpSource();
+					if (rtpSource != NULL) {
+						RTPReceptionStatsDB::Iterator statsIter(rtpSource->receptionStatsDB());
+						RTPReceptionStats* stats = NULL;
+						while ((stats = statsIter.next(True)) != NULL) {
+							expected += stats->totNumPacketsExpected();
+							received += stats->totNumPacketsReceived();
+						}
+					}
+				}
+			}
+		}
+
+		void shutdown() {
+			if (m_session != NULL) {
+				MediaSubsessionIterator iter(*m_session);
+				MediaSubsession* subsession = NULL;
+				while ((subsession = iter.next()) != NULL) {
+					if (subsession->sink != NULL) {
+						Medium::close(subsession->sink);
+						subsession->sink = NULL;
+					}
+				}
+				if (m_playing) {
+					this->sendTeardownCommand(*m_session, NULL);
+				}
+			}
+			Medium::close(this);
+		}
+
+	protected:
+		LoadClient(UsageEnvironment& env, const char* url, bool useTCP, int verbose)
+			: RTSPClient(env, url, verbose, "rtsploadgen", 0, -1),
+			m_useTCP(useTCP), m_playing(false), m_failed(false), m_session(NULL), m_iter(NULL) {
+			memset(&m_start, 0, sizeof(m_start));
+			memset(&m_described, 0, sizeof(m_described));
+			memset(&m_setup, 0, sizeof(m_setup));
+			memset(&m_played, 0, sizeof(m_played));
+		}
+		virtual ~LoadClient() {
+			delete m_iter;
+			Medium::close(m_session);
+		}
+
+		void fail(const char* step, int resultCode, char* resultString) {
+			envir() << "[" << url() << "] " << step << " failed:" << resultCode << " " << (resultString ? resultString : "") << "\n";
+			m_failed = true;
+		}
+
+		static void continueAfterDESCRIBE(RTSPClient* rtspClient, int resultCode, char* resultString) {
+			((LoadClient*)rtspClient)->afterDESCRIBE(resultCode, resultString);
+			delete [] resultString;
+		}
+		void afterDESCRIBE(int resultCode, char* resultString) {
+			gettimeofday(&m_described, NULL);
+			if (resultCode != 0) {
+				fail("DESCRIBE", resultCode, resultString);
+			} else {
+				m_session = MediaSession::createNew(envir(), resultString);
+				if ( (m_session == NULL) || (!m_session->hasSubsessions()) ) {
+					fail("SDP", resultCode, NULL);
+				} else {
+					m_iter = new MediaSubsessionIterator(*m_session);
+					setupNextSubsession();
+				}
+			}
+		}
+
+		void setupNextSubsession() {
+			MediaSubsession* subsession = NULL;
+			while ((subsession = m_iter->next()) != NULL) {
+				if (subsession->initiate()) {
+					this->sendSetupCommand(*subsession, continueAfterSETUP, False, m_useTCP);
+					return;
+				}
+			}
+			gettimeofday(&m_setup, NULL);
+			this->sendPlayCommand(*m_session, continueAfterPLAY);
+		}
+
+		static void continueAfterSETUP(RTSPClient* rtspClient, int resultCode, char* resultString) {
+			((LoadClient*)rtspClient)->afterSETUP(resultCode, resultString);
+			delete [] resultString;
+		}
+		void afterSETUP(int resultCode, char* resultString) {
+			if (resultCode != 0) {
+				fail("SETUP", resultCode, resultString);
+			} else {
+				m_iter->reset();
+				MediaSubsession* subsession = NULL;
+				while ((subsession = m_iter->next()) != NULL) {
+					if ( (subsession->sink == NULL) && (subsession->readSource() != NULL) ) {
+						subsession->sink = CountingSink::createNew(envir(), OutPacketBuffer::maxSize);
+						subsession->sink->startPlaying(*(subsession->readSource()), NULL, NULL);
+						break;
+					}
+				}
+				setupNextSubsession();
+			}
+		}
+
+		static void continueAfterPLAY(RTSPClient* rtspClient, int resultCode, char* resultString) {
+			((LoadClient*)rtspClient)->afterPLAY(resultCode, resultString);
+			delete [] resultString;
+		}
+		void afterPLAY(int resultCode, char* resultString) {
+			gettimeofday(&m_played, NULL);
+			if (resultCode != 0) {
+				fail("PLAY", resultCode, resultString);
+			} else {
+				m_playing = true;
+			}
+		}
+
+	private:
+		bool                     m_useTCP;
+		bool                     m_playing;
+		bool                     m_failed;
+		MediaSession*            m_session;
+		MediaSubsessionIterator* m_iter;
+		timeval                  m_start;
+		timeval                  m_described;
+		timeval                  m_setup;
+		timeval                  m_played;
+};
+
+// -----------------------------------------
+//    Ramp 1..N clients and print the curve
+// -----------------------------------------
+class LoadGenerator
+{
+	public:
+		enum Transport { UDP, TCP, MIXED };
+
+		LoadGenerator(UsageEnvironment& env, const std::string & url, unsigned int maxClients, unsigned int step, unsigned int dwell, Transport transport, int pid, int verbose, char & quit)
+			: m_env(env), m_url(url), m_maxClients(maxClients), m_step(step), m_dwell(dwell), m_transport(transport), m_pid(pid), m_verbose(verbose), m_quit(quit),
+			m_bytes(0), m_frames(0), m_expected(0), m_received(0), m_cpuTicks(0) {
+			memset(&m_sampleTime, 0, sizeof(m_sampleTime));
+		}
+
+		~LoadGenerator() {
+			for (std::list<LoadClient*>::iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+				(*it)->shutdown();
+			}
+		}
+
+		void start() {
+			std::cout << std::setw(8) << "clients"
+			          << std::setw(9) << "failed"
+			          << std::setw(12) << "describe"
+			          << std::setw(10) << "setup"
+			          << std::setw(10) << "play"
+			          << std::setw(12) << "setup-max"
+			          << std::setw(14) << "kbps/client"
+			          << std::setw(14) << "kbps-min"
+			          << std::setw(12) << "fps/client"
+			          << std::setw(9) << "loss%"
+			          << std::setw(10) << "rss(MB)"
+			          << std::setw(8) << "cpu%"
+			          << std::setw(14) << "clients/core" << std::endl;
+			addClients();
+		}
+
+	protected:
+		static void settleStub(void* clientData) { ((LoadGenerator*)clientData)->settle(); }
+		static void sampleStub(void* clientData) { ((LoadGenerator*)clientData)->sample(); }
+
+		// start the clients of the next step
+		void addClients() {
+			m_newClients.clear();
+			for (unsigned int i = 0; (i < m_step) && (m_clients.size() < m_maxClients); ++i) {
+				bool useTCP = (m_transport == TCP) || ( (m_transport == MIXED) && (m_clients.size() % 2) );
+				LoadClient* client = LoadClient::createNew(m_env, m_url.c_str(), useTCP, m_verbose);
+				m_clients.push_back(client);
+				m_newClients.push_back(client);
+				client->start();
+			}
+			// let the new sessions settle before measuring
+			m_env.taskScheduler().scheduleDelayedTask(1000000, settleStub, this);
+		}
+
+		void settle() {
+			snapshot(m_clientBytes, m_bytes, m_frames, m_expected, m_received);
+			m_cpuTicks = (m_pid > 0) ? readCpuTicks(m_pid) : 0;
+			gettimeofday(&m_sampleTime, NULL);
+			m_env.taskScheduler().scheduleDelayedTask(m_dwell*1000000LL, sampleStub, this);
+		}
+
+		// total counters and bytes of each client in the client list order
+		void snapshot(std::list<u_int64_t> & clientBytes, u_int64_t & bytes, u_int64_t & frames, u_int64_t & expected, u_int64_t & received) {
+			clientBytes.clear();
+			bytes = frames = expected = received = 0;
+			for (std::list<LoadClient*>::iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+				u_int64_t b, f, e, r;
+				(*it)->getCounters(b, f, e, r);
+				clientBytes.push_back(b);
+				bytes += b; frames += f; expected += e; received += r;
+			}
+		}
+
+		// measure the interval and print one point of the curve
+		void sample() {
+			timeval now;
+			gettimeofday(&now, NULL);
+			double interval = elapsedMs(m_sampleTime, now)/1000.0;
+
+			unsigned int playing = 0;
+			unsigned int failed = 0;
+			double minKbps = -1;
+			for (std::list<LoadClient*>::iterator it = m_clients.begin(); it != m_clients.end(); ++it) {
+				if ((*it)->hasFailed()) {
+					failed++;
+				} else if ((*it)->isPlaying()) {
+					playing++;
+				}
+			}
+
+			std::list<u_int64_t> clientBytes;
+			u_int64_t bytes, frames, expected, received;
+			snapshot(clientBytes, bytes, frames, expected, received);
+
+			std::list<u_int64_t>::iterator prevIt = m_clientBytes.begin();
+			std::list<u_int64_t>::iterator curIt = clientBytes.begin();
+			for (std::list<LoadClient*>::iterator it = m_clients.begin(); it != m_clients.end(); ++it, ++prevIt, ++curIt) {
+				if ((*it)->isPlaying()) {
+					double kbps = (*curIt - *prevIt)*8/1000.0/interval;
+					if ( (minKbps < 0) || (kbps < minKbps) ) {
+						minKbps = kbps;
+					}
+				}
+			}
+
+			double describe = 0, setup = 0, play = 0, setupMax = 0;
+			unsigned int nbNew = 0;
+			for (std::list<LoadClient*>::iterator it = m_newClients.begin(); it != m_newClients.end(); ++it) {
+				if ((*it)->isPlaying()) {
+					describe += (*it)->describeMs();
+					setup    += (*it)->setupMs();
+					play     += (*it)->playMs();
+					setupMax  = std::max(setupMax, (*it)->totalMs());
+					nbNew++;
+				}
+			}
+			if (nbNew) {
+				describe /= nbNew; setup /= nbNew; play /= nbNew;
+			}
+
+			double kbps = playing ? (bytes - m_bytes)*8/1000.0/interval/playing : 0;
+			double fps  = playing ? (frames - m_frames)/interval/playing : 0;
+			u_int64_t expectedDelta = expected - m_expected;
+			u_int64_t receivedDelta = received - m_received;
+			double loss = (expectedDelta > receivedDelta) ? (expectedDelta - receivedDelta)*100.0/expectedDelta : 0;
+
+			double rss = 0, cpu = 0;
+			if (m_pid > 0) {
+				rss = readRss(m_pid)/1024.0;
+				cpu = (readCpuTicks(m_pid) - m_cpuTicks)*100.0/sysconf(_SC_CLK_TCK)/interval;
+			}
+
+			std::cout << std::fixed << std::setprecision(1)
+			          << std::setw(8) << m_clients.size()
+			          << std::setw(9) << failed
+			          << std::setw(12) << describe
+			          << std::setw(10) << setup
+			          << std::setw(10) << play
+			          << std::setw(12) << setupMax
+			          << std::setw(14) << kbps
+			          << std::setw(14) << std::max(minKbps, 0.0)
+			          << std::setw(12) << fps
+			          << std::setw(9) << loss
+			          << std::setw(10) << rss
+			          << std::setw(8) << cpu
+			          << std::setw(14) << ((cpu > 0) ? playing*100.0/cpu : 0) << std::endl;
+
+			if (m_clients.size() < m_maxClients) {
+				addClients();
+			} else {
+				m_quit = 1;
+			}
+		}
+
+	private:
+		UsageEnvironment&      m_env;
+		std::string            m_url;
+		unsigned int           m_maxClients;
+		unsigned int           m_step;
+		unsigned int           m_dwell;
+		Transport              m_transport;
+		int                    m_pid;
+		int                    m_verbose;
+		char&                  m_quit;
+		std::list<LoadClient*> m_clients;
+		std::list<LoadClient*> m_newClients;
+		std::list<u_int64_t>   m_clientBytes;
+		u_int64_t              m_bytes;
+		u_int64_t              m_frames;
+		u_int64_t              m_expected;
+		u_int64_t              m_received;
+		unsigned long long     m_cpuTicks;
+		timeval                m_sampleTime;
+};
+
+// -----------------------------------------
+//    signal handler
+// -----------------------------------------
+char quit = 0;
+void sighandler(int n)
+{
+	printf("SIGINT\n");
+	quit =1;
+}
+
+// -----------------------------------------
+//    usage
+// -----------------------------------------
+void usage(std::string name) {
+	std::cout << name << " [-v[v]] [-n clients] [-s step] [-d seconds] [-T udp|tcp|mixed] [-p pid] rtsp://url" << std::endl;
+	std::cout << "\t -v               : verbose"                                                     << std::endl;
+	std::cout << "\t -vv              : very verbose"                                                << std::endl;
+	std::cout << "\t -n <clients>     : maximum number of clients (default 16)"                      << std::endl;
+	std::cout << "\t -s <step>        : number of clients added at each step (default 1)"            << std::endl;
+	std::cout << "\t -d <seconds>     : measurement duration of each step (default 5)"               << std::endl;
+	std::cout << "\t -T <transport>   : RTP transport udp, tcp or mixed (default udp)"              << std::endl;
+	std::cout << "\t -p <pid>         : server process to monitor RSS and CPU"                       << std::endl;
+	exit(0);
+}
+
+// -----------------------------------------
+//    entry point
+// -----------------------------------------
+int main(int argc, char** argv) {
+	int verbose = 0;
+	unsigned int maxClients = 16;
+	unsigned int step = 1;
+	unsigned int dwell = 5;
+	int pid = 0;
+	LoadGenerator::Transport transport = LoadGenerator::UDP;
+
+	int c = 0;
+	while ((c = getopt (argc, argv, "v::n:s:d:T:p:h")) != -1) {
+		switch (c) {
+		case 'v':	verbose    = 1; if (optarg && *optarg=='v') verbose++;  break;
+		case 'n':	maxClients = atoi(optarg); break;
+		case 's':	step       = atoi(optarg); break;
+		case 'd':	dwell      = atoi(optarg); break;
+		case 'p':	pid        = atoi(optarg); break;
+		case 'T':
+			if (strcmp(optarg, "tcp") == 0) {
+				transport = LoadGenerator::TCP;
+			} else if (strcmp(optarg, "mixed") == 0) {
+				transport = LoadGenerator::MIXED;
+			} else {
+				transport = LoadGenerator::UDP;
+			}
+		break;
+		case 'h':
+		default:	usage(argv[0]);
+		}
+	}
+	if ( (optind >= argc) || (maxClients == 0) || (step == 0) || (dwell == 0) ) {
+		usage(argv[0]);
+	}
+
+	// create live555 environment
+	TaskScheduler* scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment* env = BasicUsageEnvironment::createNew(*scheduler);
+
+	// the server send raw depth frames bigger than the default buffer
+	OutPacketBuffer::maxSize = 1025 * 1024;
+
+	{
+		LoadGenerator generator(*env, argv[optind], maxClients, step, dwell, transport, pid, verbose, quit);
+		generator.start();
+
+		signal(SIGINT,sighandler);
+		env->taskScheduler().doEventLoop(&quit);
+	}
+
+	env->reclaim();
+	delete scheduler;
+
+	return 0;
+}